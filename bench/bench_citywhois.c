@@ -0,0 +1,87 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../citywhois/citywhois.c"
+#include "bench.h"
+#include "population.h"
+
+static Client *oper;
+
+static void setup(void) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+
+    mock_config_add(mock_config_add(root, MYCONF, NULL), "db", TEST_MMDB);
+    if (mock_module_load(root) < 0)
+        exit(1);
+    mock_config_free(root);
+    oper = mock_local_user("oper", "oper", "192.0.2.1");
+    oper->umodes |= UMODE_OPER;
+}
+
+static void teardown(void) {
+    mock_module_unload(0);
+    mock_reset();
+}
+
+static void whois_loop(BenchState *state, Client *target) {
+    while (bench_keep_running(state)) {
+        NameValuePrioList *list = NULL;
+        citywhois_whois(oper, target, &list);
+        free_nvplist(list);
+    }
+}
+
+// A city found, with the WHOIS line built and freed as the core does
+static void BM_whois_ipv4(BenchState *state) {
+    setup();
+    whois_loop(state, mock_local_user("target", "target", "10.3.7.1"));
+    teardown();
+}
+BENCHMARK(BM_whois_ipv4);
+
+static void BM_whois_ipv6(BenchState *state) {
+    setup();
+    whois_loop(state, mock_local_user("target", "target", "2001:db8:7::1"));
+    teardown();
+}
+BENCHMARK(BM_whois_ipv6);
+
+static void BM_whois_not_found(BenchState *state) {
+    setup();
+    whois_loop(state, mock_local_user("target", "target", "192.0.2.77"));
+    teardown();
+}
+BENCHMARK(BM_whois_not_found);
+
+// WHOIS on each user of a population in turn, spread over the whole database
+static void BM_whois_population(BenchState *state) {
+    PopulationOptions opt = { .users = state->arg, .v6_percent = 30, .seed = 5 };
+    Client **users;
+    long n = 0;
+
+    setup();
+    users = population_create(&opt);
+    while (bench_keep_running(state)) {
+        NameValuePrioList *list = NULL;
+        citywhois_whois(oper, users[n++ % state->arg], &list);
+        free_nvplist(list);
+    }
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ARG(BM_whois_population, 10000);
+
+// The MaxMind lookup alone, without building the WHOIS line
+static void BM_mmdb_lookup(BenchState *state) {
+    int gai_error, mmdb_error;
+
+    setup();
+    while (bench_keep_running(state)) {
+        MMDB_lookup_result_s result = MMDB_lookup_string(&citywhois_config.mmdb, "10.3.7.1", &gai_error, &mmdb_error);
+        bench_keep(result.found_entry);
+    }
+    teardown();
+}
+BENCHMARK(BM_mmdb_lookup);
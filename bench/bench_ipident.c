@@ -0,0 +1,76 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * ipident: cost of computing the ident in the LOCAL_CONNECT hook, by
+ * address family and number of cloak keys.
+ */
+#include "../ipident/ipident.c"
+#include "bench.h"
+#include "population.h"
+
+static const char *keys[] = {
+    "yY90gBRfJMSqN45WSLM9ttPQB57cVJbTN3nkDi5ZwGtXwn4pZ9JcJFGNwtJX82W8mBBXzJxUXPxwkMNJaP9fXcrxz7ApihCBp3YUt2TSAWp4TFTRfmQBAvHCc",
+    "8ed78KM7yhyS8E2SDrVX9t7c8CYQ2YKcQrVff5Keg9dpp6BgTzPE4Jk9wA99HcMShmwp3ntZnnunuzUBwtJuQqMaXTBD8XuVRg3eVGgGARqxHy4YfYMXEnbxY",
+    "RcsG6RXNZZitkdtuhvzGVpY6cHEFdvAWunFnbSvEzJhV3zCrSYG56HiQaT3ES5TFc4YywgaZVxepyQBNWcvtD2U3ddG4rCKanZPjV6TMT4jg6YrbQ4dMvHRit",
+    "Hq4uBs8fn2yPxd7VJ6cZk3Tte9WmRAgLQXN5rYpDjEhwMKGbUS4vCz7aF8J2nT6xqkePd3VRsLgm9WBYHuZtXAcf5Nj2yKQErDwvGp8UhMbTs6n4CzLaJxR7",
+    "m3X8dKqT5vL2pW9zRbN6cYhF4jGsAeU7tQxD2nVkP8wJrMZ5yHb3CfE9gTLa6uSdXq4NWk7RpY2zBvGjh5cKmFs8xT3LnAe9DwQrU6tZyJpV4bHg7MXk2NCf",
+};
+
+static void load_ipident(int nkeys) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, "cloak-ident-keys", NULL);
+
+    for (int i = 0; i < nkeys; i++)
+        mock_config_add(block, "key", keys[i]);
+    if (mock_module_load(root) < 0) {
+        fprintf(stderr, "ipident: module failed to load\n");
+        exit(1);
+    }
+    mock_config_free(root);
+}
+
+static void unload_ipident(void) {
+    mock_module_unload(0);
+    mock_reset();
+}
+
+static void ident_for(BenchState *state, const char *ip) {
+    Client *client;
+
+    load_ipident(state->arg);
+    client = mock_local_user("bench", "user", ip);
+    while (bench_keep_running(state))
+        set_crypto_ip_based_ident(client);
+    bench_set_label(state, "%s", client->user->username);
+    unload_ipident();
+}
+
+static void BM_ident_ipv4(BenchState *state) {
+    ident_for(state, "10.1.2.3");
+}
+BENCHMARK_ARG(BM_ident_ipv4, 1);
+BENCHMARK_ARG(BM_ident_ipv4, 5);
+
+static void BM_ident_ipv6(BenchState *state) {
+    ident_for(state, "2001:db8:1:2:3:4:5:6");
+}
+BENCHMARK_ARG(BM_ident_ipv6, 1);
+BENCHMARK_ARG(BM_ident_ipv6, 5);
+
+// A connect burst: every user of a mixed population once
+static void BM_ident_population(BenchState *state) {
+    PopulationOptions opt = { .users = state->arg, .v6_percent = 30, .clones = 2 };
+    Client **users;
+    uint64_t i = 0;
+
+    load_ipident(3);
+    users = population_create(&opt);
+    while (bench_keep_running(state))
+        set_crypto_ip_based_ident(users[i++ % opt.users]);
+    safe_free(users);
+    unload_ipident();
+}
+BENCHMARK_ARG(BM_ident_population, 10000);
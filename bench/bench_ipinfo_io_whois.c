@@ -0,0 +1,110 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../ipinfo_io_whois/ipinfo_io_whois.c"
+#include "bench.h"
+#include "population.h"
+
+#define ANSWER "{\"ip\": \"10.0.0.1\", \"city\": \"Leiden\", \"region\": \"South Holland\", \"country\": \"NL\", \"org\": \"AS64496 Example\"}"
+
+static Client *oper;
+
+static void setup(void) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+
+    mock_config_add(mock_config_add(root, MYCONF, NULL), "apikey", "KEY");
+    if (mock_module_load(root) < 0)
+        exit(1);
+    mock_config_free(root);
+    oper = mock_local_user("oper", "oper", "192.0.2.1");
+    oper->umodes |= UMODE_OPER;
+}
+
+static void teardown(void) {
+    mock_module_unload(0);
+    mock_reset();
+}
+
+// Fill the cache with the IPs of this many population users
+static Client **fill_cache(int nusers) {
+    PopulationOptions opt = { .users = nusers, .v6_percent = 30, .seed = 9 };
+    Client **users = population_create(&opt);
+
+    for (int i = 0; i < nusers; i++)
+        add_to_cache(users[i]->ip, "City: Leiden, Region: South Holland, Country: NL, Org: AS64496 Example");
+    return users;
+}
+
+// WHOIS answered from a cache of arg entries
+static void BM_whois_cache_hit(BenchState *state) {
+    Client **users;
+    long n = 0;
+
+    setup();
+    users = fill_cache(state->arg);
+    while (bench_keep_running(state)) {
+        NameValuePrioList *list = NULL;
+        ipinfo_io_whois_whois(oper, users[n++ % state->arg], &list);
+        free_nvplist(list);
+    }
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ARG(BM_whois_cache_hit, 100);
+BENCHMARK_ARG(BM_whois_cache_hit, 10000);
+
+// WHOIS that has to ask the API: building and queueing the request
+static void BM_whois_cache_miss(BenchState *state) {
+    Client *target;
+
+    setup();
+    target = mock_local_user("target", "target", "10.0.0.1");
+    mock_url_discard = 1;
+    while (bench_keep_running(state)) {
+        NameValuePrioList *list = NULL;
+        ipinfo_io_whois_whois(oper, target, &list);
+    }
+    teardown();
+}
+BENCHMARK(BM_whois_cache_miss);
+
+// The cache lookup alone
+static void BM_find_in_cache(BenchState *state) {
+    Client **users;
+    long n = 0;
+
+    setup();
+    users = fill_cache(state->arg);
+    while (bench_keep_running(state))
+        bench_keep(find_in_cache(users[n++ % state->arg]->ip));
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ARG(BM_find_in_cache, 10000);
+
+// Parsing an API answer and caching it. Each round takes out the entry the
+// previous one added, so the cache does not grow.
+static void BM_callback(BenchState *state) {
+    Client *target;
+
+    setup();
+    target = mock_local_user("target", "target", "10.0.0.1");
+    while (bench_keep_running(state)) {
+        NameValuePrioList *list = NULL;
+        CacheEntry *entry;
+
+        bench_pause(state);
+        ipinfo_io_whois_whois(oper, target, &list);
+        bench_resume(state);
+        mock_url_complete(ANSWER, NULL);
+        bench_pause(state);
+        HASH_FIND_STR(cache, "10.0.0.1", entry);
+        HASH_DEL(cache, entry);
+        free(entry);
+        bench_resume(state);
+    }
+    teardown();
+}
+BENCHMARK(BM_callback);
@@ -0,0 +1,188 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * listsg: /SG through the security group index against the full client
+ * scan it replaced, and the cost of keeping the index up to date.
+ */
+#include "../listsg/listsg.c"
+#include "bench.h"
+#include "population.h"
+
+static Client **users;
+static Client *oper;
+
+// N local users in four groups: everyone, logged in (40%), opers (5%)
+// and a mask matching about one in 256. Extra groups for the update
+// benchmarks never match anyone.
+static void setup(int nusers, int extra_groups) {
+    PopulationOptions opt = { .users = nusers, .loggedin_percent = 40, .oper_percent = 5 };
+    char name[32];
+
+    mock_security_group("everyone");
+    mock_security_group("known-users")->identified = 1;
+    mock_security_group("opers")->oper = 1;
+    mock_security_group("subnet")->mask = our_strdup("*!*@10.0.0.*");
+    for (int i = 0; i < extra_groups; i++) {
+        snprintf(name, sizeof(name), "extra%d", i);
+        mock_security_group(name)->mask = our_strdup("nobody!*@*");
+    }
+
+    users = population_create(&opt);
+    oper = mock_local_user("benchoper", "oper", "192.0.2.1");
+    oper->umodes |= UMODE_OPER;
+    mock_sendq_limit = 1 << 30;
+    if (mock_module_load(NULL) < 0) {
+        fprintf(stderr, "listsg: module failed to load\n");
+        exit(1);
+    }
+}
+
+static void teardown(void) {
+    mock_module_unload(0);
+    mock_reset();
+    safe_free(users);
+}
+
+static void BM_sg_list(BenchState *state) {
+    const char *parv[] = { NULL, "everyone", NULL };
+
+    setup(state->arg, 0);
+    while (bench_keep_running(state)) {
+        oper->local->sendQ.length = 0;
+        mock_run_command(oper, "SG", 2, parv);
+    }
+    bench_set_label(state, "%d members", sg_groups[0].members);
+    teardown();
+}
+BENCHMARK_ARG(BM_sg_list, 1000);
+BENCHMARK_ARG(BM_sg_list, 10000);
+BENCHMARK_ARG(BM_sg_list, 100000);
+
+// The pre-index /SG: evaluate every local client against the group
+static void sg_list_fullscan(Client *client, const char *groupname) {
+    char buffer[MAX_BUFFER_SIZE];
+    int nickname_count = 0;
+    Client *target;
+
+    sendnotice(client, "Members of security group %s:", groupname);
+    buffer[0] = '\0';
+    list_for_each_entry(target, &lclient_list, lclient_node) {
+        if (user_allowed_by_security_group_name(target, groupname)) {
+            if (nickname_count > 0)
+                strlcat(buffer, ", ", sizeof(buffer));
+            strlcat(buffer, target->name, sizeof(buffer));
+            nickname_count++;
+            if (strlen(buffer) >= MAX_BUFFER_SIZE - 50) {
+                sendnotice(client, "- %s", buffer);
+                buffer[0] = '\0';
+                nickname_count = 0;
+            }
+        }
+    }
+    if (nickname_count > 0)
+        sendnotice(client, "- %s", buffer);
+}
+
+static void BM_sg_list_fullscan(BenchState *state) {
+    setup(state->arg, 0);
+    while (bench_keep_running(state))
+        sg_list_fullscan(oper, "everyone");
+    teardown();
+}
+BENCHMARK_ARG(BM_sg_list_fullscan, 1000);
+BENCHMARK_ARG(BM_sg_list_fullscan, 10000);
+BENCHMARK_ARG(BM_sg_list_fullscan, 100000);
+
+// A small group in a big network is where the index pays off most
+static void BM_sg_list_small_group(BenchState *state) {
+    const char *parv[] = { NULL, "subnet", NULL };
+
+    setup(state->arg, 0);
+    while (bench_keep_running(state))
+        mock_run_command(oper, "SG", 2, parv);
+    bench_set_label(state, "%d members", sg_groups[3].members);
+    teardown();
+}
+BENCHMARK_ARG(BM_sg_list_small_group, 100000);
+
+static void BM_sg_list_small_group_fullscan(BenchState *state) {
+    setup(state->arg, 0);
+    while (bench_keep_running(state))
+        sg_list_fullscan(oper, "subnet");
+    teardown();
+}
+BENCHMARK_ARG(BM_sg_list_small_group_fullscan, 100000);
+
+// Re-evaluating one client, as on every nick change, login or umode change
+static void BM_sgindex_update(BenchState *state) {
+    uint64_t i = 0;
+
+    setup(1000, state->arg);
+    while (bench_keep_running(state))
+        sgindex_update_client(users[i++ % 1000]);
+    bench_set_label(state, "%d groups", sg_group_count);
+    teardown();
+}
+BENCHMARK_ARG(BM_sgindex_update, 0);
+BENCHMARK_ARG(BM_sgindex_update, 28);
+
+// One tick of the periodic resync on a server with 40k users: what the
+// event loop stalls for, at most SG_RESYNC_BATCH re-evaluated clients
+static void BM_resync_step(BenchState *state) {
+    uint64_t rounds = 0;
+
+    setup(state->arg, 28);
+    while (bench_keep_running(state)) {
+        if (!sg_resync_active) {
+            sgindex_resync(NULL);
+            rounds++;
+        }
+        sgindex_resync_step(NULL);
+    }
+    bench_set_label(state, "%d clients per step, %llu rounds", SG_RESYNC_BATCH, (unsigned long long)rounds);
+    teardown();
+}
+BENCHMARK_ARG(BM_resync_step, 40000);
+
+// A user connecting and quitting while N others stay online
+static void BM_connect_quit(BenchState *state) {
+    setup(state->arg, 0);
+    while (bench_keep_running(state)) {
+        bench_pause(state);
+        Client *client = mock_local_user("churn", "churn", "10.0.0.1");
+        bench_resume(state);
+        mock_connect(client);
+        MOCK_RUN_HOOK(HOOKTYPE_LOCAL_QUIT, int (*)(Client *, MessageTag *, const char *), client, NULL, "bye");
+        bench_pause(state);
+        mock_free_client(client);
+        bench_resume(state);
+    }
+    teardown();
+}
+BENCHMARK_ARG(BM_connect_quit, 10000);
+
+static void BM_sg_user(BenchState *state) {
+    const char *parv[] = { NULL, "u1", NULL };
+
+    setup(1000, state->arg);
+    while (bench_keep_running(state))
+        mock_run_command(oper, "SG-user", 2, parv);
+    teardown();
+}
+BENCHMARK_ARG(BM_sg_user, 28);
+
+static void BM_rpc_members_page(BenchState *state) {
+    json_t *params = json_object();
+
+    json_object_set_new(params, "name", json_string("everyone"));
+    json_object_set_new(params, "limit", json_integer(state->arg));
+    setup(10000, 0);
+    while (bench_keep_running(state))
+        mock_run_rpc(oper, "security_group.members", params);
+    json_decref(params);
+    teardown();
+}
+BENCHMARK_ARG(BM_rpc_members_page, 1000);
@@ -0,0 +1,324 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../welcomemessages/welcomemessages.c"
+#include "bench.h"
+#include "population.h"
+
+// Load npatterns config welcomes, mostly "#chanN" exact names. Every
+// tenth one is a "#teamN-*" prefix pattern instead, and out of every
+// hundred one is "#room?N" and one "*-logN". #chanN, #teamN-x, #roomxN
+// and #x-logN match entry N.
+static void load_patterns(int npatterns) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, "channel-welcome", NULL);
+    char name[64];
+
+    for (int i = 0; i < npatterns; i++) {
+        if (i % 100 == 98)
+            snprintf(name, sizeof(name), "#room?%d", i);
+        else if (i % 100 == 99)
+            snprintf(name, sizeof(name), "*-log%d", i);
+        else if (i % 10 == 9)
+            snprintf(name, sizeof(name), "#team%d-*", i);
+        else
+            snprintf(name, sizeof(name), "#chan%d", i);
+        mock_config_add(block, name, "Welcome to $channel, $nick! We are $usercount.");
+    }
+    if (mock_module_load(root) < 0)
+        exit(1);
+    mock_config_free(root);
+}
+
+static void teardown(void) {
+    mock_module_unload(0);
+    mock_reset();
+}
+
+// The usual join: the channel has its welcome cached already
+static void BM_join_cached(BenchState *state) {
+    Client *client;
+    Channel *channel;
+
+    load_patterns(state->arg);
+    client = mock_local_user("alice", "alice", "10.0.0.1");
+    channel = mock_channel("#chan0");
+    mock_join(client, channel, NULL);
+    custom_join(client, channel, NULL);
+    while (bench_keep_running(state))
+        custom_join(client, channel, NULL);
+    teardown();
+}
+BENCHMARK_ARG(BM_join_cached, 100);
+
+// First join after a rehash or /WELCOME: the channel resolves its welcome again
+static void BM_join_resolve(BenchState *state) {
+    Client *client;
+    Channel *channel;
+
+    load_patterns(state->arg);
+    client = mock_local_user("alice", "alice", "10.0.0.1");
+    channel = mock_channel("#team99-dev");
+    mock_join(client, channel, NULL);
+    while (bench_keep_running(state)) {
+        welcome_invalidate(channel->name);
+        custom_join(client, channel, NULL);
+    }
+    teardown();
+}
+BENCHMARK_ARG(BM_join_resolve, 100);
+
+// Joins to a channel without any welcome
+static void BM_join_no_welcome(BenchState *state) {
+    Client *client;
+    Channel *channel;
+
+    load_patterns(state->arg);
+    client = mock_local_user("alice", "alice", "10.0.0.1");
+    channel = mock_channel("#elsewhere");
+    mock_join(client, channel, NULL);
+    while (bench_keep_running(state))
+        custom_join(client, channel, NULL);
+    teardown();
+}
+BENCHMARK_ARG(BM_join_no_welcome, 100);
+
+// A population joining, duplicate suppression on
+static void BM_join_population(BenchState *state) {
+    PopulationOptions opt = { .users = state->arg, .v6_percent = 30, .seed = 3 };
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    Client **users;
+    Channel *channel;
+    long n = 0;
+
+    mock_config_add(mock_config_add(root, "channel-welcome", NULL), "#help", "Welcome to $channel, $nick!");
+    mock_config_add(mock_config_add(root, "channel-welcome-settings", NULL), "suppress-window", "5m");
+    if (mock_module_load(root) < 0)
+        exit(1);
+    mock_config_free(root);
+    users = population_create(&opt);
+    channel = mock_channel("#help");
+    for (int i = 0; i < state->arg; i++)
+        mock_join(users[i], channel, NULL);
+    while (bench_keep_running(state))
+        custom_join(users[n++ % state->arg], channel, NULL);
+    bench_set_label(state, "%lu sent, %lu suppressed", modstats->welcomes_sent, modstats->welcomes_duplicate);
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ARG(BM_join_population, 10000);
+
+// Channel name number n out of npatterns: a mix of exact, prefix,
+// ? and * matches, plus names with no welcome
+static void storm_channel_name(char *buf, size_t len, int n, int npatterns) {
+    int i = n % npatterns;
+
+    switch (n % 8) {
+        case 0:
+            snprintf(buf, len, "#other%d", n);
+            break;
+        case 1:
+            snprintf(buf, len, "#team%d-%d", i / 10 * 10 + 9, n);
+            break;
+        case 2:
+            snprintf(buf, len, "#roomx%d", i / 100 * 100 + 98);
+            break;
+        default:
+            snprintf(buf, len, "#chan%d", i - i % 10 + n % 8);
+            break;
+    }
+}
+
+// What custom_join did before the matcher: match_simple() on every entry
+// in config order, on every join
+static int linear_lookup(const char *name) {
+    for (int i = 0; i < channel_count; i++) {
+        if (match_simple(CM_CHANNEL(i), name))
+            return i;
+    }
+    return -1;
+}
+
+static char **storm_names(int count, int npatterns) {
+    char **names = safe_alloc(sizeof(char *) * count);
+    char buf[64];
+
+    for (int i = 0; i < count; i++) {
+        storm_channel_name(buf, sizeof(buf), i, npatterns);
+        safe_strdup(names[i], buf);
+    }
+    return names;
+}
+
+static void free_names(char **names, int count) {
+    for (int i = 0; i < count; i++)
+        safe_free(names[i]);
+    safe_free(names);
+}
+
+// Finding the first matching entry for a channel name
+static void BM_matcher_lookup(BenchState *state) {
+    char **names;
+    long n = 0;
+
+    load_patterns(state->arg);
+    names = storm_names(4096, state->arg);
+    while (bench_keep_running(state))
+        bench_keep(matcher_lookup(names[n++ & 4095]));
+    free_names(names, 4096);
+    teardown();
+}
+BENCHMARK_ARG(BM_matcher_lookup, 100);
+BENCHMARK_ARG(BM_matcher_lookup, 1000);
+BENCHMARK_ARG(BM_matcher_lookup, 10000);
+
+static void BM_linear_lookup(BenchState *state) {
+    char **names;
+    long n = 0;
+
+    load_patterns(state->arg);
+    names = storm_names(4096, state->arg);
+    while (bench_keep_running(state))
+        bench_keep(linear_lookup(names[n++ & 4095]));
+    free_names(names, 4096);
+    teardown();
+}
+BENCHMARK_ARG(BM_linear_lookup, 100);
+BENCHMARK_ARG(BM_linear_lookup, 1000);
+BENCHMARK_ARG(BM_linear_lookup, 10000);
+
+BENCHMARK_ARG(BM_join_resolve, 10000);
+
+#define STORM_USERS 10000
+#define STORM_NAMES 50000
+
+// Autojoin storm after a netsplit heals: 10k config entries and a million
+// joins of 10k users to channels that do not exist yet, so every channel
+// resolves its welcome on its first join. The 50k names repeat, the label
+// shows how many channels that comes to.
+static void BM_join_storm(BenchState *state) {
+    PopulationOptions opt = { .users = STORM_USERS, .seed = 11 };
+    Client **users;
+    Channel **channels;
+    char **names;
+    long n = 0;
+
+    load_patterns(state->arg);
+    users = population_create(&opt);
+    names = storm_names(STORM_NAMES, state->arg);
+    channels = safe_alloc(sizeof(Channel *) * STORM_NAMES);
+    while (bench_keep_running(state)) {
+        int c = (n * 7919) % STORM_NAMES;
+        if (!channels[c]) {
+            bench_pause(state);
+            channels[c] = mock_channel(names[c]);
+            bench_resume(state);
+        }
+        custom_join(users[n % STORM_USERS], channels[c], NULL);
+        n++;
+    }
+    bench_set_label(state, "%llu resolves, %lu sent", modstats->resolve.calls, modstats->welcomes_sent);
+    free_names(names, STORM_NAMES);
+    safe_free(channels);
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ITERATIONS(BM_join_storm, 10000, 1000000);
+
+// The same storm through the old code, which sent the message as is.
+// Too slow for a million joins, so it runs for --min-time like the rest
+// and the label scales what it sent up to the million of BM_join_storm.
+#define STORM_MESSAGE "Welcome to the channel! Read the topic before asking."
+
+static void BM_join_storm_linear(BenchState *state) {
+    PopulationOptions opt = { .users = STORM_USERS, .seed = 11 };
+    Client **users;
+    char **names;
+    long n = 0, sent = 0;
+
+    load_patterns(state->arg);
+    users = population_create(&opt);
+    names = storm_names(STORM_NAMES, state->arg);
+    while (bench_keep_running(state)) {
+        int i = linear_lookup(names[(n * 7919) % STORM_NAMES]);
+        if (i >= 0) {
+            sendnotice(users[n % STORM_USERS], "%s", STORM_MESSAGE);
+            sent++;
+        }
+        n++;
+    }
+    bench_set_label(state, "%ld sent, %.0f per 1000000", sent, sent * 1e6 / n);
+    free_names(names, STORM_NAMES);
+    safe_free(users);
+    teardown();
+}
+BENCHMARK_ARG(BM_join_storm_linear, 10000);
+
+// Templates against sending the message with sendnotice() as it was done
+// before. All send the same length of text.
+#define PLAIN_TEXT "Hi alice, welcome to #help, 1 users here. Topic: Read the FAQ"
+#define VARS_TEXT "Hi $nick, welcome to $channel, $usercount users here. Topic: $topic"
+
+static Client *tmpl_client;
+static Channel *tmpl_channel;
+
+static void template_setup(void) {
+    tmpl_client = mock_local_user("alice", "alice", "10.0.0.1");
+    tmpl_channel = mock_channel("#help");
+    mock_join(tmpl_client, tmpl_channel, NULL);
+    safe_strdup(tmpl_channel->topic, "Read the FAQ");
+}
+
+static void BM_sendnotice_plain(BenchState *state) {
+    template_setup();
+    while (bench_keep_running(state))
+        sendnotice(tmpl_client, "%s", PLAIN_TEXT);
+    mock_reset();
+}
+BENCHMARK(BM_sendnotice_plain);
+
+static void template_loop(BenchState *state, const char *text, int lines) {
+    Segment segs[16];
+    WelcomeTemplate line[3];
+
+    template_setup();
+    for (int l = 0; l < lines; l++) {
+        line[l].segs = segs;
+        line[l].count = template_parse(text, segs);
+    }
+    while (bench_keep_running(state))
+        template_send(tmpl_client, tmpl_channel, line, lines);
+    mock_reset();
+}
+
+static void BM_template_static(BenchState *state) {
+    template_loop(state, PLAIN_TEXT, 1);
+}
+BENCHMARK(BM_template_static);
+
+static void BM_template_vars(BenchState *state) {
+    template_loop(state, VARS_TEXT, 1);
+}
+BENCHMARK(BM_template_vars);
+
+// Three notices per join
+static void BM_template_multiline(BenchState *state) {
+    template_loop(state, VARS_TEXT, 3);
+}
+BENCHMARK(BM_template_multiline);
+
+// What scanning the message for variables on every join would cost
+static void BM_template_parse_each_join(BenchState *state) {
+    Segment segs[16];
+    WelcomeTemplate line = { segs, 0 };
+
+    template_setup();
+    while (bench_keep_running(state)) {
+        line.count = template_parse(VARS_TEXT, segs);
+        template_send(tmpl_client, tmpl_channel, &line, 1);
+    }
+    mock_reset();
+}
+BENCHMARK(BM_template_parse_each_join);
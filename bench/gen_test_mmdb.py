@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Write a small GeoIP2-City style MaxMind DB for the citywhois tests.
+
+Standard library only. The layout is fixed so tests can predict answers:
+
+  10.B.C.0/24, C < 254     city CITIES[(B * 7 + C) % 64]
+  10.B.254.0/24            country only, no city ("unknown city")
+  10.B.255.0/24            not in the database ("unknown location")
+  2001:db8:N::/48, N < 256 city CITIES[N % 64]
+  anything else            not in the database
+
+Usage: gen_test_mmdb.py OUTPUT
+"""
+import struct
+import sys
+import time
+
+CITIES = [
+    "Amsterdam", "Berlin", "Chicago", "Dublin", "Edinburgh", "Frankfurt",
+    "Geneva", "Helsinki", "Istanbul", "Jakarta", "Kyiv", "Lisbon",
+    "Madrid", "Nairobi", "Oslo", "Paris", "Quito", "Rome", "Santiago",
+    "Tokyo", "Utrecht", "Vienna", "Warsaw", "Xi'an", "Yokohama", "Zurich",
+    "Athens", "Brussels", "Copenhagen", "Delhi", "Essen", "Florence",
+    "Glasgow", "Hamburg", "Innsbruck", "Johannesburg", "Kraków", "Lyon",
+    "Montréal", "Naples", "Osaka", "Prague", "Québec", "Riga", "São Paulo",
+    "Tallinn", "Ulm", "Valencia", "Wellington", "Xalapa", "York", "Zagreb",
+    "Antwerp", "Bordeaux", "Cork", "Dresden", "Eindhoven", "Faro", "Gdańsk",
+    "Haarlem", "Ibiza", "Jena", "Kassel", "Leiden",
+]
+
+COUNTRY = {"iso_code": "ZZ", "names": {"en": "Testland"}}
+RECORD_SIZE = 24
+
+
+def ctrl(type_, size):
+    """Control byte(s) for a field of this type and payload size."""
+    if size < 29:
+        first, extra = size, b""
+    elif size < 29 + 256:
+        first, extra = 29, bytes([size - 29])
+    elif size < 285 + 65536:
+        first, extra = 30, struct.pack(">H", size - 285)
+    else:
+        first, extra = 31, struct.pack(">I", size - 65821)[1:]
+    if type_ <= 7:
+        return bytes([(type_ << 5) | first]) + extra
+    return bytes([first, type_ - 7]) + extra
+
+
+def encode_uint(type_, value):
+    raw = value.to_bytes(16, "big").lstrip(b"\0")
+    return ctrl(type_, len(raw)) + raw
+
+
+def encode(value, uint_type=None):
+    if isinstance(value, str):
+        raw = value.encode("utf-8")
+        return ctrl(2, len(raw)) + raw
+    if isinstance(value, float):
+        return ctrl(3, 8) + struct.pack(">d", value)
+    if isinstance(value, bool):
+        return ctrl(14, int(value))
+    if isinstance(value, int):
+        return encode_uint(uint_type or 6, value)
+    if isinstance(value, dict):
+        out = ctrl(7, len(value))
+        for k, v in value.items():
+            out += encode(k) + encode(v)
+        return out
+    if isinstance(value, list):
+        return ctrl(11, len(value)) + b"".join(encode(v) for v in value)
+    raise TypeError(type(value))
+
+
+class Tree:
+    def __init__(self):
+        self.nodes = [[None, None]]  # record: None, ("node", i) or ("data", offset)
+
+    def insert(self, address, prefix_len, data_offset):
+        node = 0
+        for depth in range(prefix_len):
+            bit = (address >> (127 - depth)) & 1
+            if depth == prefix_len - 1:
+                self.nodes[node][bit] = ("data", data_offset)
+                return
+            record = self.nodes[node][bit]
+            if record is None:
+                self.nodes.append([None, None])
+                record = ("node", len(self.nodes) - 1)
+                self.nodes[node][bit] = record
+            node = record[1]
+
+    def encode(self):
+        count = len(self.nodes)
+        out = bytearray()
+        for node in self.nodes:
+            for record in node:
+                if record is None:
+                    value = count
+                elif record[0] == "node":
+                    value = record[1]
+                else:
+                    value = count + 16 + record[1]
+                out += value.to_bytes(3, "big")
+        return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+
+    data = bytearray()
+    offsets = []
+    for i, name in enumerate(CITIES):
+        offsets.append(len(data))
+        data += encode({
+            "city": {"geoname_id": 1000 + i, "names": {"en": name}},
+            "country": COUNTRY,
+            "location": {"latitude": float(i), "longitude": float(-i)},
+        })
+    country_only = len(data)
+    data += encode({"country": COUNTRY})
+
+    tree = Tree()
+    for b in range(256):
+        for c in range(255):
+            address = (10 << 24 | b << 16 | c << 8)  # IPv4 lives at ::/96
+            offset = country_only if c == 254 else offsets[(b * 7 + c) % 64]
+            tree.insert(address, 96 + 24, offset)
+    for n in range(256):
+        address = (0x2001 << 112) | (0x0db8 << 96) | (n << 80)
+        tree.insert(address, 48, offsets[n % 64])
+
+    metadata = {
+        "node_count": len(tree.nodes),
+        "record_size": RECORD_SIZE,
+        "ip_version": 6,
+        "database_type": "GeoIP2-City",
+        "languages": ["en"],
+        "binary_format_major_version": 2,
+        "binary_format_minor_version": 0,
+        "build_epoch": int(time.time()),
+        "description": {"en": "citywhois test database"},
+    }
+    meta = ctrl(7, len(metadata))
+    for k, v in metadata.items():
+        uint_type = {"record_size": 5, "ip_version": 5,
+                     "binary_format_major_version": 5,
+                     "binary_format_minor_version": 5,
+                     "build_epoch": 9}.get(k)
+        meta += encode(k) + encode(v, uint_type)
+
+    with open(sys.argv[1], "wb") as f:
+        f.write(tree.encode())
+        f.write(b"\0" * 16)
+        f.write(data)
+        f.write(b"\xab\xcd\xefMaxMind.com")
+        f.write(meta)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,44 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * Count heap allocations by defining malloc and friends in the binary
+ * itself; glibc supports this and routes its own internal calls (strdup,
+ * OpenSSL's CRYPTO_malloc, ...) through them too. The real work is left
+ * to glibc's __libc_* entry points.
+ */
+#include <stddef.h>
+#include "alloccount.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+unsigned long long alloc_calls = 0;
+unsigned long long free_calls = 0;
+
+#define COUNT(x) __atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED)
+
+void *malloc(size_t size) {
+    COUNT(alloc_calls);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    COUNT(alloc_calls);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    COUNT(alloc_calls);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr)
+        COUNT(free_calls);
+    __libc_free(ptr);
+}
@@ -0,0 +1,14 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+// malloc/calloc/realloc and free calls made by anything in the process,
+// counted by wrappers around the glibc allocator (alloccount.c)
+extern unsigned long long alloc_calls;
+extern unsigned long long free_calls;
+
+#endif
@@ -0,0 +1,164 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "bench.h"
+#include "alloccount.h"
+
+#define MAX_BENCHMARKS 128
+#define MAX_ITERATIONS 1000000000ULL
+
+typedef struct Benchmark {
+    char name[96];
+    BenchFunc func;
+    long arg;
+    uint64_t fixed_iterations;
+} Benchmark;
+
+static Benchmark benchmarks[MAX_BENCHMARKS];
+static int benchmark_count = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void bench_register(const char *name, BenchFunc func, long arg, int has_arg, uint64_t fixed_iterations) {
+    Benchmark *b;
+
+    if (benchmark_count == MAX_BENCHMARKS) {
+        fprintf(stderr, "Too many benchmarks, raise MAX_BENCHMARKS\n");
+        exit(1);
+    }
+    b = &benchmarks[benchmark_count++];
+    if (has_arg)
+        snprintf(b->name, sizeof(b->name), "%s/%ld", name, arg);
+    else
+        snprintf(b->name, sizeof(b->name), "%s", name);
+    b->func = func;
+    b->arg = arg;
+    b->fixed_iterations = fixed_iterations;
+}
+
+void bench_pause(BenchState *state) {
+    if (!state->running)
+        return;
+    state->elapsed_ns += now_ns() - state->start_ns;
+    state->allocs += alloc_calls - state->start_allocs;
+    state->running = 0;
+}
+
+void bench_resume(BenchState *state) {
+    if (state->running)
+        return;
+    state->running = 1;
+    state->start_allocs = alloc_calls;
+    state->start_ns = now_ns();
+}
+
+int bench_keep_running(BenchState *state) {
+    if (state->done == 0 && !state->running && !state->elapsed_ns)
+        bench_resume(state);
+    if (state->done < state->iterations) {
+        state->done++;
+        return 1;
+    }
+    bench_pause(state);
+    return 0;
+}
+
+void bench_set_label(BenchState *state, const char *fmt, ...) {
+    va_list vl;
+
+    va_start(vl, fmt);
+    vsnprintf(state->label, sizeof(state->label), fmt, vl);
+    va_end(vl);
+}
+
+static void run_once(Benchmark *b, BenchState *state, uint64_t iterations) {
+    memset(state, 0, sizeof(*state));
+    state->arg = b->arg;
+    state->iterations = iterations;
+    b->func(state);
+    if (state->running)
+        bench_pause(state);
+    if (state->done < iterations) {
+        fprintf(stderr, "%s: stopped after %llu of %llu iterations\n", b->name,
+                (unsigned long long)state->done, (unsigned long long)iterations);
+        exit(1);
+    }
+}
+
+static void run_benchmark(Benchmark *b, double min_time, int csv) {
+    BenchState state;
+    uint64_t iterations = b->fixed_iterations ? b->fixed_iterations : 1;
+    uint64_t min_ns = (uint64_t)(min_time * 1e9);
+
+    for (;;) {
+        run_once(b, &state, iterations);
+        if (b->fixed_iterations || state.elapsed_ns >= min_ns || iterations >= MAX_ITERATIONS)
+            break;
+        // Same growth rule as Google Benchmark: aim 40% past the target,
+        // but never more than ten times the last count
+        double multiplier = state.elapsed_ns ? min_ns * 1.4 / state.elapsed_ns : 10.0;
+        if (multiplier > 10.0)
+            multiplier = 10.0;
+        uint64_t next = (uint64_t)(iterations * multiplier);
+        iterations = next > iterations ? next : iterations + 1;
+        if (iterations > MAX_ITERATIONS)
+            iterations = MAX_ITERATIONS;
+    }
+
+    double ns_per_op = (double)state.elapsed_ns / state.done;
+    double allocs_per_op = (double)state.allocs / state.done;
+    if (csv)
+        printf("%s,%llu,%.1f,%.2f,%s\n", b->name, (unsigned long long)state.done, ns_per_op, allocs_per_op, state.label);
+    else
+        printf("%-44s %12llu %12.1f %10.2f  %s\n", b->name, (unsigned long long)state.done, ns_per_op, allocs_per_op, state.label);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--filter=SUBSTRING] [--min-time=SECONDS] [--csv] [--list]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = NULL;
+    double min_time = 0.5;
+    int csv = 0, list = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--filter=", 9))
+            filter = argv[i] + 9;
+        else if (!strncmp(argv[i], "--min-time=", 11))
+            min_time = atof(argv[i] + 11);
+        else if (!strcmp(argv[i], "--csv"))
+            csv = 1;
+        else if (!strcmp(argv[i], "--list"))
+            list = 1;
+        else
+            usage(argv[0]);
+    }
+
+    if (csv)
+        printf("benchmark,iterations,ns_per_op,allocs_per_op,label\n");
+    else if (!list)
+        printf("%-44s %12s %12s %10s  %s\n", "Benchmark", "Iterations", "ns/op", "allocs/op", "");
+    for (int i = 0; i < benchmark_count; i++) {
+        if (filter && !strstr(benchmarks[i].name, filter))
+            continue;
+        if (list)
+            printf("%s\n", benchmarks[i].name);
+        else
+            run_benchmark(&benchmarks[i], min_time, csv);
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * Microbenchmarks in the style of Google Benchmark:
+ *
+ *   static void BM_lookup(BenchState *state) {
+ *       ...setup, may use state->arg...
+ *       while (bench_keep_running(state))
+ *           bench_keep(lookup(x));
+ *       ...teardown...
+ *   }
+ *   BENCHMARK_ARG(BM_lookup, 1000);
+ *
+ * The function is called with a growing iteration count until one run
+ * takes at least --min-time, then ns/op and allocs/op of that run are
+ * reported. Only the loop is measured; bench_pause()/bench_resume() take
+ * per-iteration setup out of the measurement.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+typedef struct BenchState {
+    long arg;
+    uint64_t iterations;
+    uint64_t done;
+    uint64_t start_ns, elapsed_ns;
+    unsigned long long start_allocs, allocs;
+    int running;
+    char label[64];
+} BenchState;
+
+typedef void (*BenchFunc)(BenchState *state);
+
+void bench_register(const char *name, BenchFunc func, long arg, int has_arg, uint64_t fixed_iterations);
+int bench_keep_running(BenchState *state);
+void bench_pause(BenchState *state);
+void bench_resume(BenchState *state);
+void bench_set_label(BenchState *state, const char *fmt, ...) __attribute__((format(printf,2,3)));
+
+// Keep the compiler from optimizing a result away
+#define bench_keep(x) do { __typeof__(x) bench_keep_v = (x); __asm__ volatile("" : : "g"(&bench_keep_v) : "memory"); } while (0)
+
+#define BENCHMARK(fn) \
+    __attribute__((constructor)) static void bench_register_##fn(void) { bench_register(#fn, fn, 0, 0, 0); }
+#define BENCHMARK_ARG(fn, a) \
+    __attribute__((constructor)) static void bench_register_##fn##_##a(void) { bench_register(#fn, fn, a, 1, 0); }
+// Exactly n iterations, for runs that are meant to be a fixed workload
+#define BENCHMARK_ITERATIONS(fn, a, n) \
+    __attribute__((constructor)) static void bench_register_##fn##_##a##_##n(void) { bench_register(#fn, fn, a, 1, n); }
+
+#endif
@@ -0,0 +1,42 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "population.h"
+
+void population_ip(int n, int v6, char *buf, size_t len) {
+    if (v6)
+        snprintf(buf, len, "2001:db8:%x:%x::%x", n & 0xff, (n >> 8) & 0xffff, 1 + (n >> 24));
+    else
+        snprintf(buf, len, "10.%d.%d.%d", (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff);
+}
+
+Client **population_create(const PopulationOptions *opt) {
+    Client **users = safe_alloc(sizeof(Client *) * (opt->users ? opt->users : 1));
+    int clones = opt->clones > 0 ? opt->clones : 1;
+    Client *hub = NULL;
+
+    mock_seed(opt->seed ? opt->seed : 1);
+    if (opt->remote_percent > 0 && !(hub = find_server("hub.example.org", NULL)))
+        hub = mock_server("hub.example.org", "002");
+
+    for (int i = 0; i < opt->users; i++) {
+        char nick[NICKLEN + 1], ip[64];
+        int n = i / clones;
+        Client *client;
+
+        snprintf(nick, sizeof(nick), "u%d", i);
+        population_ip(n, (int)(n % 100) < opt->v6_percent, ip, sizeof(ip));
+        if ((int)(mock_random() % 100) < opt->remote_percent)
+            client = mock_remote_user(hub, nick, nick, ip);
+        else
+            client = mock_local_user(nick, nick, ip);
+        if ((int)(mock_random() % 100) < opt->loggedin_percent)
+            mock_set_account(client, nick);
+        if ((int)(mock_random() % 100) < opt->oper_percent)
+            client->umodes |= UMODE_OPER;
+        users[i] = client;
+    }
+    return users;
+}
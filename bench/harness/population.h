@@ -0,0 +1,33 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * Synthetic client populations. Addresses are derived from the index so
+ * the same options always give the same network, and they line up with
+ * the test MMDB (gen_test_mmdb.py): IPv4 in 10/8, IPv6 in 2001:db8::/32.
+ */
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include "unrealircd.h"
+
+typedef struct PopulationOptions {
+    int users;
+    int v6_percent;         // share of addresses that are IPv6
+    int clones;             // users per address, 1 for all distinct
+    int loggedin_percent;   // logged in to services
+    int oper_percent;
+    int remote_percent;     // behind a linked server instead of local
+    uint64_t seed;
+} PopulationOptions;
+
+// Creates the users and returns them in an array the caller frees; the
+// clients themselves go away with mock_reset()
+Client **population_create(const PopulationOptions *opt);
+
+// Address number n, as used by population_create()
+void population_ip(int n, int v6, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "unrealircd.h"
+#include "test.h"
+
+#define MAX_TESTS 256
+
+typedef struct Test {
+    const char *name;
+    TestFunc func;
+} Test;
+
+static Test tests[MAX_TESTS];
+static int test_count = 0;
+static int current_failures = 0;
+
+void test_register(const char *name, TestFunc func) {
+    if (test_count == MAX_TESTS) {
+        fprintf(stderr, "Too many tests, raise MAX_TESTS\n");
+        exit(1);
+    }
+    tests[test_count].name = name;
+    tests[test_count].func = func;
+    test_count++;
+}
+
+void test_fail(const char *file, int line, const char *fmt, ...) {
+    va_list vl;
+
+    fprintf(stderr, "  %s:%d: check failed: ", file, line);
+    va_start(vl, fmt);
+    vfprintf(stderr, fmt, vl);
+    va_end(vl);
+    fputc('\n', stderr);
+    current_failures++;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    int failed = 0, ran = 0;
+
+    for (int i = 0; i < test_count; i++) {
+        if (filter && !strstr(tests[i].name, filter))
+            continue;
+        current_failures = 0;
+        tests[i].func();
+        mock_reset();
+        ran++;
+        if (current_failures) {
+            failed++;
+            printf("FAIL %s\n", tests[i].name);
+        } else {
+            printf("ok   %s\n", tests[i].name);
+        }
+    }
+    printf("%d of %d tests passed\n", ran - failed, ran);
+    return failed ? 1 : 0;
+}
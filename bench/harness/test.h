@@ -0,0 +1,44 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * Unit tests: TEST(name) { CHECK(...); } in a file that includes one
+ * module. Tests run in the order they are defined and the mock core is
+ * reset after each one; a failed CHECK is reported and the test goes on.
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include <string.h>
+
+typedef void (*TestFunc)(void);
+
+void test_register(const char *name, TestFunc func);
+void test_fail(const char *file, int line, const char *fmt, ...) __attribute__((format(printf,3,4)));
+
+#define TEST(name) \
+    static void test_##name(void); \
+    __attribute__((constructor)) static void test_register_##name(void) { test_register(#name, test_##name); } \
+    static void test_##name(void)
+
+#define CHECK(cond) do { \
+        if (!(cond)) \
+            test_fail(__FILE__, __LINE__, "%s", #cond); \
+    } while (0)
+
+#define CHECK_STREQ(a, b) do { \
+        const char *check_a = (a), *check_b = (b); \
+        if (!check_a || !check_b || strcmp(check_a, check_b)) \
+            test_fail(__FILE__, __LINE__, "%s == %s: \"%s\" vs \"%s\"", #a, #b, \
+                      check_a ? check_a : "(null)", check_b ? check_b : "(null)"); \
+    } while (0)
+
+#define CHECK_INTEQ(a, b) do { \
+        long long check_a = (long long)(a), check_b = (long long)(b); \
+        if (check_a != check_b) \
+            test_fail(__FILE__, __LINE__, "%s == %s: %lld vs %lld", #a, #b, check_a, check_b); \
+    } while (0)
+
+#endif
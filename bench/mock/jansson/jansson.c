@@ -0,0 +1,483 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+// Minimal jansson stand-in, see jansson.h
+
+#include "jansson.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    json_t json;
+    size_t count, size;
+    char **keys;
+    json_t **values;
+} JsonContainer; // object or array, arrays leave keys NULL
+
+typedef struct {
+    json_t json;
+    char *value;
+} JsonString;
+
+typedef struct {
+    json_t json;
+    json_int_t value;
+} JsonInteger;
+
+typedef struct {
+    json_t json;
+    double value;
+} JsonReal;
+
+static json_t *json_alloc(json_type type, size_t size) {
+    json_t *json = calloc(1, size);
+
+    if (!json)
+        return NULL;
+    json->type = type;
+    json->refcount = 1;
+    return json;
+}
+
+json_t *json_object(void) {
+    return json_alloc(JSON_OBJECT, sizeof(JsonContainer));
+}
+
+json_t *json_array(void) {
+    return json_alloc(JSON_ARRAY, sizeof(JsonContainer));
+}
+
+static json_t *json_stringn_nocopy(char *value) {
+    JsonString *s = (JsonString *)json_alloc(JSON_STRING, sizeof(JsonString));
+
+    if (!s) {
+        free(value);
+        return NULL;
+    }
+    s->value = value;
+    return &s->json;
+}
+
+json_t *json_string(const char *value) {
+    char *copy;
+
+    if (!value || !(copy = strdup(value)))
+        return NULL;
+    return json_stringn_nocopy(copy);
+}
+
+json_t *json_integer(json_int_t value) {
+    JsonInteger *i = (JsonInteger *)json_alloc(JSON_INTEGER, sizeof(JsonInteger));
+
+    if (i)
+        i->value = value;
+    return &i->json;
+}
+
+json_t *json_real(double value) {
+    JsonReal *r = (JsonReal *)json_alloc(JSON_REAL, sizeof(JsonReal));
+
+    if (r)
+        r->value = value;
+    return &r->json;
+}
+
+// Like jansson the constants are shared and never freed
+static json_t json_true_value = { JSON_TRUE, (size_t)-1 };
+static json_t json_false_value = { JSON_FALSE, (size_t)-1 };
+static json_t json_null_value = { JSON_NULL, (size_t)-1 };
+
+json_t *json_true(void) {
+    return &json_true_value;
+}
+
+json_t *json_false(void) {
+    return &json_false_value;
+}
+
+json_t *json_null(void) {
+    return &json_null_value;
+}
+
+json_t *json_incref(json_t *json) {
+    if (json && json->refcount != (size_t)-1)
+        json->refcount++;
+    return json;
+}
+
+void json_decref(json_t *json) {
+    if (!json || json->refcount == (size_t)-1 || --json->refcount)
+        return;
+
+    switch (json->type) {
+        case JSON_OBJECT:
+        case JSON_ARRAY: {
+            JsonContainer *c = (JsonContainer *)json;
+            for (size_t i = 0; i < c->count; i++) {
+                if (c->keys)
+                    free(c->keys[i]);
+                json_decref(c->values[i]);
+            }
+            free(c->keys);
+            free(c->values);
+            break;
+        }
+        case JSON_STRING:
+            free(((JsonString *)json)->value);
+            break;
+        default:
+            break;
+    }
+    free(json);
+}
+
+static int container_grow(JsonContainer *c) {
+    size_t size = c->size ? c->size * 2 : 8;
+    json_t **values = realloc(c->values, sizeof(json_t *) * size);
+
+    if (!values)
+        return -1;
+    c->values = values;
+    if (c->json.type == JSON_OBJECT) {
+        char **keys = realloc(c->keys, sizeof(char *) * size);
+        if (!keys)
+            return -1;
+        c->keys = keys;
+    }
+    c->size = size;
+    return 0;
+}
+
+size_t json_object_size(const json_t *object) {
+    return json_is_object(object) ? ((const JsonContainer *)object)->count : 0;
+}
+
+json_t *json_object_get(const json_t *object, const char *key) {
+    const JsonContainer *c = (const JsonContainer *)object;
+
+    if (!json_is_object(object) || !key)
+        return NULL;
+    for (size_t i = 0; i < c->count; i++) {
+        if (!strcmp(c->keys[i], key))
+            return c->values[i];
+    }
+    return NULL;
+}
+
+int json_object_set_new(json_t *object, const char *key, json_t *value) {
+    JsonContainer *c = (JsonContainer *)object;
+
+    if (!value)
+        return -1;
+    if (!json_is_object(object) || !key) {
+        json_decref(value);
+        return -1;
+    }
+    for (size_t i = 0; i < c->count; i++) {
+        if (!strcmp(c->keys[i], key)) {
+            json_decref(c->values[i]);
+            c->values[i] = value;
+            return 0;
+        }
+    }
+    if (c->count == c->size && container_grow(c) < 0) {
+        json_decref(value);
+        return -1;
+    }
+    c->keys[c->count] = strdup(key);
+    c->values[c->count++] = value;
+    return 0;
+}
+
+int json_object_set(json_t *object, const char *key, json_t *value) {
+    return json_object_set_new(object, key, json_incref(value));
+}
+
+size_t json_array_size(const json_t *array) {
+    return json_is_array(array) ? ((const JsonContainer *)array)->count : 0;
+}
+
+json_t *json_array_get(const json_t *array, size_t index) {
+    if (!json_is_array(array) || index >= ((const JsonContainer *)array)->count)
+        return NULL;
+    return ((const JsonContainer *)array)->values[index];
+}
+
+int json_array_append_new(json_t *array, json_t *value) {
+    JsonContainer *c = (JsonContainer *)array;
+
+    if (!value)
+        return -1;
+    if (!json_is_array(array) || (c->count == c->size && container_grow(c) < 0)) {
+        json_decref(value);
+        return -1;
+    }
+    c->values[c->count++] = value;
+    return 0;
+}
+
+const char *json_string_value(const json_t *string) {
+    return json_is_string(string) ? ((const JsonString *)string)->value : NULL;
+}
+
+json_int_t json_integer_value(const json_t *integer) {
+    return json_is_integer(integer) ? ((const JsonInteger *)integer)->value : 0;
+}
+
+double json_real_value(const json_t *real) {
+    return json_is_real(real) ? ((const JsonReal *)real)->value : 0.0;
+}
+
+/*
+ * Parser: recursive descent over RFC 8259 JSON. \u escapes outside the
+ * BMP (surrogate pairs) are not combined, which no module relies on.
+ */
+typedef struct {
+    const char *p;
+    const char *start;
+    json_error_t *error;
+} Parser;
+
+static json_t *parse_value(Parser *ps, int depth);
+
+static void parse_error(Parser *ps, const char *text) {
+    if (ps->error) {
+        ps->error->line = 1;
+        ps->error->position = (int)(ps->p - ps->start);
+        ps->error->column = ps->error->position;
+        strncpy(ps->error->source, "<string>", sizeof(ps->error->source) - 1);
+        strncpy(ps->error->text, text, sizeof(ps->error->text) - 1);
+    }
+}
+
+static void skip_ws(Parser *ps) {
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')
+        ps->p++;
+}
+
+static char *parse_string_raw(Parser *ps) {
+    size_t size = 32, len = 0;
+    char *out = malloc(size);
+
+    ps->p++; // opening quote
+    while (out && *ps->p != '"') {
+        unsigned int c = (unsigned char)*ps->p++;
+        char enc[4];
+        int n = 1;
+
+        if (c == '\0' || c < 0x20) {
+            parse_error(ps, "invalid string");
+            free(out);
+            return NULL;
+        }
+        enc[0] = (char)c;
+        if (c == '\\') {
+            c = (unsigned char)*ps->p++;
+            switch (c) {
+                case '"': case '\\': case '/': enc[0] = (char)c; break;
+                case 'b': enc[0] = '\b'; break;
+                case 'f': enc[0] = '\f'; break;
+                case 'n': enc[0] = '\n'; break;
+                case 'r': enc[0] = '\r'; break;
+                case 't': enc[0] = '\t'; break;
+                case 'u': {
+                    unsigned int cp = 0;
+                    for (int i = 0; i < 4; i++) {
+                        char h = *ps->p++;
+                        cp <<= 4;
+                        if (h >= '0' && h <= '9') cp |= h - '0';
+                        else if (h >= 'a' && h <= 'f') cp |= h - 'a' + 10;
+                        else if (h >= 'A' && h <= 'F') cp |= h - 'A' + 10;
+                        else {
+                            parse_error(ps, "invalid \\u escape");
+                            free(out);
+                            return NULL;
+                        }
+                    }
+                    if (cp < 0x80) {
+                        enc[0] = (char)cp;
+                    } else if (cp < 0x800) {
+                        enc[0] = (char)(0xC0 | (cp >> 6));
+                        enc[1] = (char)(0x80 | (cp & 0x3F));
+                        n = 2;
+                    } else {
+                        enc[0] = (char)(0xE0 | (cp >> 12));
+                        enc[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                        enc[2] = (char)(0x80 | (cp & 0x3F));
+                        n = 3;
+                    }
+                    break;
+                }
+                default:
+                    parse_error(ps, "invalid escape");
+                    free(out);
+                    return NULL;
+            }
+        }
+        if (len + n + 1 > size) {
+            char *grown = realloc(out, size * 2);
+            if (!grown) {
+                free(out);
+                return NULL;
+            }
+            out = grown;
+            size *= 2;
+        }
+        memcpy(out + len, enc, n);
+        len += n;
+    }
+    if (!out)
+        return NULL;
+    ps->p++; // closing quote
+    out[len] = '\0';
+    return out;
+}
+
+static json_t *parse_number(Parser *ps) {
+    const char *begin = ps->p;
+    char *end;
+    int real = 0;
+
+    if (*ps->p == '-')
+        ps->p++;
+    while ((*ps->p >= '0' && *ps->p <= '9') || *ps->p == '.' || *ps->p == 'e' || *ps->p == 'E' ||
+           ((*ps->p == '+' || *ps->p == '-') && (ps->p[-1] == 'e' || ps->p[-1] == 'E'))) {
+        if (*ps->p == '.' || *ps->p == 'e' || *ps->p == 'E')
+            real = 1;
+        ps->p++;
+    }
+    if (real) {
+        double d = strtod(begin, &end);
+        if (end != ps->p) {
+            parse_error(ps, "invalid number");
+            return NULL;
+        }
+        return json_real(d);
+    }
+    json_int_t i = strtoll(begin, &end, 10);
+    if (end != ps->p || end == begin) {
+        parse_error(ps, "invalid number");
+        return NULL;
+    }
+    return json_integer(i);
+}
+
+static json_t *parse_container(Parser *ps, int depth, int object) {
+    json_t *json = object ? json_object() : json_array();
+    char close = object ? '}' : ']';
+
+    ps->p++;
+    skip_ws(ps);
+    if (*ps->p == close) {
+        ps->p++;
+        return json;
+    }
+    while (1) {
+        char *key = NULL;
+        json_t *value;
+
+        skip_ws(ps);
+        if (object) {
+            if (*ps->p != '"' || !(key = parse_string_raw(ps))) {
+                parse_error(ps, "expected a string key");
+                json_decref(json);
+                return NULL;
+            }
+            skip_ws(ps);
+            if (*ps->p++ != ':') {
+                parse_error(ps, "expected ':'");
+                free(key);
+                json_decref(json);
+                return NULL;
+            }
+        }
+        value = parse_value(ps, depth + 1);
+        if (!value) {
+            free(key);
+            json_decref(json);
+            return NULL;
+        }
+        if (object) {
+            json_object_set_new(json, key, value);
+            free(key);
+        } else {
+            json_array_append_new(json, value);
+        }
+        skip_ws(ps);
+        if (*ps->p == ',') {
+            ps->p++;
+            continue;
+        }
+        if (*ps->p == close) {
+            ps->p++;
+            return json;
+        }
+        parse_error(ps, "expected ',' or a closing bracket");
+        json_decref(json);
+        return NULL;
+    }
+}
+
+static json_t *parse_value(Parser *ps, int depth) {
+    if (depth > 64) {
+        parse_error(ps, "too deeply nested");
+        return NULL;
+    }
+    skip_ws(ps);
+    switch (*ps->p) {
+        case '{':
+            return parse_container(ps, depth, 1);
+        case '[':
+            return parse_container(ps, depth, 0);
+        case '"': {
+            char *s = parse_string_raw(ps);
+            return s ? json_stringn_nocopy(s) : NULL;
+        }
+        case 't':
+            if (!strncmp(ps->p, "true", 4)) {
+                ps->p += 4;
+                return json_true();
+            }
+            break;
+        case 'f':
+            if (!strncmp(ps->p, "false", 5)) {
+                ps->p += 5;
+                return json_false();
+            }
+            break;
+        case 'n':
+            if (!strncmp(ps->p, "null", 4)) {
+                ps->p += 4;
+                return json_null();
+            }
+            break;
+        default:
+            if (*ps->p == '-' || (*ps->p >= '0' && *ps->p <= '9'))
+                return parse_number(ps);
+            break;
+    }
+    parse_error(ps, "unexpected character");
+    return NULL;
+}
+
+json_t *json_loads(const char *input, size_t flags, json_error_t *error) {
+    Parser ps = { input, input, error };
+    json_t *json;
+
+    (void)flags;
+    if (!input)
+        return NULL;
+    json = parse_value(&ps, 0);
+    if (!json)
+        return NULL;
+    skip_ws(&ps);
+    if (*ps.p) {
+        parse_error(&ps, "end of file expected");
+        json_decref(json);
+        return NULL;
+    }
+    return json;
+}
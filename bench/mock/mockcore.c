@@ -0,0 +1,1633 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * The parts of the UnrealIRCd core that the modules call, reimplemented
+ * just far enough to run them in a test or benchmark binary. Lookups are
+ * hashed like in the real core so that large synthetic populations don't
+ * turn the mock itself into the bottleneck. Sending only formats the line
+ * and accounts for it in the sendq, it never goes anywhere.
+ */
+#include "unrealircd.h"
+#include <arpa/inet.h>
+
+struct Module {
+    const char *name;
+};
+
+static Module mock_module = { "mock" };
+static ModuleInfo mock_modinfo = { &mock_module, 0 };
+static ConfigFile mock_conffile = { "mock.conf" };
+
+Client me;
+struct list_head client_list, lclient_list, global_server_list;
+SecurityGroup *securitygroups = NULL;
+time_t timeofday;
+char *mock_datadir = ".";
+
+int mock_capture = 0;
+MockLine *mock_lines = NULL;
+static MockLine **mock_lines_tail = &mock_lines;
+unsigned long mock_lines_sent = 0;
+int mock_sendq_limit = 200000;
+
+MockHook *mock_hooks[MOCK_HOOKTYPE_MAX];
+int mock_rpc_error_code = 0;
+json_t *mock_rpc_result = NULL;
+int mock_url_pending = 0;
+int mock_url_discard = 0;
+unsigned long mock_log_count = 0;
+unsigned long mock_config_errors = 0;
+
+/*
+ * Randomness: deterministic, so every run sees the same populations
+ */
+static uint64_t mock_rng_state = 0x9E3779B97F4A7C15ULL;
+
+void mock_seed(uint64_t seed) {
+    mock_rng_state = seed;
+}
+
+// splitmix64
+uint64_t mock_random(void) {
+    uint64_t z = (mock_rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint32_t getrandom32(void) {
+    return (uint32_t)mock_random();
+}
+
+void generate_batch_id(char *str) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    for (int i = 0; i < BATCHLEN; i++)
+        str[i] = chars[mock_random() % (sizeof(chars) - 1)];
+    str[BATCHLEN] = '\0';
+}
+
+/*
+ * Memory and strings
+ */
+void outofmemory(size_t bytes) {
+    fprintf(stderr, "Out of memory while allocating %zu bytes\n", bytes);
+    abort();
+}
+
+void *safe_alloc(size_t size) {
+    void *p;
+
+    if (!size)
+        return NULL;
+    p = calloc(1, size);
+    if (!p)
+        outofmemory(size);
+    return p;
+}
+
+char *our_strdup(const char *str) {
+    char *p;
+
+    if (!str)
+        return NULL;
+    p = strdup(str);
+    if (!p)
+        outofmemory(strlen(str));
+    return p;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len >= size ? size - 1 : len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(dst, size);
+
+    if (len == size)
+        return size + strlen(src);
+    return len + strlcpy(dst + len, src, size - len);
+}
+
+char *strtoken(char **save, char *str, const char *fs) {
+    char *pos = *save;
+    char *tmp;
+
+    if (str)
+        pos = str;
+    while (pos && *pos && strchr(fs, *pos))
+        pos++;
+    if (!pos || !*pos)
+        return (pos = *save = NULL);
+    tmp = pos;
+    while (*pos && !strchr(fs, *pos))
+        pos++;
+    if (*pos)
+        *pos++ = '\0';
+    else
+        pos = NULL;
+    *save = pos;
+    return tmp;
+}
+
+int ircvsnprintf(char *buf, size_t size, const char *fmt, va_list vl) {
+    return vsnprintf(buf, size, fmt, vl);
+}
+
+int ircsnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list vl;
+    int ret;
+
+    va_start(vl, fmt);
+    ret = vsnprintf(buf, size, fmt, vl);
+    va_end(vl);
+    return ret;
+}
+
+// Case insensitive wildcard match: * ? and \ to escape, like the core
+int match_simple(const char *mask, const char *name) {
+    const char *m = mask, *n = name;
+    const char *star_m = NULL, *star_n = NULL;
+
+    while (*n) {
+        if (*m == '*') {
+            while (*m == '*')
+                m++;
+            if (!*m)
+                return 1;
+            star_m = m;
+            star_n = n;
+            continue;
+        }
+        if (*m == '?') {
+            m++;
+            n++;
+            continue;
+        }
+
+        const char *next = m + 1;
+        char mc = *m;
+        if (mc == '\\' && m[1]) {
+            mc = m[1];
+            next = m + 2;
+        }
+        if (mc && tolower((unsigned char)mc) == tolower((unsigned char)*n)) {
+            m = next;
+            n++;
+            continue;
+        }
+        if (!star_m)
+            return 0;
+        m = star_m;
+        n = ++star_n;
+    }
+    while (*m == '*')
+        m++;
+    return !*m;
+}
+
+/*
+ * SipHash-2-4, the hash the core uses for all its hash tables
+ */
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+static inline uint64_t sip_byte(const unsigned char *in, size_t i, int nocase) {
+    return nocase ? (uint64_t)(unsigned char)tolower(in[i]) : (uint64_t)in[i];
+}
+
+static uint64_t siphash24(const unsigned char *in, size_t len, const char *key, int nocase) {
+    uint64_t k0, k1, m, b = (uint64_t)len << 56;
+    uint64_t v0 = 0x736f6d6570736575ULL, v1 = 0x646f72616e646f6dULL;
+    uint64_t v2 = 0x6c7967656e657261ULL, v3 = 0x7465646279746573ULL;
+    size_t i = 0, end = len - (len % 8);
+
+    memcpy(&k0, key, 8);
+    memcpy(&k1, key + 8, 8);
+    v0 ^= k0;
+    v1 ^= k1;
+    v2 ^= k0;
+    v3 ^= k1;
+
+    for (; i < end; i += 8) {
+        m = 0;
+        for (int j = 0; j < 8; j++)
+            m |= sip_byte(in, i + j, nocase) << (8 * j);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (int j = 0; i + j < len; j++)
+        b |= sip_byte(in, i + j, nocase) << (8 * j);
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+void siphash_generate_key(char *k) {
+    for (int i = 0; i < SIPHASH_KEY_LENGTH; i++)
+        k[i] = (char)mock_random();
+}
+
+uint64_t siphash(const char *in, const char *k) {
+    return siphash24((const unsigned char *)in, strlen(in), k, 0);
+}
+
+uint64_t siphash_raw(const char *in, size_t len, const char *k) {
+    return siphash24((const unsigned char *)in, len, k, 0);
+}
+
+uint64_t siphash_nocase(const char *in, const char *k) {
+    return siphash24((const unsigned char *)in, strlen(in), k, 1);
+}
+
+/*
+ * Client, ID and channel hash tables
+ */
+#define MOCK_HASH_SIZE 65536
+
+static Client *client_name_hash[MOCK_HASH_SIZE];
+static Client *client_id_hash[MOCK_HASH_SIZE];
+static Channel *channel_hash[MOCK_HASH_SIZE];
+static Channel *channels = NULL;
+static char mock_hashkey[SIPHASH_KEY_LENGTH] = "mockcore-hash-k";
+
+static unsigned int hash_name(const char *name) {
+    return siphash_nocase(name, mock_hashkey) % MOCK_HASH_SIZE;
+}
+
+static unsigned int hash_id(const char *id) {
+    return siphash(id, mock_hashkey) % MOCK_HASH_SIZE;
+}
+
+static void hash_add_client(Client *client) {
+    unsigned int h = hash_name(client->name);
+
+    client->mock_hash_next_name = client_name_hash[h];
+    client_name_hash[h] = client;
+    if (*client->id) {
+        h = hash_id(client->id);
+        client->mock_hash_next_id = client_id_hash[h];
+        client_id_hash[h] = client;
+    }
+}
+
+static void hash_del_client_name(Client *client) {
+    Client **p;
+
+    for (p = &client_name_hash[hash_name(client->name)]; *p; p = &(*p)->mock_hash_next_name) {
+        if (*p == client) {
+            *p = client->mock_hash_next_name;
+            break;
+        }
+    }
+}
+
+static void hash_del_client_id(Client *client) {
+    Client **p;
+
+    if (!*client->id)
+        return;
+    for (p = &client_id_hash[hash_id(client->id)]; *p; p = &(*p)->mock_hash_next_id) {
+        if (*p == client) {
+            *p = client->mock_hash_next_id;
+            break;
+        }
+    }
+}
+
+Client *hash_find_id(const char *id, Client *requester) {
+    Client *client;
+
+    for (client = client_id_hash[hash_id(id)]; client; client = client->mock_hash_next_id) {
+        if (!strcmp(client->id, id))
+            return client;
+    }
+    return NULL;
+}
+
+static Client *hash_find_name(const char *name) {
+    Client *client;
+
+    for (client = client_name_hash[hash_name(name)]; client; client = client->mock_hash_next_name) {
+        if (!strcasecmp(client->name, name))
+            return client;
+    }
+    return NULL;
+}
+
+Client *find_client(const char *name, Client *requester) {
+    Client *client;
+
+    if (isdigit((unsigned char)*name) && (client = hash_find_id(name, requester)))
+        return client;
+    return hash_find_name(name);
+}
+
+Client *find_user(const char *name, Client *requester) {
+    Client *client = find_client(name, requester);
+
+    return client && IsUser(client) ? client : NULL;
+}
+
+Client *find_server(const char *name, Client *requester) {
+    Client *client = find_client(name, requester);
+
+    return client && IsServer(client) ? client : NULL;
+}
+
+Channel *find_channel(const char *name) {
+    Channel *channel;
+
+    for (channel = channel_hash[hash_name(name)]; channel; channel = channel->mock_hash_next) {
+        if (!strcasecmp(channel->name, name))
+            return channel;
+    }
+    return NULL;
+}
+
+int valid_channelname(const char *name) {
+    return *name == '#' && strlen(name) <= CHANNELLEN && !strpbrk(name, " ,\a");
+}
+
+/*
+ * Module data slots
+ */
+typedef struct MockModData {
+    ModDataInfo info;
+    int in_use;
+    int unloaded; // module was unloaded for a rehash, data is kept
+} MockModData;
+
+#define MOCK_MODDATA_MAX 32
+static MockModData moddatas[MOCK_MODDATA_MAX];
+
+static int moddata_slots(ModDataType type) {
+    switch (type) {
+        case MODDATATYPE_CLIENT: return MODDATA_MAX_CLIENT;
+        case MODDATATYPE_LOCAL_CLIENT: return MODDATA_MAX_LOCAL_CLIENT;
+        case MODDATATYPE_CHANNEL: return MODDATA_MAX_CHANNEL;
+        default: return MODDATA_MAX_LOCAL_VARIABLE;
+    }
+}
+
+ModDataInfo *findmoddata_byname(const char *name, ModDataType type) {
+    for (int i = 0; i < MOCK_MODDATA_MAX; i++) {
+        if (moddatas[i].in_use && !moddatas[i].unloaded && moddatas[i].info.type == type &&
+            !strcmp(moddatas[i].info.name, name))
+            return &moddatas[i].info;
+    }
+    return NULL;
+}
+
+ModDataInfo *ModDataAdd(Module *module, ModDataInfo req) {
+    int free_index = -1;
+    int used[64] = { 0 };
+
+    for (int i = 0; i < MOCK_MODDATA_MAX; i++) {
+        MockModData *m = &moddatas[i];
+        if (!m->in_use) {
+            if (free_index < 0)
+                free_index = i;
+            continue;
+        }
+        if (m->info.type != req.type)
+            continue;
+        if (!strcmp(m->info.name, req.name)) {
+            if (!m->unloaded)
+                return NULL; // registered twice
+            // Reloaded after a rehash: same slot, the data stays
+            int slot = m->info.slot;
+            char *name = m->info.name;
+            m->info = req;
+            m->info.name = name;
+            m->info.slot = slot;
+            m->info.owner = module;
+            m->unloaded = 0;
+            return &m->info;
+        }
+        used[m->info.slot] = 1;
+    }
+
+    if (free_index < 0)
+        return NULL;
+    for (int slot = 0; slot < moddata_slots(req.type); slot++) {
+        if (!used[slot]) {
+            MockModData *m = &moddatas[free_index];
+            m->info = req;
+            m->info.name = our_strdup(req.name);
+            m->info.slot = slot;
+            m->info.owner = module;
+            m->in_use = 1;
+            m->unloaded = 0;
+            return &m->info;
+        }
+    }
+    return NULL;
+}
+
+static void moddata_free_client(Client *client) {
+    for (int i = 0; i < MOCK_MODDATA_MAX; i++) {
+        MockModData *m = &moddatas[i];
+        if (!m->in_use)
+            continue;
+        if (m->info.type == MODDATATYPE_CLIENT) {
+            if (m->info.free)
+                m->info.free(&client->moddata[m->info.slot]);
+            memset(&client->moddata[m->info.slot], 0, sizeof(ModData));
+        } else if (m->info.type == MODDATATYPE_LOCAL_CLIENT && client->local) {
+            if (m->info.free)
+                m->info.free(&client->local->moddata[m->info.slot]);
+            memset(&client->local->moddata[m->info.slot], 0, sizeof(ModData));
+        }
+    }
+}
+
+static void moddata_free_channel(Channel *channel) {
+    for (int i = 0; i < MOCK_MODDATA_MAX; i++) {
+        MockModData *m = &moddatas[i];
+        if (m->in_use && m->info.type == MODDATATYPE_CHANNEL) {
+            if (m->info.free)
+                m->info.free(&channel->moddata[m->info.slot]);
+            memset(&channel->moddata[m->info.slot], 0, sizeof(ModData));
+        }
+    }
+}
+
+// Free the data of one slot on every object and release it
+static void moddata_release(MockModData *m) {
+    Client *client;
+    Channel *channel;
+
+    if (m->info.type == MODDATATYPE_CLIENT || m->info.type == MODDATATYPE_LOCAL_CLIENT) {
+        list_for_each_entry(client, &client_list, client_node) {
+            ModData *md;
+            if (m->info.type == MODDATATYPE_LOCAL_CLIENT) {
+                if (!client->local)
+                    continue;
+                md = &client->local->moddata[m->info.slot];
+            } else {
+                md = &client->moddata[m->info.slot];
+            }
+            if (m->info.free)
+                m->info.free(md);
+            memset(md, 0, sizeof(ModData));
+        }
+    } else if (m->info.type == MODDATATYPE_CHANNEL) {
+        for (channel = channels; channel; channel = channel->nextch) {
+            if (m->info.free)
+                m->info.free(&channel->moddata[m->info.slot]);
+            memset(&channel->moddata[m->info.slot], 0, sizeof(ModData));
+        }
+    }
+    safe_free(m->info.name);
+    memset(m, 0, sizeof(*m));
+}
+
+/*
+ * Persistent variables, handed from one module instance to the next
+ */
+typedef struct MockPersistent MockPersistent;
+struct MockPersistent {
+    MockPersistent *next;
+    char *name;
+    void *ptr;
+    int value;
+    int is_int;
+    void (*free_variable)(ModData *m);
+};
+
+static MockPersistent *persistents = NULL;
+
+static MockPersistent *persistent_find(const char *name, int create) {
+    MockPersistent *p;
+
+    for (p = persistents; p; p = p->next) {
+        if (!strcmp(p->name, name))
+            return p;
+    }
+    if (!create)
+        return NULL;
+    p = safe_alloc(sizeof(MockPersistent));
+    p->name = our_strdup(name);
+    p->next = persistents;
+    persistents = p;
+    return p;
+}
+
+void *LoadPersistentPointerX(ModuleInfo *modinfo, const char *name, void (*free_variable)(ModData *m)) {
+    MockPersistent *p = persistent_find(name, 1);
+
+    p->free_variable = free_variable;
+    return p->ptr;
+}
+
+void SavePersistentPointerX(ModuleInfo *modinfo, const char *name, void *var) {
+    persistent_find(name, 1)->ptr = var;
+}
+
+int LoadPersistentIntX(ModuleInfo *modinfo, const char *name, int *var) {
+    MockPersistent *p = persistent_find(name, 0);
+
+    if (!p)
+        return 0;
+    *var = p->value;
+    return 1;
+}
+
+void SavePersistentIntX(ModuleInfo *modinfo, const char *name, int var) {
+    MockPersistent *p = persistent_find(name, 1);
+
+    p->value = var;
+    p->is_int = 1;
+}
+
+static void persistent_free_all(void) {
+    MockPersistent *p, *next;
+
+    for (p = persistents; p; p = next) {
+        next = p->next;
+        if (p->ptr && p->free_variable) {
+            ModData m;
+            m.ptr = p->ptr;
+            p->free_variable(&m);
+        }
+        safe_free(p->name);
+        safe_free(p);
+    }
+    persistents = NULL;
+}
+
+/*
+ * Hooks, commands, events, RPC handlers, API callbacks
+ */
+typedef struct MockCommand MockCommand;
+struct MockCommand {
+    MockCommand *next;
+    char *name;
+    CmdFunc *func;
+    int flags;
+};
+
+typedef struct MockEvent MockEvent;
+struct MockEvent {
+    MockEvent *next;
+    char *name;
+    void (*func)(void *);
+    void *data;
+};
+
+typedef struct MockRPC MockRPC;
+struct MockRPC {
+    MockRPC *next;
+    char *method;
+    void (*call)(Client *, json_t *, json_t *);
+};
+
+typedef struct MockCallback MockCallback;
+struct MockCallback {
+    MockCallback *next;
+    char *name;
+    void (*func)(OutgoingWebRequest *, OutgoingWebResponse *);
+};
+
+static MockCommand *commands = NULL;
+static MockEvent *events = NULL;
+static MockRPC *rpc_handlers = NULL;
+static MockCallback *api_callbacks = NULL;
+
+Hook *HookAddMain(Module *module, int hooktype, int priority, void (*func)(void)) {
+    MockHook *h, **p;
+
+    if (hooktype <= 0 || hooktype >= MOCK_HOOKTYPE_MAX)
+        return NULL;
+    h = safe_alloc(sizeof(MockHook));
+    h->priority = priority;
+    h->func = func;
+    for (p = &mock_hooks[hooktype]; *p && (*p)->priority <= priority; p = &(*p)->next)
+        ;
+    h->next = *p;
+    *p = h;
+    return (Hook *)h;
+}
+
+Command *CommandAdd(Module *module, const char *cmd, CmdFunc *func, unsigned char params, int flags) {
+    MockCommand *c = safe_alloc(sizeof(MockCommand));
+
+    c->name = our_strdup(cmd);
+    c->func = func;
+    c->flags = flags;
+    c->next = commands;
+    commands = c;
+    return (Command *)c;
+}
+
+int mock_run_command(Client *client, const char *cmd, int parc, const char *parv[]) {
+    MockCommand *c;
+
+    for (c = commands; c; c = c->next) {
+        if (!strcasecmp(c->name, cmd)) {
+            c->func(client, NULL, parc, parv);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+Event *EventAdd(Module *module, const char *name, void (*event)(void *), void *data, long every_msec, int count) {
+    MockEvent *e = safe_alloc(sizeof(MockEvent));
+
+    e->name = our_strdup(name);
+    e->func = event;
+    e->data = data;
+    e->next = events;
+    events = e;
+    return (Event *)e;
+}
+
+void mock_run_events(void) {
+    for (MockEvent *e = events; e; e = e->next)
+        e->func(e->data);
+}
+
+void mock_run_event(const char *name) {
+    for (MockEvent *e = events; e; e = e->next) {
+        if (!strcmp(e->name, name))
+            e->func(e->data);
+    }
+}
+
+int RPCHandlerAdd(Module *module, RPCHandlerInfo *r) {
+    MockRPC *h = safe_alloc(sizeof(MockRPC));
+
+    h->method = our_strdup(r->method);
+    h->call = r->call;
+    h->next = rpc_handlers;
+    rpc_handlers = h;
+    return 1;
+}
+
+void mock_run_rpc(Client *client, const char *method, json_t *params) {
+    json_t *request = json_object();
+
+    mock_rpc_error_code = 0;
+    if (mock_rpc_result) {
+        json_decref(mock_rpc_result);
+        mock_rpc_result = NULL;
+    }
+    json_object_set_new(request, "method", json_string(method));
+    json_object_set_new(request, "params", json_incref(params));
+    for (MockRPC *h = rpc_handlers; h; h = h->next) {
+        if (!strcmp(h->method, method)) {
+            h->call(client, request, params);
+            json_decref(request);
+            return;
+        }
+    }
+    json_decref(request);
+    mock_rpc_error_code = JSON_RPC_ERROR_NOT_FOUND;
+}
+
+void RegisterApiCallbackWebResponse(Module *module, const char *name, void (*func)(OutgoingWebRequest *, OutgoingWebResponse *)) {
+    MockCallback *cb = safe_alloc(sizeof(MockCallback));
+
+    cb->name = our_strdup(name);
+    cb->func = func;
+    cb->next = api_callbacks;
+    api_callbacks = cb;
+}
+
+static void registrations_free(void) {
+    for (int i = 0; i < MOCK_HOOKTYPE_MAX; i++) {
+        MockHook *h, *next;
+        for (h = mock_hooks[i]; h; h = next) {
+            next = h->next;
+            safe_free(h);
+        }
+        mock_hooks[i] = NULL;
+    }
+    while (commands) {
+        MockCommand *c = commands;
+        commands = c->next;
+        safe_free(c->name);
+        safe_free(c);
+    }
+    while (events) {
+        MockEvent *e = events;
+        events = e->next;
+        safe_free(e->name);
+        safe_free(e);
+    }
+    while (rpc_handlers) {
+        MockRPC *h = rpc_handlers;
+        rpc_handlers = h->next;
+        safe_free(h->method);
+        safe_free(h);
+    }
+    while (api_callbacks) {
+        MockCallback *cb = api_callbacks;
+        api_callbacks = cb->next;
+        safe_free(cb->name);
+        safe_free(cb);
+    }
+}
+
+/*
+ * Module loading
+ */
+int mock_module_load(ConfigEntry *config) {
+    int errors = 0;
+
+    if (Mod_Test && Mod_Test(&mock_modinfo) != MOD_SUCCESS)
+        goto fail;
+
+    for (ConfigEntry *ce = config ? config->items : NULL; ce; ce = ce->next) {
+        MOCK_RUN_HOOK(HOOKTYPE_CONFIGTEST, int (*)(ConfigFile *, ConfigEntry *, int, int *),
+                      &mock_conffile, ce, CONFIG_MAIN, &errors);
+    }
+    for (MockHook *h = mock_hooks[HOOKTYPE_CONFIGPOSTTEST]; h; h = h->next) {
+        int errs = 0;
+        if (((int (*)(int *))h->func)(&errs) < 0)
+            errors += errs ? errs : 1;
+    }
+    if (errors)
+        goto fail;
+
+    if (Mod_Init(&mock_modinfo) != MOD_SUCCESS)
+        goto fail;
+    for (ConfigEntry *ce = config ? config->items : NULL; ce; ce = ce->next)
+        MOCK_RUN_HOOK(HOOKTYPE_CONFIGRUN, int (*)(ConfigFile *, ConfigEntry *, int), &mock_conffile, ce, CONFIG_MAIN);
+    if (Mod_Load(&mock_modinfo) != MOD_SUCCESS) {
+        mock_module_unload(0);
+        return -1;
+    }
+    return 0;
+
+fail:
+    registrations_free();
+    return -1;
+}
+
+void mock_module_unload(int rehash) {
+    Mod_Unload(&mock_modinfo);
+    registrations_free();
+    for (int i = 0; i < MOCK_MODDATA_MAX; i++) {
+        if (!moddatas[i].in_use)
+            continue;
+        if (rehash)
+            moddatas[i].unloaded = 1;
+        else
+            moddata_release(&moddatas[i]);
+    }
+    if (!rehash)
+        persistent_free_all();
+}
+
+/*
+ * Configuration
+ */
+ConfigEntry *mock_config_add(ConfigEntry *parent, const char *name, const char *value) {
+    static int line_number = 0;
+    ConfigEntry *ce = safe_alloc(sizeof(ConfigEntry));
+    ConfigEntry **p;
+
+    ce->name = our_strdup(name);
+    ce->value = our_strdup(value);
+    ce->file = &mock_conffile;
+    ce->line_number = ++line_number;
+    ce->parent = parent;
+    if (parent) {
+        for (p = &parent->items; *p; p = &(*p)->next)
+            ;
+        *p = ce;
+    }
+    return ce;
+}
+
+void mock_config_free(ConfigEntry *ce) {
+    ConfigEntry *next;
+
+    for (; ce; ce = next) {
+        next = ce->next;
+        mock_config_free(ce->items);
+        safe_free(ce->name);
+        safe_free(ce->value);
+        safe_free(ce);
+    }
+}
+
+static void config_print(const char *what, const char *fmt, va_list vl) {
+    fprintf(stderr, "[%s] ", what);
+    vfprintf(stderr, fmt, vl);
+    fputc('\n', stderr);
+}
+
+void config_error(const char *fmt, ...) {
+    va_list vl;
+
+    mock_config_errors++;
+    va_start(vl, fmt);
+    if (!getenv("MOCK_QUIET"))
+        config_print("error", fmt, vl);
+    va_end(vl);
+}
+
+void config_warn(const char *fmt, ...) {
+    va_list vl;
+
+    va_start(vl, fmt);
+    if (getenv("MOCK_VERBOSE"))
+        config_print("warning", fmt, vl);
+    va_end(vl);
+}
+
+void config_status(const char *fmt, ...) {
+    va_list vl;
+
+    va_start(vl, fmt);
+    if (getenv("MOCK_VERBOSE"))
+        config_print("status", fmt, vl);
+    va_end(vl);
+}
+
+// Time values like 300, 5m or 1h30m; -1 if it isn't one
+long config_checkval(const char *value, unsigned short flags) {
+    long total = 0, n = 0;
+    int digits = 0;
+
+    if (!(flags & CFG_TIME))
+        return atol(value);
+    for (const char *p = value; *p; p++) {
+        if (isdigit((unsigned char)*p)) {
+            n = n * 10 + (*p - '0');
+            digits = 1;
+            continue;
+        }
+        if (!digits)
+            return -1;
+        switch (tolower((unsigned char)*p)) {
+            case 'w': total += n * 604800; break;
+            case 'd': total += n * 86400; break;
+            case 'h': total += n * 3600; break;
+            case 'm': total += n * 60; break;
+            case 's': total += n; break;
+            default: return -1;
+        }
+        n = 0;
+        digits = 0;
+    }
+    return total + n;
+}
+
+void convert_to_absolute_path(char **path, const char *reldir) {
+    char buf[512];
+
+    if (!*path || **path == '/' || !reldir)
+        return;
+    snprintf(buf, sizeof(buf), "%s/%s", reldir, *path);
+    safe_strdup(*path, buf);
+}
+
+/*
+ * Logging
+ */
+struct LogData {
+    char *key;
+    char *str;
+};
+
+LogData *log_data_string(const char *key, const char *str) {
+    LogData *d = safe_alloc(sizeof(LogData));
+
+    d->key = our_strdup(key);
+    d->str = our_strdup(str ? str : "");
+    return d;
+}
+
+LogData *log_data_integer(const char *key, int64_t integer) {
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%lld", (long long)integer);
+    return log_data_string(key, buf);
+}
+
+void do_unreal_log(int loglevel, const char *subsystem, const char *event_id, Client *client, const char *msg, ...) {
+    va_list vl;
+    LogData *d;
+    int verbose = getenv("MOCK_VERBOSE") != NULL;
+
+    mock_log_count++;
+    if (verbose)
+        fprintf(stderr, "[log %s.%s] %s", subsystem, event_id, msg);
+    va_start(vl, msg);
+    while ((d = va_arg(vl, LogData *))) {
+        if (verbose)
+            fprintf(stderr, " %s=%s", d->key, d->str);
+        safe_free(d->key);
+        safe_free(d->str);
+        safe_free(d);
+    }
+    va_end(vl);
+    if (verbose)
+        fputc('\n', stderr);
+}
+
+/*
+ * Sending. A line is formatted like the core would, counted and added
+ * to the sendq of the connection it would go out on.
+ */
+static void mock_deliver(Client *to, MessageTag *mtags, const char *text) {
+    char line[4096];
+    Client *via = to ? to->direction : NULL;
+
+    if (mtags && mtags->name) {
+        if (mtags->value)
+            snprintf(line, sizeof(line), "@%s=%s %s", mtags->name, mtags->value, text);
+        else
+            snprintf(line, sizeof(line), "@%s %s", mtags->name, text);
+        text = line;
+    }
+
+    mock_lines_sent++;
+    if (via && via->local)
+        via->local->sendQ.length += strlen(text) + 2;
+
+    if (mock_capture) {
+        MockLine *l = safe_alloc(sizeof(MockLine));
+        l->to = to;
+        l->line = our_strdup(text);
+        *mock_lines_tail = l;
+        mock_lines_tail = &l->next;
+    }
+}
+
+void sendto_one(Client *to, MessageTag *mtags, const char *pattern, ...) {
+    char buf[1024];
+    va_list vl;
+
+    va_start(vl, pattern);
+    vsnprintf(buf, sizeof(buf), pattern, vl);
+    va_end(vl);
+    mock_deliver(to, mtags, buf);
+}
+
+void sendto_server(Client *one, unsigned long caps, unsigned long nocaps, MessageTag *mtags, const char *format, ...) {
+    char buf[1024];
+    va_list vl;
+    Client *server;
+
+    va_start(vl, format);
+    vsnprintf(buf, sizeof(buf), format, vl);
+    va_end(vl);
+
+    list_for_each_entry(server, &global_server_list, client_node) {
+        if (IsMe(server) || !MyConnect(server) || (one && server == one->direction))
+            continue;
+        mock_deliver(server, mtags, buf);
+    }
+}
+
+void sendnotice(Client *to, const char *pattern, ...) {
+    char text[1024];
+    va_list vl;
+
+    va_start(vl, pattern);
+    vsnprintf(text, sizeof(text), pattern, vl);
+    va_end(vl);
+    sendto_one(to, NULL, ":%s NOTICE %s :%s", me.name, to->name, text);
+}
+
+void sendtxtnumeric(Client *to, const char *pattern, ...) {
+    char text[1024];
+    va_list vl;
+
+    va_start(vl, pattern);
+    vsnprintf(text, sizeof(text), pattern, vl);
+    va_end(vl);
+    sendto_one(to, NULL, ":%s %03d %s :%s", me.name, RPL_TEXT, to->name, text);
+}
+
+static const char *numeric_format(int numeric) {
+    switch (numeric) {
+        case ERR_NOSUCHCHANNEL: return "%s :No such channel";
+        case ERR_NEEDMOREPARAMS: return "%s :Not enough parameters";
+        case ERR_NOPRIVILEGES: return ":Permission Denied- You do not have the correct IRC Operator privileges";
+        case ERR_CHANOPRIVSNEEDED: return "%s :You're not channel operator";
+        default: return ":";
+    }
+}
+
+void sendnumeric(Client *to, int numeric, ...) {
+    char text[1024];
+    va_list vl;
+
+    va_start(vl, numeric);
+    vsnprintf(text, sizeof(text), numeric_format(numeric), vl);
+    va_end(vl);
+    sendto_one(to, NULL, ":%s %03d %s %s", me.name, numeric, to->name, text);
+}
+
+void add_nvplist_numeric_fmt(NameValuePrioList **lst, int priority, const char *name, Client *to, int numeric, const char *pattern, ...) {
+    char realpattern[512], buf[512];
+    NameValuePrioList *e, **p;
+    va_list vl;
+
+    snprintf(realpattern, sizeof(realpattern), "%03d %s", numeric, pattern);
+    va_start(vl, pattern);
+    vsnprintf(buf, sizeof(buf), realpattern, vl);
+    va_end(vl);
+
+    e = safe_alloc(sizeof(NameValuePrioList));
+    e->priority = priority;
+    safe_strdup(e->name, name);
+    safe_strdup(e->value, buf);
+    for (p = lst; *p && (*p)->priority <= priority; p = &(*p)->next)
+        ;
+    e->next = *p;
+    if (*p)
+        (*p)->prev = e;
+    *p = e;
+}
+
+void free_nvplist(NameValuePrioList *lst) {
+    NameValuePrioList *next;
+
+    for (; lst; lst = next) {
+        next = lst->next;
+        safe_free(lst->name);
+        safe_free(lst->value);
+        safe_free(lst);
+    }
+}
+
+int mock_count_lines(Client *to, const char *substring) {
+    int n = 0;
+
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        if ((!to || l->to == to) && (!substring || strstr(l->line, substring)))
+            n++;
+    }
+    return n;
+}
+
+void mock_clear_lines(void) {
+    while (mock_lines) {
+        MockLine *l = mock_lines;
+        mock_lines = l->next;
+        safe_free(l->line);
+        safe_free(l);
+    }
+    mock_lines_tail = &mock_lines;
+}
+
+/*
+ * Clients and channels
+ */
+static void client_set_id(Client *client, const char *sid) {
+    static unsigned int uid_counter = 0;
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    unsigned int n = uid_counter++;
+
+    // SID followed by 6 characters, like the core's UIDs
+    strlcpy(client->id, sid, sizeof(client->id));
+    for (int i = 8; i >= 3; i--) {
+        client->id[i] = chars[n % 36];
+        n /= 36;
+    }
+    client->id[9] = '\0';
+}
+
+static Client *make_user(Client *server, const char *nick, const char *username, const char *ip, int local) {
+    Client *client = safe_alloc(sizeof(Client));
+
+    client->status = CLIENT_STATUS_USER;
+    client->user = safe_alloc(sizeof(User));
+    strlcpy(client->name, nick, sizeof(client->name));
+    strlcpy(client->user->username, username ? username : "user", sizeof(client->user->username));
+    strlcpy(client->user->realhost, ip ? ip : "localhost", sizeof(client->user->realhost));
+    strlcpy(client->user->account, "0", sizeof(client->user->account));
+    strlcpy(client->info, "Mock user", sizeof(client->info));
+    safe_strdup(client->ip, ip);
+    client->uplink = server;
+    client_set_id(client, server->id);
+    if (local) {
+        client->local = safe_alloc(sizeof(LocalClient));
+        client->local->creationtime = TStime();
+        client->direction = client;
+        list_add(&client->lclient_node, &lclient_list);
+    } else {
+        client->direction = server->direction;
+        INIT_LIST_HEAD(&client->lclient_node);
+    }
+    list_add(&client->client_node, &client_list);
+    hash_add_client(client);
+    return client;
+}
+
+Client *mock_local_user(const char *nick, const char *username, const char *ip) {
+    return make_user(&me, nick, username, ip, 1);
+}
+
+Client *mock_remote_user(Client *server, const char *nick, const char *username, const char *ip) {
+    return make_user(server, nick, username, ip, 0);
+}
+
+// A server directly linked to us
+Client *mock_server(const char *name, const char *sid) {
+    Client *server = safe_alloc(sizeof(Client));
+
+    server->status = CLIENT_STATUS_SERVER;
+    strlcpy(server->name, name, sizeof(server->name));
+    strlcpy(server->id, sid, sizeof(server->id));
+    server->local = safe_alloc(sizeof(LocalClient));
+    server->direction = server;
+    server->uplink = &me;
+    INIT_LIST_HEAD(&server->lclient_node);
+    list_add(&server->client_node, &global_server_list);
+    hash_add_client(server);
+    return server;
+}
+
+void mock_set_nick(Client *client, const char *nick) {
+    hash_del_client_name(client);
+    strlcpy(client->name, nick, sizeof(client->name));
+    client->mock_hash_next_name = client_name_hash[hash_name(nick)];
+    client_name_hash[hash_name(nick)] = client;
+}
+
+void mock_set_account(Client *client, const char *account) {
+    strlcpy(client->user->account, account ? account : "0", sizeof(client->user->account));
+}
+
+static void channel_part(Channel *channel, Client *client) {
+    Member **m;
+
+    for (m = &channel->members; *m; m = &(*m)->next) {
+        if ((*m)->client == client) {
+            Member *gone = *m;
+            *m = gone->next;
+            safe_free(gone);
+            channel->users--;
+            return;
+        }
+    }
+}
+
+void mock_free_client(Client *client) {
+    if (client == &me)
+        return;
+    for (Channel *channel = channels; channel; channel = channel->nextch)
+        channel_part(channel, client);
+    moddata_free_client(client);
+    hash_del_client_name(client);
+    hash_del_client_id(client);
+    list_del(&client->client_node);
+    if (MyUser(client))
+        list_del(&client->lclient_node);
+    safe_free(client->ip);
+    safe_free(client->user);
+    safe_free(client->local);
+    safe_free(client);
+}
+
+void mock_connect(Client *client) {
+    if (MyUser(client))
+        MOCK_RUN_HOOK(HOOKTYPE_LOCAL_CONNECT, int (*)(Client *), client);
+}
+
+void mock_quit(Client *client, const char *comment) {
+    if (MyUser(client))
+        MOCK_RUN_HOOK(HOOKTYPE_LOCAL_QUIT, int (*)(Client *, MessageTag *, const char *), client, NULL, comment);
+    mock_free_client(client);
+}
+
+Channel *mock_channel(const char *name) {
+    Channel *channel = find_channel(name);
+    unsigned int h;
+
+    if (channel)
+        return channel;
+    channel = safe_alloc(sizeof(Channel));
+    strlcpy(channel->name, name, sizeof(channel->name));
+    h = hash_name(channel->name);
+    channel->mock_hash_next = channel_hash[h];
+    channel_hash[h] = channel;
+    channel->nextch = channels;
+    channels = channel;
+    return channel;
+}
+
+void mock_join(Client *client, Channel *channel, const char *member_modes) {
+    Member *m = safe_alloc(sizeof(Member));
+
+    m->client = client;
+    strlcpy(m->member_modes, member_modes ? member_modes : "", sizeof(m->member_modes));
+    m->next = channel->members;
+    channel->members = m;
+    channel->users++;
+}
+
+void mock_free_channel(Channel *channel) {
+    Channel **p;
+
+    moddata_free_channel(channel);
+    while (channel->members)
+        channel_part(channel, channel->members->client);
+    for (p = &channel_hash[hash_name(channel->name)]; *p; p = &(*p)->mock_hash_next) {
+        if (*p == channel) {
+            *p = channel->mock_hash_next;
+            break;
+        }
+    }
+    for (p = &channels; *p; p = &(*p)->nextch) {
+        if (*p == channel) {
+            *p = channel->nextch;
+            break;
+        }
+    }
+    safe_free(channel->topic);
+    safe_free(channel);
+}
+
+int check_channel_access(Client *client, Channel *channel, const char *modes) {
+    for (Member *m = channel->members; m; m = m->next) {
+        if (m->client == client)
+            return strpbrk(m->member_modes, modes) != NULL;
+    }
+    return 0;
+}
+
+int has_channel_mode(Channel *channel, char mode) {
+    return channel && mode && strchr(channel->mock_modes, mode) != NULL;
+}
+
+int HasCapability(Client *client, const char *cap) {
+    if (!client || !client->local)
+        return 0;
+    if (!strcmp(cap, "batch"))
+        return client->local->caps & MOCK_CAP_BATCH;
+    return 0;
+}
+
+int get_sendq(Client *client) {
+    return mock_sendq_limit;
+}
+
+/*
+ * Security groups
+ */
+SecurityGroup *mock_security_group(const char *name) {
+    SecurityGroup *s = safe_alloc(sizeof(SecurityGroup));
+    SecurityGroup **p;
+
+    strlcpy(s->name, name, sizeof(s->name));
+    // Keep config order, the first block comes first
+    for (p = &securitygroups; *p; p = &(*p)->next)
+        s->prev = *p;
+    *p = s;
+    return s;
+}
+
+void mock_free_security_groups(void) {
+    while (securitygroups) {
+        SecurityGroup *s = securitygroups;
+        securitygroups = s->next;
+        safe_free(s->mask);
+        safe_free(s->realname);
+        safe_free(s);
+    }
+}
+
+SecurityGroup *find_security_group(const char *name) {
+    for (SecurityGroup *s = securitygroups; s; s = s->next) {
+        if (!strcasecmp(s->name, name))
+            return s;
+    }
+    return NULL;
+}
+
+int user_allowed_by_security_group(Client *client, SecurityGroup *s) {
+    if (!s || !IsUser(client))
+        return 0;
+    if (s->identified && !IsLoggedIn(client))
+        return 0;
+    if (s->oper && !IsOper(client))
+        return 0;
+    if (s->mask) {
+        char buf[NICKLEN + USERLEN + HOSTLEN + 3];
+        snprintf(buf, sizeof(buf), "%s!%s@%s", client->name, client->user->username, client->ip ? client->ip : "");
+        if (!match_simple(s->mask, buf))
+            return 0;
+    }
+    if (s->realname && !match_simple(s->realname, client->info))
+        return 0;
+    return 1;
+}
+
+int user_allowed_by_security_group_name(Client *client, const char *name) {
+    return user_allowed_by_security_group(client, find_security_group(name));
+}
+
+const char *get_security_groups(Client *client) {
+    static char buf[512];
+
+    *buf = '\0';
+    for (SecurityGroup *s = securitygroups; s; s = s->next) {
+        if (user_allowed_by_security_group(client, s)) {
+            if (*buf)
+                strlcat(buf, ",", sizeof(buf));
+            strlcat(buf, s->name, sizeof(buf));
+        }
+    }
+    return buf;
+}
+
+/*
+ * JSON-RPC
+ */
+const char *json_object_get_string(json_t *j, const char *name) {
+    json_t *v = json_object_get(j, name);
+
+    return json_is_string(v) ? json_string_value(v) : NULL;
+}
+
+int64_t json_object_get_integer(json_t *j, const char *name, int64_t default_value) {
+    json_t *v = json_object_get(j, name);
+
+    return json_is_integer(v) ? json_integer_value(v) : default_value;
+}
+
+json_t *json_string_unreal(const char *s) {
+    return json_string(s ? s : "");
+}
+
+void json_expand_client(json_t *j, const char *key, Client *client, int detail) {
+    json_t *child = key ? json_object() : j;
+
+    json_object_set_new(child, "name", json_string_unreal(client->name));
+    json_object_set_new(child, "id", json_string_unreal(client->id));
+    if (detail > 0 && client->ip)
+        json_object_set_new(child, "ip", json_string_unreal(client->ip));
+    if (key)
+        json_object_set_new(j, key, child);
+}
+
+void rpc_response(Client *client, json_t *request, json_t *result) {
+    if (mock_rpc_result)
+        json_decref(mock_rpc_result);
+    mock_rpc_result = json_incref(result);
+}
+
+void rpc_error(Client *client, json_t *request, int error_code, const char *error_message) {
+    mock_rpc_error_code = error_code;
+}
+
+void rpc_error_fmt(Client *client, json_t *request, int error_code, const char *fmt, ...) {
+    mock_rpc_error_code = error_code;
+}
+
+/*
+ * Outgoing web requests
+ */
+typedef struct MockURL MockURL;
+struct MockURL {
+    MockURL *next;
+    OutgoingWebRequest *request;
+};
+
+static MockURL *url_queue = NULL, **url_queue_tail = &url_queue;
+
+static void url_request_free(OutgoingWebRequest *request) {
+    safe_free(request->url);
+    safe_free(request->body);
+    safe_free(request->apicallback);
+    safe_free(request);
+}
+
+void url_start_async(OutgoingWebRequest *request) {
+    MockURL *u;
+
+    if (mock_url_discard) {
+        safe_free(request->callback_data);
+        url_request_free(request);
+        return;
+    }
+    u = safe_alloc(sizeof(MockURL));
+    u->request = request;
+    *url_queue_tail = u;
+    url_queue_tail = &u->next;
+    mock_url_pending++;
+}
+
+// Finish the oldest pending request with this body or error
+const char *mock_url_next(void) {
+    return url_queue ? url_queue->request->url : NULL;
+}
+
+void mock_url_complete(const char *body, const char *errorbuf) {
+    MockURL *u = url_queue;
+    OutgoingWebResponse response;
+
+    if (!u)
+        return;
+    url_queue = u->next;
+    if (!url_queue)
+        url_queue_tail = &url_queue;
+    mock_url_pending--;
+
+    memset(&response, 0, sizeof(response));
+    response.memory = (char *)body;
+    response.size = body ? strlen(body) : 0;
+    response.errorbuf = (char *)errorbuf;
+    for (MockCallback *cb = api_callbacks; cb; cb = cb->next) {
+        if (u->request->apicallback && !strcmp(cb->name, u->request->apicallback)) {
+            cb->func(u->request, &response);
+            break;
+        }
+    }
+    url_request_free(u->request);
+    safe_free(u);
+}
+
+/*
+ * Databases
+ */
+struct UnrealDB {
+    FILE *fd;
+    UnrealDBMode mode;
+};
+
+static const char *unrealdb_error = "no error";
+
+UnrealDB *unrealdb_open(const char *filename, UnrealDBMode mode, char *secret_block) {
+    UnrealDB *c;
+    FILE *fd = fopen(filename, mode == UNREALDB_MODE_WRITE ? "wb" : "rb");
+
+    if (!fd) {
+        unrealdb_error = strerror(errno);
+        return NULL;
+    }
+    c = safe_alloc(sizeof(UnrealDB));
+    c->fd = fd;
+    c->mode = mode;
+    return c;
+}
+
+int unrealdb_close(UnrealDB *c) {
+    int ok = fclose(c->fd) == 0;
+
+    if (!ok)
+        unrealdb_error = strerror(errno);
+    safe_free(c);
+    return ok;
+}
+
+static int unrealdb_write(UnrealDB *c, const void *buf, size_t len) {
+    if (c->mode != UNREALDB_MODE_WRITE || fwrite(buf, 1, len, c->fd) != len) {
+        unrealdb_error = "write error";
+        return 0;
+    }
+    return 1;
+}
+
+static int unrealdb_read(UnrealDB *c, void *buf, size_t len) {
+    if (c->mode != UNREALDB_MODE_READ || fread(buf, 1, len, c->fd) != len) {
+        unrealdb_error = "short read";
+        return 0;
+    }
+    return 1;
+}
+
+int unrealdb_write_int64(UnrealDB *c, uint64_t t) {
+    return unrealdb_write(c, &t, sizeof(t));
+}
+
+int unrealdb_write_int32(UnrealDB *c, uint32_t t) {
+    return unrealdb_write(c, &t, sizeof(t));
+}
+
+int unrealdb_write_str(UnrealDB *c, const char *x) {
+    uint16_t len = x ? (uint16_t)strlen(x) : 0xffff;
+
+    if (x && strlen(x) >= 0xffff) {
+        unrealdb_error = "string too long";
+        return 0;
+    }
+    return unrealdb_write(c, &len, sizeof(len)) && (!x || unrealdb_write(c, x, len));
+}
+
+int unrealdb_read_int64(UnrealDB *c, uint64_t *t) {
+    return unrealdb_read(c, t, sizeof(*t));
+}
+
+int unrealdb_read_int32(UnrealDB *c, uint32_t *t) {
+    return unrealdb_read(c, t, sizeof(*t));
+}
+
+int unrealdb_read_str(UnrealDB *c, char **x) {
+    uint16_t len;
+
+    *x = NULL;
+    if (!unrealdb_read(c, &len, sizeof(len)))
+        return 0;
+    if (len == 0xffff)
+        return 1;
+    *x = safe_alloc(len + 1);
+    if (!unrealdb_read(c, *x, len)) {
+        safe_free(*x);
+        return 0;
+    }
+    (*x)[len] = '\0';
+    return 1;
+}
+
+const char *unrealdb_get_error_string(void) {
+    return unrealdb_error;
+}
+
+int unreal_rename(const char *oldpath, const char *newpath) {
+    return rename(oldpath, newpath);
+}
+
+/*
+ * Setup and reset
+ */
+__attribute__((constructor))
+static void mock_init(void) {
+    INIT_LIST_HEAD(&client_list);
+    INIT_LIST_HEAD(&lclient_list);
+    INIT_LIST_HEAD(&global_server_list);
+
+    me.status = CLIENT_STATUS_ME;
+    strlcpy(me.name, "irc.example.org", sizeof(me.name));
+    strlcpy(me.id, "001", sizeof(me.id));
+    strlcpy(me.info, "Mock server", sizeof(me.info));
+    me.direction = &me;
+    me.uplink = &me;
+    INIT_LIST_HEAD(&me.lclient_node);
+    list_add(&me.client_node, &global_server_list);
+    hash_add_client(&me);
+    timeofday = time(NULL);
+}
+
+void mock_reset(void) {
+    while (channels)
+        mock_free_channel(channels);
+    while (client_list.next != &client_list)
+        mock_free_client(list_entry(client_list.next, Client, client_node));
+    while (global_server_list.next != &global_server_list) {
+        Client *server = list_entry(global_server_list.next, Client, client_node);
+        if (server == &me) {
+            // me stays, move it to the back and stop once only it is left
+            if (server->client_node.next == &global_server_list)
+                break;
+            list_del(&me.client_node);
+            list_add(&me.client_node, global_server_list.prev);
+            continue;
+        }
+        mock_free_client(server);
+    }
+    mock_free_security_groups();
+    mock_clear_lines();
+    mock_capture = 0;
+    mock_sendq_limit = 200000;
+    mock_url_discard = 0;
+    while (url_queue) {
+        MockURL *u = url_queue;
+        url_queue = u->next;
+        safe_free(u->request->callback_data);
+        url_request_free(u->request);
+        safe_free(u);
+    }
+    url_queue_tail = &url_queue;
+    mock_url_pending = 0;
+    if (mock_rpc_result) {
+        json_decref(mock_rpc_result);
+        mock_rpc_result = NULL;
+    }
+    mock_rpc_error_code = 0;
+}
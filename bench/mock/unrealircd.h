@@ -0,0 +1,568 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+/*
+ * Stand-in for the UnrealIRCd 6 headers, just enough of them to compile
+ * the modules in this repository outside an UnrealIRCd tree. Names,
+ * signatures and macro semantics follow the real ones; the implementation
+ * is in mockcore.c. Everything prefixed mock_ is test/bench plumbing that
+ * does not exist in UnrealIRCd.
+ */
+#ifndef MOCK_UNREALIRCD_H
+#define MOCK_UNREALIRCD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <jansson.h>
+
+#define FORMAT_STRING(x) x
+
+#define NICKLEN 30
+#define USERLEN 10
+#define HOSTLEN 63
+#define REALLEN 50
+#define ACCOUNTLEN 30
+#define CHANNELLEN 32
+#define IDLEN 12
+#define BATCHLEN 22
+#define TOPICLEN 360
+#define MAXPARA 15
+#define SIPHASH_KEY_LENGTH 16
+
+#define PERMDATADIR mock_datadir
+
+#define MOD_SUCCESS 0
+#define MOD_FAILED -1
+#define HOOK_CONTINUE 0
+#define CONFIG_MAIN 1
+#define CFG_TIME 0x0001
+
+#define CMD_UNREGISTERED 0x0001
+#define CMD_USER 0x0002
+#define CMD_SERVER 0x0004
+
+#define ULOG_DEBUG 1000
+#define ULOG_INFO 2000
+#define ULOG_WARNING 3000
+#define ULOG_ERROR 4000
+
+#define ERR_NOSUCHCHANNEL 403
+#define ERR_NEEDMOREPARAMS 461
+#define ERR_NOPRIVILEGES 481
+#define ERR_CHANOPRIVSNEEDED 482
+#define RPL_TEXT 304
+
+#define JSON_RPC_ERROR_INVALID_PARAMS -32602
+#define JSON_RPC_ERROR_INTERNAL_ERROR -32603
+#define JSON_RPC_ERROR_NOT_FOUND -1000
+
+#define HTTP_METHOD_GET 1
+#define HTTP_METHOD_POST 2
+
+enum {
+    HOOKTYPE_CONFIGTEST = 1,
+    HOOKTYPE_CONFIGPOSTTEST,
+    HOOKTYPE_CONFIGRUN,
+    HOOKTYPE_LOCAL_CONNECT,
+    HOOKTYPE_LOCAL_QUIT,
+    HOOKTYPE_LOCAL_JOIN,
+    HOOKTYPE_POST_LOCAL_NICKCHANGE,
+    HOOKTYPE_ACCOUNT_LOGIN,
+    HOOKTYPE_LOCAL_OPER,
+    HOOKTYPE_UMODE_CHANGE,
+    HOOKTYPE_USERHOST_CHANGE,
+    HOOKTYPE_IP_CHANGE,
+    HOOKTYPE_REALNAME_CHANGE,
+    HOOKTYPE_WHOIS,
+    HOOKTYPE_STATS,
+    MOCK_HOOKTYPE_MAX
+};
+
+// Linux style intrusive lists, as in UnrealIRCd's list.h
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define INIT_LIST_HEAD(ptr) do { (ptr)->next = (ptr); (ptr)->prev = (ptr); } while (0)
+#define list_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define list_for_each_entry(pos, head, member) \
+    for (pos = list_entry((head)->next, __typeof__(*pos), member); \
+         &pos->member != (head); \
+         pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+static inline void list_add(struct list_head *entry, struct list_head *head) {
+    entry->next = head->next;
+    entry->prev = head;
+    head->next->prev = entry;
+    head->next = entry;
+}
+
+static inline void list_del(struct list_head *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = entry;
+}
+
+// Doubly linked lists with prev/next members, as in UnrealIRCd's list.c
+#define AddListItem(item, list) do { \
+        (item)->prev = NULL; \
+        (item)->next = (list); \
+        if (list) \
+            (list)->prev = (item); \
+        (list) = (item); \
+    } while (0)
+
+#define DelListItem(item, list) do { \
+        if ((item)->prev) \
+            (item)->prev->next = (item)->next; \
+        else \
+            (list) = (item)->next; \
+        if ((item)->next) \
+            (item)->next->prev = (item)->prev; \
+        (item)->prev = (item)->next = NULL; \
+    } while (0)
+
+typedef union ModData {
+    int i;
+    long l;
+    char *str;
+    void *ptr;
+} ModData;
+
+#define MODDATA_MAX_CLIENT 8
+#define MODDATA_MAX_LOCAL_CLIENT 8
+#define MODDATA_MAX_CHANNEL 8
+#define MODDATA_MAX_LOCAL_VARIABLE 64
+
+typedef enum ModDataType {
+    MODDATATYPE_LOCAL_VARIABLE = 1,
+    MODDATATYPE_GLOBAL_VARIABLE,
+    MODDATATYPE_CLIENT,
+    MODDATATYPE_LOCAL_CLIENT,
+    MODDATATYPE_CHANNEL,
+} ModDataType;
+
+typedef struct Module Module;
+
+typedef struct ModDataInfo {
+    char *name;
+    ModDataType type;
+    void (*free)(ModData *m);
+    const char *(*serialize)(ModData *m);
+    void (*unserialize)(const char *str, ModData *m);
+    int sync;
+    int remote_write;
+    int slot;
+    Module *owner;
+} ModDataInfo;
+
+typedef struct ModuleInfo {
+    Module *handle;
+    int flags;
+} ModuleInfo;
+
+typedef struct ModuleHeader {
+    const char *name;
+    const char *version;
+    const char *description;
+    const char *author;
+    const char *modversion;
+} ModuleHeader;
+
+#define MOD_HEADER Mod_Header
+#define MOD_TEST() int Mod_Test(ModuleInfo *modinfo)
+#define MOD_INIT() int Mod_Init(ModuleInfo *modinfo)
+#define MOD_LOAD() int Mod_Load(ModuleInfo *modinfo)
+#define MOD_UNLOAD() int Mod_Unload(ModuleInfo *modinfo)
+#define MARK_AS_GLOBAL_MODULE(modinfo) do { (modinfo)->flags |= 1; } while (0)
+
+// Not every module has a MOD_TEST, the mock core checks for it at runtime
+extern ModuleHeader Mod_Header;
+int Mod_Test(ModuleInfo *modinfo) __attribute__((weak));
+int Mod_Init(ModuleInfo *modinfo);
+int Mod_Load(ModuleInfo *modinfo);
+int Mod_Unload(ModuleInfo *modinfo);
+
+typedef struct ConfigFile {
+    char *filename;
+} ConfigFile;
+
+typedef struct ConfigEntry ConfigEntry;
+struct ConfigEntry {
+    char *name;
+    char *value;
+    ConfigEntry *next;
+    ConfigEntry *items;
+    ConfigEntry *parent;
+    ConfigFile *file;
+    int line_number;
+};
+
+typedef struct dbuf {
+    unsigned int length;
+} dbuf;
+
+#define DBufLength(dyn) ((dyn)->length)
+
+typedef struct MessageTag MessageTag;
+struct MessageTag {
+    MessageTag *prev, *next;
+    char *name;
+    char *value;
+};
+
+typedef struct LocalClient {
+    dbuf sendQ;
+    time_t creationtime;
+    int caps;       // mock: MOCK_CAP_* bits
+    ModData moddata[MODDATA_MAX_LOCAL_CLIENT];
+} LocalClient;
+
+typedef struct User {
+    char username[USERLEN + 1];
+    char realhost[HOSTLEN + 1];
+    char account[ACCOUNTLEN + 1];
+} User;
+
+#define CLIENT_STATUS_ME 1
+#define CLIENT_STATUS_SERVER 2
+#define CLIENT_STATUS_USER 3
+
+#define CLIENT_FLAG_ULINE 0x1
+
+#define UMODE_OPER 0x1
+
+typedef struct Client Client;
+struct Client {
+    struct list_head client_node;   // client_list for users, global_server_list for servers
+    struct list_head lclient_node;  // lclient_list, local users only
+    Client *direction;
+    Client *uplink;
+    LocalClient *local;
+    User *user;
+    int status;
+    long flags;
+    long umodes;
+    char name[HOSTLEN + 1];         // nick or server name
+    char id[IDLEN + 1];
+    char info[REALLEN + 1];
+    char *ip;
+    ModData moddata[MODDATA_MAX_CLIENT];
+    Client *mock_hash_next_name;
+    Client *mock_hash_next_id;
+};
+
+typedef struct Member Member;
+struct Member {
+    Member *next;
+    Client *client;
+    char member_modes[8];
+};
+
+typedef struct Channel Channel;
+struct Channel {
+    Channel *nextch;
+    Channel *mock_hash_next;
+    char *topic;
+    int users;
+    Member *members;
+    char mock_modes[32];            // channel mode letters that are set
+    ModData moddata[MODDATA_MAX_CHANNEL];
+    char name[CHANNELLEN + 1];
+};
+
+// Security groups as far as the mock needs them: a user is a member if
+// every criterion that is set holds
+typedef struct SecurityGroup SecurityGroup;
+struct SecurityGroup {
+    SecurityGroup *prev, *next;
+    char name[64];
+    int identified;   // logged in to services
+    int oper;         // IRCOp
+    char *mask;       // nick!user@ip, matched with match_simple
+    char *realname;   // matched with match_simple
+};
+
+#define IsMe(x) ((x)->status == CLIENT_STATUS_ME)
+#define IsServer(x) ((x)->status == CLIENT_STATUS_SERVER || IsMe(x))
+#define IsUser(x) ((x)->status == CLIENT_STATUS_USER)
+#define IsULine(x) ((x)->flags & CLIENT_FLAG_ULINE)
+#define IsOper(x) ((x)->umodes & UMODE_OPER)
+#define MyConnect(x) ((x)->local != NULL)
+#define MyUser(x) (MyConnect(x) && IsUser(x))
+#define IsLoggedIn(x) (IsUser(x) && (x)->user && *(x)->user->account != '*' && !isdigit((unsigned char)*(x)->user->account))
+#define BadPtr(x) (!(x) || (*(x) == '\0'))
+
+#define moddata_client(client, md) (client)->moddata[(md)->slot]
+#define moddata_local_client(client, md) (client)->local->moddata[(md)->slot]
+#define moddata_channel(channel, md) (channel)->moddata[(md)->slot]
+
+typedef struct NameValuePrioList NameValuePrioList;
+struct NameValuePrioList {
+    NameValuePrioList *prev, *next;
+    int priority;
+    char *name;
+    char *value;
+};
+
+typedef struct OutgoingWebRequest {
+    char *url;
+    int http_method;
+    char *body;
+    char *apicallback;
+    void *callback_data;
+    int max_redirects;
+} OutgoingWebRequest;
+
+typedef struct OutgoingWebResponse {
+    char *errorbuf;
+    char *memory;
+    size_t size;
+} OutgoingWebResponse;
+
+typedef struct RPCHandlerInfo {
+    const char *method;
+    int flags;
+    int loglevel;
+    void (*call)(Client *, json_t *, json_t *);
+} RPCHandlerInfo;
+
+typedef struct LogData LogData;
+
+typedef struct UnrealDB UnrealDB;
+typedef enum UnrealDBMode {
+    UNREALDB_MODE_READ = 0,
+    UNREALDB_MODE_WRITE = 1,
+} UnrealDBMode;
+
+typedef struct Event Event;
+typedef struct Command Command;
+typedef struct Hook Hook;
+
+#define CMD_FUNC(x) void (x)(Client *client, MessageTag *recv_mtags, int parc, const char *parv[])
+#define EVENT(x) void (x)(void *data)
+#define RPC_CALL_FUNC(x) void (x)(Client *client, json_t *request, json_t *params)
+typedef CMD_FUNC(CmdFunc);
+
+extern Client me;
+extern struct list_head client_list, lclient_list, global_server_list;
+extern SecurityGroup *securitygroups;
+extern time_t timeofday;
+extern char *mock_datadir;
+
+#define TStime() (timeofday)
+
+// Memory
+void *safe_alloc(size_t size);
+char *our_strdup(const char *str);
+void outofmemory(size_t bytes);
+#define safe_free(x) do { if (x) free(x); (x) = NULL; } while (0)
+#define safe_strdup(dst, str) do { char *safe_strdup_tmp = our_strdup(str); if (dst) free(dst); (dst) = safe_strdup_tmp; } while (0)
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+char *strtoken(char **save, char *str, const char *fs);
+int ircvsnprintf(char *buf, size_t size, const char *fmt, va_list vl);
+int ircsnprintf(char *buf, size_t size, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,3,4)));
+int match_simple(const char *mask, const char *name);
+
+// Hashing and randomness
+void siphash_generate_key(char *k);
+uint64_t siphash(const char *in, const char *k);
+uint64_t siphash_raw(const char *in, size_t len, const char *k);
+uint64_t siphash_nocase(const char *in, const char *k);
+uint32_t getrandom32(void);
+void generate_batch_id(char *str);
+
+// Modules, hooks, commands, events
+#define HookAdd(module, hooktype, priority, func) HookAddMain(module, hooktype, priority, (void (*)(void))(func))
+Hook *HookAddMain(Module *module, int hooktype, int priority, void (*func)(void));
+Command *CommandAdd(Module *module, const char *cmd, CmdFunc *func, unsigned char params, int flags);
+Event *EventAdd(Module *module, const char *name, void (*event)(void *), void *data, long every_msec, int count);
+ModDataInfo *ModDataAdd(Module *module, ModDataInfo req);
+ModDataInfo *findmoddata_byname(const char *name, ModDataType type);
+int RPCHandlerAdd(Module *module, RPCHandlerInfo *r);
+void RegisterApiCallbackWebResponse(Module *module, const char *name, void (*func)(OutgoingWebRequest *, OutgoingWebResponse *));
+
+#define LoadPersistentPointer(modinfo, var, free_function) var = LoadPersistentPointerX(modinfo, #var, free_function)
+#define SavePersistentPointer(modinfo, var) SavePersistentPointerX(modinfo, #var, var)
+#define LoadPersistentInt(modinfo, var) LoadPersistentIntX(modinfo, #var, &var)
+#define SavePersistentInt(modinfo, var) SavePersistentIntX(modinfo, #var, var)
+void *LoadPersistentPointerX(ModuleInfo *modinfo, const char *name, void (*free_variable)(ModData *m));
+void SavePersistentPointerX(ModuleInfo *modinfo, const char *name, void *var);
+int LoadPersistentIntX(ModuleInfo *modinfo, const char *name, int *var);
+void SavePersistentIntX(ModuleInfo *modinfo, const char *name, int var);
+
+// Configuration
+void config_error(FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,1,2)));
+void config_warn(FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,1,2)));
+void config_status(FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,1,2)));
+long config_checkval(const char *value, unsigned short flags);
+void convert_to_absolute_path(char **path, const char *reldir);
+
+// Logging
+#define unreal_log(...) do_unreal_log(__VA_ARGS__, NULL)
+void do_unreal_log(int loglevel, const char *subsystem, const char *event_id, Client *client, const char *msg, ...);
+LogData *log_data_string(const char *key, const char *str);
+LogData *log_data_integer(const char *key, int64_t integer);
+
+// Clients, channels, security groups
+Client *find_client(const char *name, Client *requester);
+Client *find_user(const char *name, Client *requester);
+Client *find_server(const char *name, Client *requester);
+Client *hash_find_id(const char *id, Client *requester);
+Channel *find_channel(const char *name);
+int check_channel_access(Client *client, Channel *channel, const char *modes);
+int has_channel_mode(Channel *channel, char mode);
+int valid_channelname(const char *name);
+int HasCapability(Client *client, const char *cap);
+int get_sendq(Client *client);
+int user_allowed_by_security_group(Client *client, SecurityGroup *s);
+int user_allowed_by_security_group_name(Client *client, const char *name);
+SecurityGroup *find_security_group(const char *name);
+const char *get_security_groups(Client *client);
+
+// Sending
+void sendto_one(Client *to, MessageTag *mtags, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,3,4)));
+void sendto_server(Client *one, unsigned long caps, unsigned long nocaps, MessageTag *mtags, FORMAT_STRING(const char *format), ...) __attribute__((format(printf,5,6)));
+void sendnotice(Client *to, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,2,3)));
+void sendnumeric(Client *to, int numeric, ...);
+void sendtxtnumeric(Client *to, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,2,3)));
+void add_nvplist_numeric_fmt(NameValuePrioList **lst, int priority, const char *name, Client *to, int numeric, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,6,7)));
+void free_nvplist(NameValuePrioList *lst);
+
+// JSON-RPC
+const char *json_object_get_string(json_t *j, const char *name);
+int64_t json_object_get_integer(json_t *j, const char *name, int64_t default_value);
+json_t *json_string_unreal(const char *s);
+void json_expand_client(json_t *j, const char *key, Client *client, int detail);
+void rpc_response(Client *client, json_t *request, json_t *result);
+void rpc_error(Client *client, json_t *request, int error_code, const char *error_message);
+void rpc_error_fmt(Client *client, json_t *request, int error_code, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,4,5)));
+
+#define REQUIRE_PARAM_STRING(name, varname) do { \
+        varname = json_object_get_string(params, name); \
+        if (!varname) { \
+            rpc_error_fmt(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Missing parameter: '%s'", name); \
+            return; \
+        } \
+    } while (0)
+#define OPTIONAL_PARAM_STRING(name, varname) varname = json_object_get_string(params, name)
+#define OPTIONAL_PARAM_INTEGER(name, varname, def) varname = json_object_get_integer(params, name, def)
+
+// Outgoing HTTP, completed by hand with mock_url_complete()
+void url_start_async(OutgoingWebRequest *request);
+
+// Databases: same calls as UnrealIRCd, but a plain unencrypted file
+UnrealDB *unrealdb_open(const char *filename, UnrealDBMode mode, char *secret_block);
+int unrealdb_close(UnrealDB *c);
+int unrealdb_write_int64(UnrealDB *c, uint64_t t);
+int unrealdb_write_int32(UnrealDB *c, uint32_t t);
+int unrealdb_write_str(UnrealDB *c, const char *x);
+int unrealdb_read_int64(UnrealDB *c, uint64_t *t);
+int unrealdb_read_int32(UnrealDB *c, uint32_t *t);
+int unrealdb_read_str(UnrealDB *c, char **x);
+const char *unrealdb_get_error_string(void);
+int unreal_rename(const char *oldpath, const char *newpath);
+
+/*
+ * Mock core control, used by the tests and benchmarks only
+ */
+
+#define MOCK_CAP_BATCH 0x1
+
+// Load the module compiled into this binary the way a boot or /REHASH
+// does: MOD_TEST, config test, MOD_INIT, config run, MOD_LOAD.
+// Returns 0 on success, -1 if any step failed.
+int mock_module_load(ConfigEntry *config);
+// MOD_UNLOAD. With rehash set persistent data and moddata are kept for the
+// next mock_module_load(), otherwise they are freed as on a real unload.
+void mock_module_unload(int rehash);
+
+// Config blocks, e.g. mock_config_add(root, "cloak-ident-keys", NULL) and
+// mock_config_add(block, "key1", "value")
+ConfigEntry *mock_config_add(ConfigEntry *parent, const char *name, const char *value);
+void mock_config_free(ConfigEntry *ce);
+
+Client *mock_local_user(const char *nick, const char *username, const char *ip);
+Client *mock_remote_user(Client *server, const char *nick, const char *username, const char *ip);
+Client *mock_server(const char *name, const char *sid);
+void mock_set_nick(Client *client, const char *nick);
+void mock_set_account(Client *client, const char *account);
+void mock_free_client(Client *client);
+// Run the LOCAL_CONNECT hooks of a local user, or the LOCAL_QUIT hooks and
+// then free it, like the core does. Unload the module before mock_reset()
+// so it never sees clients vanish without a quit.
+void mock_connect(Client *client);
+void mock_quit(Client *client, const char *comment);
+Channel *mock_channel(const char *name);
+void mock_join(Client *client, Channel *channel, const char *member_modes);
+void mock_free_channel(Channel *channel);
+
+SecurityGroup *mock_security_group(const char *name);
+void mock_free_security_groups(void);
+
+// Lines sent by the module, only recorded while mock_capture is set.
+// to is the server for lines sent with sendto_server().
+typedef struct MockLine MockLine;
+struct MockLine {
+    MockLine *next;
+    Client *to;
+    char *line;
+};
+extern int mock_capture;
+extern MockLine *mock_lines;
+extern unsigned long mock_lines_sent;   // counted whether captured or not
+extern int mock_sendq_limit;
+int mock_count_lines(Client *to, const char *substring);
+void mock_clear_lines(void);
+
+// Hooks registered by the module, to be called by the test
+typedef struct MockHook MockHook;
+struct MockHook {
+    MockHook *next;
+    int priority;
+    void (*func)(void);
+};
+extern MockHook *mock_hooks[MOCK_HOOKTYPE_MAX];
+#define MOCK_RUN_HOOK(hooktype, functype, ...) do { \
+        for (MockHook *mock_h = mock_hooks[hooktype]; mock_h; mock_h = mock_h->next) \
+            ((functype)mock_h->func)(__VA_ARGS__); \
+    } while (0)
+
+int mock_run_command(Client *client, const char *cmd, int parc, const char *parv[]);
+void mock_run_events(void);
+void mock_run_event(const char *name);
+void mock_run_rpc(Client *client, const char *method, json_t *params);
+extern int mock_rpc_error_code;       // code of the last rpc_error(), 0 if the call succeeded
+extern json_t *mock_rpc_result;       // result of the last rpc_response(), owned by the mock
+
+// Pending url_start_async() requests
+extern int mock_url_pending;
+extern int mock_url_discard;          // drop requests right away, as if they never complete
+void mock_url_complete(const char *body, const char *errorbuf);
+const char *mock_url_next(void);      // URL of the oldest pending request, NULL if none
+
+extern unsigned long mock_log_count;
+extern unsigned long mock_config_errors;
+
+// Reset between tests: frees all clients, channels and security groups
+void mock_reset(void);
+
+uint64_t mock_random(void);
+void mock_seed(uint64_t seed);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../citywhois/citywhois.c"
+#include "test.h"
+
+// TEST_MMDB is written by gen_test_mmdb.py, see there for what is in it
+static int load_citywhois(const char *db) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    int ret;
+
+    mock_config_add(mock_config_add(root, MYCONF, NULL), "db", db);
+    ret = mock_module_load(root);
+    mock_config_free(root);
+    return ret;
+}
+
+// The WHOIS line an oper gets for a user at this IP, "" if none
+static const char *whois_line(const char *ip) {
+    static char line[512];
+    Client *oper = mock_local_user("oper", "oper", "192.0.2.1");
+    Client *target = mock_local_user("target", "target", ip);
+    NameValuePrioList *list = NULL;
+
+    oper->umodes |= UMODE_OPER;
+    citywhois_whois(oper, target, &list);
+    strlcpy(line, list ? list->value : "", sizeof(line));
+    free_nvplist(list);
+    mock_free_client(target);
+    mock_free_client(oper);
+    return line;
+}
+
+TEST(city_for_ipv4_and_ipv6) {
+    CHECK_INTEQ(load_citywhois(TEST_MMDB), 0);
+    CHECK_STREQ(whois_line("10.0.0.1"), "320 target :is connecting from City: Amsterdam");
+    CHECK_STREQ(whois_line("10.1.2.3"), "320 target :is connecting from City: Jakarta");
+    CHECK_STREQ(whois_line("10.0.44.9"), "320 target :is connecting from City: São Paulo");
+    CHECK_STREQ(whois_line("2001:db8:1::1"), "320 target :is connecting from City: Berlin");
+    CHECK_INTEQ(modstats->mmdb_lookup.calls, 4);
+    mock_module_unload(0);
+}
+
+TEST(unknown_city_and_location) {
+    CHECK_INTEQ(load_citywhois(TEST_MMDB), 0);
+    CHECK_STREQ(whois_line("10.0.254.1"), "320 target :is connecting from an unknown city");
+    CHECK_STREQ(whois_line("10.0.255.1"), "320 target :is connecting from an unknown location");
+    CHECK_STREQ(whois_line("192.0.2.1"), "320 target :is connecting from an unknown location");
+    CHECK_STREQ(whois_line(NULL), "320 target :No IP found!!");
+    mock_module_unload(0);
+}
+
+TEST(only_opers_see_it) {
+    Client *user = mock_local_user("user", "user", "192.0.2.1");
+    Client *target = mock_local_user("target", "target", "10.0.0.1");
+    NameValuePrioList *list = NULL;
+
+    CHECK_INTEQ(load_citywhois(TEST_MMDB), 0);
+    citywhois_whois(user, target, &list);
+    CHECK(list == NULL);
+    CHECK_INTEQ(modstats->whois.calls, 0);
+    mock_module_unload(0);
+}
+
+TEST(missing_database_is_a_config_error) {
+    unsigned long errors = mock_config_errors;
+
+    CHECK_INTEQ(load_citywhois("/nonexistent/GeoLite2-City.mmdb"), -1);
+    CHECK(mock_config_errors > errors);
+}
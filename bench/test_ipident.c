@@ -0,0 +1,114 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../ipident/ipident.c"
+#include "test.h"
+
+static int load_ipident(const char *ipv4_prefix, const char *ipv6_prefix, int nkeys) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, "cloak-ident-keys", NULL);
+    int ret;
+
+    for (int i = 0; i < nkeys; i++)
+        mock_config_add(block, "key", i ? "second-test-key-0123456789" : "first-test-key-0123456789");
+    if (ipv4_prefix)
+        mock_config_add(block, "ipv4-prefix", ipv4_prefix);
+    if (ipv6_prefix)
+        mock_config_add(block, "ipv6-prefix", ipv6_prefix);
+    ret = mock_module_load(root);
+    mock_config_free(root);
+    return ret;
+}
+
+// Run the connect hook for a fresh user on this address, return the ident
+static const char *ident_of(const char *ip) {
+    static char ident[USERLEN + 1];
+    Client *client = mock_local_user("test", "original", ip);
+
+    mock_connect(client);
+    strlcpy(ident, client->user->username, sizeof(ident));
+    mock_free_client(client);
+    return ident;
+}
+
+TEST(ident_format) {
+    CHECK_INTEQ(load_ipident(NULL, NULL, 1), 0);
+    const char *ident = ident_of("10.1.2.3");
+    CHECK_INTEQ(strlen(ident), 9);
+    for (int i = 0; i < 6; i++)
+        CHECK(isalpha((unsigned char)ident[i]));
+    for (int i = 6; i < 9; i++)
+        CHECK(isdigit((unsigned char)ident[i]));
+    mock_module_unload(0);
+}
+
+TEST(ident_is_stable) {
+    char first[USERLEN + 1];
+
+    CHECK_INTEQ(load_ipident(NULL, NULL, 2), 0);
+    strlcpy(first, ident_of("10.1.2.3"), sizeof(first));
+    CHECK_STREQ(ident_of("10.1.2.3"), first);
+    CHECK(strcmp(ident_of("10.1.2.4"), first) != 0);
+
+    // Same keys after a rehash, same ident
+    mock_module_unload(1);
+    CHECK_INTEQ(load_ipident(NULL, NULL, 2), 0);
+    CHECK_STREQ(ident_of("10.1.2.3"), first);
+
+    // Other keys, other ident
+    mock_module_unload(1);
+    CHECK_INTEQ(load_ipident(NULL, NULL, 1), 0);
+    CHECK(strcmp(ident_of("10.1.2.3"), first) != 0);
+    mock_module_unload(0);
+}
+
+TEST(ident_prefix_grouping) {
+    char first[USERLEN + 1];
+
+    CHECK_INTEQ(load_ipident("24", NULL, 1), 0);
+    strlcpy(first, ident_of("10.1.2.3"), sizeof(first));
+    CHECK_STREQ(ident_of("10.1.2.200"), first);
+    CHECK(strcmp(ident_of("10.1.3.3"), first) != 0);
+
+    // Default /64 for IPv6: privacy addresses share the ident
+    strlcpy(first, ident_of("2001:db8:1:2::1"), sizeof(first));
+    CHECK_STREQ(ident_of("2001:db8:1:2:aaaa:bbbb:cccc:dddd"), first);
+    CHECK(strcmp(ident_of("2001:db8:1:3::1"), first) != 0);
+    mock_module_unload(0);
+}
+
+TEST(ident_untouched_without_keys_or_ip) {
+    Client *client;
+
+    CHECK_INTEQ(load_ipident(NULL, NULL, 0), 0);
+    CHECK_STREQ(ident_of("10.1.2.3"), "original");
+    mock_module_unload(0);
+
+    CHECK_INTEQ(load_ipident(NULL, NULL, 1), 0);
+    client = mock_local_user("noip", "original", NULL);
+    set_crypto_ip_based_ident(client);
+    CHECK_STREQ(client->user->username, "original");
+    mock_module_unload(0);
+}
+
+TEST(config_rejects_bad_prefix) {
+    CHECK_INTEQ(load_ipident("33", NULL, 1), -1);
+    CHECK_INTEQ(load_ipident(NULL, "0", 1), -1);
+}
+
+TEST(modstats_survive_rehash) {
+    CHECK_INTEQ(load_ipident(NULL, NULL, 1), 0);
+    ident_of("10.1.2.3");
+    ident_of("10.1.2.4");
+    CHECK_INTEQ(modstats->ident.calls, 2);
+    mock_module_unload(1);
+    CHECK_INTEQ(load_ipident(NULL, NULL, 1), 0);
+    CHECK_INTEQ(modstats->ident.calls, 2);
+
+    mock_run_rpc(&me, "modstats.ipident", NULL);
+    CHECK_INTEQ(mock_rpc_error_code, 0);
+    CHECK(json_object_get(json_object_get(mock_rpc_result, "stats"), "ident") != NULL);
+    mock_module_unload(0);
+}
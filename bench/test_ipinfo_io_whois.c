@@ -0,0 +1,115 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../ipinfo_io_whois/ipinfo_io_whois.c"
+#include "test.h"
+
+#define ANSWER "{\"ip\": \"10.0.0.1\", \"city\": \"Leiden\", \"region\": \"South Holland\", \"country\": \"NL\", \"org\": \"AS64496 Example\"}"
+#define INFO "City: Leiden, Region: South Holland, Country: NL, Org: AS64496 Example"
+
+static Client *oper, *target;
+
+static int load_ipinfo(const char *api_url) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, MYCONF, NULL);
+    int ret;
+
+    mock_config_add(block, "apikey", "KEY");
+    if (api_url)
+        mock_config_add(block, "api-url", api_url);
+    ret = mock_module_load(root);
+    mock_config_free(root);
+    oper = mock_local_user("oper", "oper", "192.0.2.1");
+    oper->umodes |= UMODE_OPER;
+    target = mock_local_user("target", "target", "10.0.0.1");
+    return ret;
+}
+
+// What a WHOIS on the target adds, "" if nothing
+static const char *whois_line(void) {
+    static char line[512];
+    NameValuePrioList *list = NULL;
+
+    ipinfo_io_whois_whois(oper, target, &list);
+    strlcpy(line, list ? list->value : "", sizeof(line));
+    free_nvplist(list);
+    return line;
+}
+
+TEST(miss_asks_the_api_and_caches_the_answer) {
+    CHECK_INTEQ(load_ipinfo(NULL), 0);
+    mock_capture = 1;
+    CHECK_STREQ(whois_line(), "");
+    CHECK_INTEQ(mock_url_pending, 1);
+    CHECK_STREQ(mock_url_next(), "https://ipinfo.io/10.0.0.1?token=KEY");
+
+    mock_url_complete(ANSWER, NULL);
+    CHECK_INTEQ(mock_count_lines(oper, " 320 oper target :is connecting from " INFO), 1);
+    CHECK_STREQ(whois_line(), "320 target :is connecting from " INFO);
+    CHECK_INTEQ(mock_url_pending, 0);
+    CHECK_INTEQ(modstats->cache_hits, 1);
+    CHECK_INTEQ(modstats->cache_misses, 1);
+    CHECK_INTEQ(modstats->http.calls, 1);
+    mock_module_unload(0);
+}
+
+TEST(api_url_gets_a_trailing_slash) {
+    CHECK_INTEQ(load_ipinfo("http://127.0.0.1:8080"), 0);
+    whois_line();
+    CHECK_STREQ(mock_url_next(), "http://127.0.0.1:8080/10.0.0.1?token=KEY");
+    mock_module_unload(0);
+}
+
+TEST(cache_entries_expire) {
+    CHECK_INTEQ(load_ipinfo(NULL), 0);
+    add_to_cache("10.0.0.1", INFO);
+    CHECK(find_in_cache("10.0.0.1") != NULL);
+    find_in_cache("10.0.0.1")->timestamp -= cache_duration + 1;
+    CHECK(find_in_cache("10.0.0.1") == NULL);
+    CHECK_STREQ(whois_line(), "");
+    CHECK_INTEQ(mock_url_pending, 1);
+    mock_module_unload(0);
+}
+
+TEST(bad_answers_are_api_errors) {
+    CHECK_INTEQ(load_ipinfo(NULL), 0);
+    for (int i = 0; i < 3; i++)
+        whois_line();
+    mock_url_complete(NULL, "Connection refused");
+    mock_url_complete("{\"error\": {\"title\": \"Rate limit exceeded\"}}", NULL);
+    mock_url_complete("<html>502 Bad Gateway</html>", NULL);
+    CHECK_INTEQ(modstats->api_errors, 3);
+    CHECK(find_in_cache("10.0.0.1") == NULL);
+    mock_module_unload(0);
+}
+
+TEST(answer_after_the_requester_left) {
+    CHECK_INTEQ(load_ipinfo(NULL), 0);
+    mock_capture = 1;
+    whois_line();
+    mock_free_client(oper);
+    mock_url_complete(ANSWER, NULL);
+    CHECK_INTEQ(mock_count_lines(NULL, NULL), 0);
+    CHECK(find_in_cache("10.0.0.1") != NULL);
+    mock_module_unload(0);
+}
+
+TEST(not_for_regular_users) {
+    NameValuePrioList *list = NULL;
+
+    CHECK_INTEQ(load_ipinfo(NULL), 0);
+    ipinfo_io_whois_whois(target, oper, &list);
+    CHECK(list == NULL);
+    CHECK_INTEQ(mock_url_pending, 0);
+    mock_module_unload(0);
+}
+
+TEST(apikey_is_required) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+
+    mock_config_add(root, MYCONF, NULL);
+    CHECK_INTEQ(mock_module_load(root), -1);
+    mock_config_free(root);
+}
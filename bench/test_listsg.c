@@ -0,0 +1,469 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../listsg/listsg.c"
+#include "test.h"
+#include "population.h"
+
+static Client **users;
+static Client *oper;
+
+static void setup(int nusers) {
+    PopulationOptions opt = { .users = nusers, .loggedin_percent = 40, .oper_percent = 5, .seed = 7 };
+
+    mock_security_group("everyone");
+    mock_security_group("known-users")->identified = 1;
+    mock_security_group("opers")->oper = 1;
+    mock_security_group("subnet")->mask = our_strdup("*!*@10.0.0.*");
+    users = population_create(&opt);
+    oper = mock_local_user("oper", "oper", "192.0.2.1");
+    oper->umodes |= UMODE_OPER;
+    CHECK_INTEQ(mock_module_load(NULL), 0);
+}
+
+static void teardown(void) {
+    mock_module_unload(0);
+    safe_free(users);
+}
+
+// Every group's index against user_allowed_by_security_group() on every client
+static void check_index(void) {
+    for (int g = 0; g < sg_group_count; g++) {
+        int expected = 0, indexed = 0, pos = 0;
+        Client *client;
+
+        list_for_each_entry(client, &lclient_list, lclient_node) {
+            if (user_allowed_by_security_group(client, sg_groups[g].sg)) {
+                expected++;
+                CHECK(SG_HAS_BIT(SGINDEX(client)->bits, g));
+            }
+        }
+        while ((client = sgindex_next_member(&sg_groups[g], &pos))) {
+            CHECK(user_allowed_by_security_group(client, sg_groups[g].sg));
+            indexed++;
+        }
+        CHECK_INTEQ(sg_groups[g].members, expected);
+        CHECK_INTEQ(indexed, expected);
+    }
+}
+
+// Nicknames in the "- a, b, c" lines of a listing
+static int count_listed(Client *to) {
+    int n = 0;
+
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        const char *text = strstr(l->line, " :- ");
+        if (l->to != to || !text || strstr(l->line, "- ["))
+            continue;
+        n++;
+        for (const char *p = text + 4; *p; p++)
+            n += *p == ',';
+    }
+    return n;
+}
+
+TEST(index_matches_full_scan) {
+    setup(2000);
+    check_index();
+
+    // Churn: logins, opers, quits and new connections
+    for (int i = 0; i < 2000; i += 7) {
+        mock_set_account(users[i], "someone");
+        MOCK_RUN_HOOK(HOOKTYPE_ACCOUNT_LOGIN, int (*)(Client *, MessageTag *), users[i], NULL);
+    }
+    for (int i = 3; i < 2000; i += 11) {
+        users[i]->umodes ^= UMODE_OPER;
+        MOCK_RUN_HOOK(HOOKTYPE_UMODE_CHANGE, int (*)(Client *, long, long), users[i], 0, users[i]->umodes);
+    }
+    for (int i = 5; i < 2000; i += 3) {
+        mock_quit(users[i], "bye");
+        users[i] = NULL;
+    }
+    for (int i = 0; i < 500; i++) {
+        char nick[16];
+        snprintf(nick, sizeof(nick), "new%d", i);
+        mock_connect(mock_local_user(nick, nick, i % 2 ? "10.0.0.9" : "10.9.9.9"));
+    }
+    check_index();
+
+    const char *parv[] = { NULL, NULL };
+    mock_capture = 1;
+    mock_run_command(oper, "SG-check", 1, parv);
+    CHECK_INTEQ(mock_count_lines(oper, "0 missing, 0 stale, 0 miscounted groups"), 1);
+    teardown();
+}
+
+static SGIndexGroup *group_by_name(const char *name) {
+    for (int g = 0; g < sg_group_count; g++) {
+        if (!strcmp(sg_groups[g].name, name))
+            return &sg_groups[g];
+    }
+    return NULL;
+}
+
+// Logins nobody told the index about are picked up by the resync, one
+// batch of clients per run of the step event
+TEST(resync_runs_in_batches) {
+    int before, rounds = 0;
+
+    setup(2000);
+    before = group_by_name("known-users")->members;
+    for (int i = 0; i < 2000; i++) {
+        if (!IsLoggedIn(users[i]))
+            mock_set_account(users[i], "someone");
+    }
+
+    mock_run_event("sgindex_resync");
+    mock_run_event("sgindex_resync_step");
+    CHECK(group_by_name("known-users")->members > before);
+    CHECK(group_by_name("known-users")->members < 2000);
+    CHECK(sg_resync_active);
+
+    while (sg_resync_active && rounds++ < 100)
+        mock_run_event("sgindex_resync_step");
+    CHECK_INTEQ(rounds, (2001 + SG_RESYNC_BATCH - 1) / SG_RESYNC_BATCH - 1);
+    CHECK_INTEQ(group_by_name("known-users")->members, 2000);
+    check_index();
+    teardown();
+}
+
+TEST(index_follows_setname_and_logout) {
+    const char *parv[] = { NULL, NULL };
+    Client *loggedin = NULL;
+    int known;
+
+    mock_security_group("bots")->realname = our_strdup("*bot*");
+    setup(100);
+    CHECK_INTEQ(group_by_name("bots")->members, 0);
+
+    strlcpy(users[1]->info, "I am a bot", sizeof(users[1]->info));
+    MOCK_RUN_HOOK(HOOKTYPE_REALNAME_CHANGE, int (*)(Client *, const char *), users[1], "");
+    CHECK_INTEQ(group_by_name("bots")->members, 1);
+
+    for (int i = 0; i < 100 && !loggedin; i++) {
+        if (IsLoggedIn(users[i]))
+            loggedin = users[i];
+    }
+    CHECK(loggedin != NULL);
+    known = group_by_name("known-users")->members;
+    mock_set_account(loggedin, NULL);
+    MOCK_RUN_HOOK(HOOKTYPE_ACCOUNT_LOGIN, int (*)(Client *, MessageTag *), loggedin, NULL);
+    CHECK_INTEQ(group_by_name("known-users")->members, known - 1);
+
+    mock_capture = 1;
+    mock_run_command(oper, "SG-check", 1, parv);
+    CHECK_INTEQ(mock_count_lines(oper, "0 missing, 0 stale, 0 miscounted groups"), 1);
+    teardown();
+}
+
+TEST(sg_lists_every_member_once) {
+    const char *parv[] = { NULL, "everyone", NULL };
+
+    setup(300);
+    mock_sendq_limit = 1 << 30;
+    mock_capture = 1;
+    mock_run_command(oper, "SG", 2, parv);
+    CHECK_INTEQ(count_listed(oper), 301);
+    CHECK_INTEQ(mock_count_lines(oper, "Members of security group everyone:"), 1);
+    CHECK(sg_outputs == NULL);
+    teardown();
+}
+
+TEST(sg_is_paced_by_sendq) {
+    const char *parv[] = { NULL, "everyone", NULL };
+    int rounds = 0;
+
+    setup(3000);
+    mock_sendq_limit = 4000;
+    mock_capture = 1;
+    mock_run_command(oper, "SG", 2, parv);
+    CHECK(sg_outputs != NULL);
+    CHECK(count_listed(oper) < 3001);
+
+    // One listing at a time per client
+    mock_run_command(oper, "SG", 2, parv);
+    CHECK_INTEQ(mock_count_lines(oper, "still being sent"), 1);
+
+    // The client reads its sendq, the event sends the next part
+    while (sg_outputs && rounds++ < 1000) {
+        oper->local->sendQ.length = 0;
+        mock_run_events();
+    }
+    CHECK(sg_outputs == NULL);
+    CHECK_INTEQ(count_listed(oper), 3001);
+    teardown();
+}
+
+TEST(sg_gives_up_on_a_stalled_client) {
+    const char *parv[] = { NULL, "everyone", NULL };
+
+    setup(3000);
+    mock_sendq_limit = 4000;
+    mock_capture = 1;
+    mock_run_command(oper, "SG", 2, parv);
+    CHECK(sg_outputs != NULL);
+    timeofday += SG_OUTPUT_MAX_AGE + 1;
+    mock_run_events();
+    CHECK(sg_outputs == NULL);
+    CHECK_INTEQ(mock_count_lines(oper, "not reading it fast enough"), 1);
+    teardown();
+}
+
+// /SG -global: local members, then the remote answers, then the end
+// line, all inside one batch
+TEST(sg_global_stays_in_batch_order) {
+    const char *parv[] = { NULL, "-global", "subnet", NULL };
+    Client *hub;
+    unsigned int id = 0;
+    char idbuf[16];
+
+    setup(500);
+    hub = mock_server("hub.example.org", "002");
+    oper->local->caps |= MOCK_CAP_BATCH;
+    mock_sendq_limit = 1 << 30;
+    mock_capture = 1;
+    mock_run_command(oper, "SG", 3, parv);
+    CHECK(sg_outputs != NULL);
+
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        if (l->to == hub)
+            sscanf(l->line, ":001 SGQUERY %u subnet", &id);
+    }
+    CHECK(id != 0);
+    snprintf(idbuf, sizeof(idbuf), "%u", id);
+
+    const char *reply[] = { NULL, me.id, idbuf, "remote1 remote2", NULL };
+    const char *end[] = { NULL, me.id, idbuf, "2", NULL };
+    mock_run_command(hub, "SGREPLY", 4, reply);
+    mock_run_command(hub, "SGEND", 4, end);
+    CHECK(sg_outputs == NULL);
+
+    // Order of what the oper got
+    const char *expect[] = { "BATCH +", "Members of security group subnet", "Asking 1 other server",
+                             " :- ", "- [hub.example.org] remote1 remote2", "End of network-wide query", "BATCH -" };
+    int step = 0, in_batch = 0;
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        if (l->to != oper)
+            continue;
+        if (strstr(l->line, "BATCH +"))
+            in_batch = 1;
+        else if (strstr(l->line, "BATCH -"))
+            in_batch = 0;
+        else
+            CHECK(in_batch && !strncmp(l->line, "@batch=", 7));
+        if (step < 7 && strstr(l->line, expect[step]))
+            step++;
+    }
+    CHECK_INTEQ(step, 7);
+    teardown();
+}
+
+// Full SG_REPLY_PAYLOAD answers from a server with a long name, for an
+// oper with a long nick: split again, nothing cut off
+TEST(sg_global_remote_lines_fit) {
+    const char *parv[] = { NULL, "-global", "subnet", NULL };
+    char hubname[HOSTLEN + 1], payload[SG_REPLY_PAYLOAD + 1], idbuf[16], nick[NICKLEN + 1];
+    unsigned int id = 0;
+    int sent = 0, listed = 0, len = 0, nickchars = 0;
+    Client *hub;
+
+    setup(10);
+    memset(hubname, 'h', HOSTLEN);
+    memcpy(hubname + HOSTLEN - 12, ".example.org", 13);
+    hub = mock_server(hubname, "002");
+    memset(nick, 'o', NICKLEN);
+    nick[NICKLEN] = '\0';
+    mock_set_nick(oper, nick);
+    mock_sendq_limit = 1 << 30;
+    mock_capture = 1;
+    mock_run_command(oper, "SG", 3, parv);
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        if (l->to == hub)
+            sscanf(l->line, ":001 SGQUERY %u subnet", &id);
+    }
+    CHECK(id != 0);
+    snprintf(idbuf, sizeof(idbuf), "%u", id);
+
+    // Nicks of NICKLEN characters and a shorter one to fill the payload
+    while (len < SG_REPLY_PAYLOAD - 1) {
+        int nicklen = SG_REPLY_PAYLOAD - len - !!len;
+        if (nicklen > NICKLEN)
+            nicklen = NICKLEN;
+        len += snprintf(payload + len, sizeof(payload) - len, "%s%0*d", len ? " " : "", nicklen, sent);
+        sent++;
+    }
+    CHECK_INTEQ(len, SG_REPLY_PAYLOAD);
+    const char *reply[] = { NULL, me.id, idbuf, payload, NULL };
+    const char *end[] = { NULL, me.id, idbuf, "0", NULL };
+    for (int i = 0; i < 3; i++)
+        mock_run_command(hub, "SGREPLY", 4, reply);
+    mock_run_command(hub, "SGEND", 4, end);
+
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        const char *text;
+        if (l->to != oper)
+            continue;
+        CHECK(strlen(l->line) <= 510);
+        if (!(text = strstr(l->line, "] ")))
+            continue;
+        for (const char *p = text + 2; *p; p++) {
+            if (*p != ' ' && (p == text + 2 || p[-1] == ' ')) {
+                nickchars += strcspn(p, " ");
+                listed++;
+            }
+        }
+    }
+    CHECK_INTEQ(listed, 3 * sent);
+    CHECK_INTEQ(nickchars, 3 * (SG_REPLY_PAYLOAD - (sent - 1)));
+    teardown();
+}
+
+// "- <group>: <count>" line for every group, to client
+static int stats_line(Client *to, const char *name) {
+    char prefix[64];
+    int count = -1;
+
+    snprintf(prefix, sizeof(prefix), ":- %s: ", name);
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        const char *text = strstr(l->line, prefix);
+        if (l->to == to && text) {
+            CHECK_INTEQ(count, -1);
+            count = atoi(text + strlen(prefix));
+        }
+    }
+    return count;
+}
+
+// /SG-STATS gives the index counts, which must match a full scan
+TEST(sg_stats_matches_index) {
+    const char *parv[] = { NULL, NULL };
+
+    setup(1000);
+    for (int i = 0; i < 1000; i += 9) {
+        mock_set_account(users[i], "someone");
+        MOCK_RUN_HOOK(HOOKTYPE_ACCOUNT_LOGIN, int (*)(Client *, MessageTag *), users[i], NULL);
+    }
+    for (int i = 1; i < 1000; i += 4) {
+        mock_quit(users[i], "bye");
+        users[i] = NULL;
+    }
+    check_index();
+
+    mock_capture = 1;
+    mock_run_command(oper, "SG-STATS", 1, parv);
+    for (int g = 0; g < sg_group_count; g++) {
+        int expected = 0;
+        Client *client;
+
+        list_for_each_entry(client, &lclient_list, lclient_node)
+            expected += user_allowed_by_security_group(client, sg_groups[g].sg);
+        CHECK_INTEQ(stats_line(oper, sg_groups[g].name), expected);
+    }
+    teardown();
+}
+
+// /SG-STATS -global: remote counts are added to ours, groups we don't
+// have are counted as skipped
+TEST(sg_stats_global_sums_remote) {
+    const char *parv[] = { NULL, "-global", NULL };
+    const char *names[] = { "everyone", "known-users", "opers", "subnet" };
+    int local[4];
+    unsigned int id = 0;
+    char idbuf[16];
+    Client *hub;
+
+    setup(300);
+    hub = mock_server("hub.example.org", "002");
+    for (int g = 0; g < 4; g++)
+        local[g] = group_by_name(names[g])->members;
+    mock_capture = 1;
+    mock_run_command(oper, "SG-STATS", 2, parv);
+    for (MockLine *l = mock_lines; l; l = l->next) {
+        if (l->to == hub)
+            sscanf(l->line, ":001 SGSTATSQ %u", &id);
+    }
+    CHECK(id != 0);
+    snprintf(idbuf, sizeof(idbuf), "%u", id);
+    mock_clear_lines();
+
+    // Two batches, as a server with many groups would send them
+    const char *batch1[] = { NULL, me.id, idbuf, "everyone=1000 opers=12 staff=4", NULL };
+    const char *batch2[] = { NULL, me.id, idbuf, "known-users=250 subnet=0 helpers=9 opers=3", NULL };
+    const char *end[] = { NULL, me.id, idbuf, "7", NULL };
+    mock_run_command(hub, "SGSTATS", 4, batch1);
+    mock_run_command(hub, "SGSTATS", 4, batch2);
+    CHECK_INTEQ(mock_count_lines(oper, "Network-wide"), 0);
+    mock_run_command(hub, "SGEND", 4, end);
+
+    CHECK_INTEQ(mock_count_lines(oper, "(1 of 1 servers answered):"), 1);
+    CHECK_INTEQ(stats_line(oper, names[0]), local[0] + 1000);
+    CHECK_INTEQ(stats_line(oper, names[1]), local[1] + 250);
+    CHECK_INTEQ(stats_line(oper, names[2]), local[2] + 15);
+    CHECK_INTEQ(stats_line(oper, names[3]), local[3]);
+    CHECK_INTEQ(mock_count_lines(oper, "- 2 remote group counts for groups not configured here were skipped"), 1);
+    CHECK(sg_queries == NULL);
+    teardown();
+}
+
+TEST(rpc_members_pages_and_limits) {
+    json_t *params = json_object();
+    int seen = 0, pages = 0;
+
+    setup(250);
+    json_object_set_new(params, "name", json_string("everyone"));
+    json_object_set_new(params, "limit", json_integer(0));
+    mock_run_rpc(oper, "security_group.members", params);
+    CHECK_INTEQ(mock_rpc_error_code, JSON_RPC_ERROR_INVALID_PARAMS);
+
+    json_object_set_new(params, "limit", json_integer(100));
+    for (;;) {
+        mock_run_rpc(oper, "security_group.members", params);
+        CHECK_INTEQ(mock_rpc_error_code, 0);
+        if (mock_rpc_error_code)
+            break;
+        pages++;
+        seen += json_array_size(json_object_get(mock_rpc_result, "members"));
+        json_t *cursor = json_object_get(mock_rpc_result, "next_cursor");
+        if (!json_is_string(cursor))
+            break;
+        json_object_set_new(params, "cursor", json_string(json_string_value(cursor)));
+    }
+    CHECK_INTEQ(pages, 3);
+    CHECK_INTEQ(seen, 251);
+
+    json_object_set_new(params, "name", json_string("no-such-group"));
+    mock_run_rpc(oper, "security_group.members", params);
+    CHECK_INTEQ(mock_rpc_error_code, JSON_RPC_ERROR_NOT_FOUND);
+    json_decref(params);
+    teardown();
+}
+
+TEST(sg_user_from_index) {
+    const char *parv[] = { NULL, "oper", NULL };
+
+    setup(10);
+    mock_capture = 1;
+    mock_run_command(oper, "SG-user", 2, parv);
+    CHECK_INTEQ(mock_count_lines(oper, "- everyone,opers"), 1);
+    teardown();
+}
+
+TEST(rehash_rebuilds_index_and_keeps_stats) {
+    const char *parv[] = { NULL, "everyone", NULL };
+
+    setup(100);
+    mock_sendq_limit = 1 << 30;
+    mock_run_command(oper, "SG", 2, parv);
+    CHECK_INTEQ(modstats->sg.calls, 1);
+
+    // A group added in the new config is picked up on reload
+    mock_module_unload(1);
+    mock_security_group("late");
+    CHECK_INTEQ(mock_module_load(NULL), 0);
+    CHECK_INTEQ(sg_group_count, 5);
+    CHECK_INTEQ(modstats->sg.calls, 1);
+    check_index();
+    teardown();
+}
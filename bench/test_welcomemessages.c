@@ -0,0 +1,337 @@
+/*
+  Licence: GPLv3 or later
+  Copyright Ⓒ 2024 Jean Chevronnet
+
+*/
+#include "../welcomemessages/welcomemessages.c"
+#include "test.h"
+#include "alloccount.h"
+
+static char datadir[] = "/tmp/welcometest.XXXXXX";
+static char dbfile[256];
+
+__attribute__((constructor))
+static void make_datadir(void) {
+    if (!mkdtemp(datadir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    mock_datadir = datadir;
+    snprintf(dbfile, sizeof(dbfile), "%s/%s", datadir, WELCOMEDB_FILE);
+}
+
+__attribute__((destructor))
+static void remove_datadir(void) {
+    char corrupt[300];
+
+    snprintf(corrupt, sizeof(corrupt), "%s.corrupt", dbfile);
+    unlink(dbfile);
+    unlink(corrupt);
+    rmdir(datadir);
+}
+
+// channel-welcome { "#help" "..."; "#multi" { "line one"; "line two"; }; "#wild*" "..."; };
+// plus a channel-welcome-settings block when settings is not NULL
+static int load_welcome(const char *settings_name, const char *settings_value) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, "channel-welcome", NULL);
+    ConfigEntry *multi;
+    int ret;
+
+    mock_config_add(block, "#help", "Welcome to $channel, $nick!");
+    multi = mock_config_add(block, "#multi", NULL);
+    mock_config_add(multi, "line one", NULL);
+    mock_config_add(multi, "line two, $usercount here", NULL);
+    mock_config_add(block, "#wild*", "wild $account $$5");
+    if (settings_name)
+        mock_config_add(mock_config_add(root, "channel-welcome-settings", NULL), settings_name, settings_value);
+    ret = mock_module_load(root);
+    mock_config_free(root);
+    return ret;
+}
+
+static void join(Client *client, const char *name) {
+    Channel *channel = mock_channel(name);
+
+    mock_join(client, channel, NULL);
+    MOCK_RUN_HOOK(HOOKTYPE_LOCAL_JOIN, int (*)(Client *, Channel *, MessageTag *), client, channel, NULL);
+}
+
+TEST(config_welcomes) {
+    Client *alice = mock_local_user("alice", "alice", "10.0.0.1");
+
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    mock_capture = 1;
+    join(alice, "#help");
+    CHECK_INTEQ(mock_count_lines(alice, "NOTICE alice :Welcome to #help, alice!"), 1);
+    join(alice, "#multi");
+    CHECK_INTEQ(mock_count_lines(alice, "NOTICE alice :line one"), 1);
+    CHECK_INTEQ(mock_count_lines(alice, "NOTICE alice :line two, 1 here"), 1);
+    join(alice, "#WILDCARD");
+    CHECK_INTEQ(mock_count_lines(alice, "NOTICE alice :wild * $5"), 1);
+    mock_set_account(alice, "Alice");
+    join(alice, "#wildest");
+    CHECK_INTEQ(mock_count_lines(alice, "NOTICE alice :wild Alice $5"), 1);
+    join(alice, "#other");
+    CHECK_INTEQ(mock_count_lines(alice, NULL), 5);
+    CHECK_INTEQ(modstats->welcomes_sent, 5 - 1);
+    mock_module_unload(0);
+}
+
+TEST(config_change_reaches_cached_channels) {
+    Client *alice = mock_local_user("alice", "alice", "10.0.0.1");
+    ConfigEntry *root, *block;
+
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    join(alice, "#help");
+    mock_module_unload(1);
+
+    root = mock_config_add(NULL, "root", NULL);
+    block = mock_config_add(root, "channel-welcome", NULL);
+    mock_config_add(block, "#help", "Changed");
+    CHECK_INTEQ(mock_module_load(root), 0);
+    mock_config_free(root);
+
+    mock_capture = 1;
+    join(alice, "#help");
+    CHECK_INTEQ(mock_count_lines(alice, ":Changed"), 1);
+    mock_module_unload(0);
+}
+
+TEST(runtime_welcome_overrides_and_persists) {
+    Client *oper = mock_local_user("oper", "oper", "10.0.0.2");
+    Client *bob = mock_local_user("bob", "bob", "10.0.0.3");
+    const char *set[] = { NULL, "#help", "Runtime hello $nick", NULL };
+    const char *clear[] = { NULL, "#help", "-", NULL };
+
+    oper->umodes |= UMODE_OPER;
+    unlink(dbfile);
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    mock_capture = 1;
+    mock_run_command(oper, "WELCOME", 3, set);
+    join(bob, "#help");
+    CHECK_INTEQ(mock_count_lines(bob, ":Runtime hello bob"), 1);
+
+    // Written out on unload, read back on load
+    mock_module_unload(1);
+    CHECK(access(dbfile, F_OK) == 0);
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    CHECK_INTEQ(runtime_count, 1);
+    join(bob, "#help");
+    CHECK_INTEQ(mock_count_lines(bob, ":Runtime hello bob"), 2);
+
+    mock_run_command(oper, "WELCOME", 3, clear);
+    join(bob, "#help");
+    CHECK_INTEQ(mock_count_lines(bob, ":Welcome to #help, bob!"), 1);
+    mock_module_unload(0);
+    unlink(dbfile);
+}
+
+// Runtime welcomes stay on this server, so chanops can't set them
+TEST(runtime_welcome_is_oper_only) {
+    Client *op = mock_local_user("op", "op", "10.0.0.4");
+    Client *user = mock_local_user("user", "user", "10.0.0.5");
+    Channel *channel = mock_channel("#room");
+    const char *set[] = { NULL, "#room", "hi", NULL };
+    const char *show[] = { NULL, "#room", NULL };
+
+    mock_join(op, channel, "q");
+    mock_join(user, channel, NULL);
+    strlcpy(channel->mock_modes, "r", sizeof(channel->mock_modes));
+    unlink(dbfile);
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    mock_capture = 1;
+
+    mock_run_command(user, "WELCOME", 3, set);
+    CHECK_INTEQ(mock_count_lines(user, " 481 user "), 1);
+    mock_run_command(op, "WELCOME", 3, set);
+    mock_run_command(op, "WELCOME", 2, show);
+    CHECK_INTEQ(mock_count_lines(op, " 481 op "), 2);
+    CHECK_INTEQ(runtime_count, 0);
+
+    op->umodes |= UMODE_OPER;
+    mock_run_command(op, "WELCOME", 3, set);
+    CHECK_INTEQ(mock_count_lines(op, "Welcome for #room set."), 1);
+    CHECK_INTEQ(runtime_count, 1);
+    mock_module_unload(0);
+    unlink(dbfile);
+}
+
+TEST(corrupt_database_is_moved_aside) {
+    char corrupt[300];
+    FILE *f = fopen(dbfile, "wb");
+
+    CHECK(f != NULL);
+    fputs("not a welcome database", f);
+    fclose(f);
+    snprintf(corrupt, sizeof(corrupt), "%s.corrupt", dbfile);
+    unlink(corrupt);
+
+    CHECK_INTEQ(load_welcome(NULL, NULL), 0);
+    CHECK_INTEQ(runtime_count, 0);
+    CHECK(access(dbfile, F_OK) != 0);
+    CHECK(access(corrupt, F_OK) == 0);
+    mock_module_unload(0);
+    unlink(corrupt);
+}
+
+TEST(duplicate_suppression) {
+    Client *alice = mock_local_user("alice", "alice", "10.0.0.1");
+
+    CHECK_INTEQ(load_welcome("suppress-window", "5m"), 0);
+    mock_capture = 1;
+    join(alice, "#help");
+    join(alice, "#help");
+    CHECK_INTEQ(mock_count_lines(alice, ":Welcome to #help"), 1);
+    CHECK_INTEQ(modstats->welcomes_duplicate, 1);
+
+    timeofday += 301;
+    join(alice, "#help");
+    CHECK_INTEQ(mock_count_lines(alice, ":Welcome to #help"), 2);
+    mock_module_unload(0);
+}
+
+TEST(rate_limit) {
+    Client *alice = mock_local_user("alice", "alice", "10.0.0.1");
+    Client *bob = mock_local_user("bob", "bob", "10.0.0.2");
+
+    CHECK_INTEQ(load_welcome("max-per-second", "1"), 0);
+    mock_capture = 1;
+    timeofday++;
+    join(alice, "#help");
+    join(bob, "#help");
+    CHECK_INTEQ(mock_count_lines(NULL, ":Welcome to #help"), 1);
+    CHECK_INTEQ(modstats->welcomes_over_budget, 1);
+    timeofday++;
+    join(bob, "#help");
+    CHECK_INTEQ(mock_count_lines(bob, ":Welcome to #help"), 1);
+    mock_module_unload(0);
+}
+
+// What custom_join did before the matcher: the first entry, in config
+// order, that match_simple() accepts
+static int linear_lookup(const char *name) {
+    for (int i = 0; i < channel_count; i++) {
+        if (match_simple(CM_CHANNEL(i), name))
+            return i;
+    }
+    return -1;
+}
+
+// '#' and then 1 to 6 characters from a small alphabet, so random
+// patterns and names collide often
+static void random_name(char *buf) {
+    static const char alphabet[] = "abAB-1";
+    int len = 1 + mock_random() % 6;
+
+    *buf++ = '#';
+    while (len--)
+        *buf++ = alphabet[mock_random() % (sizeof(alphabet) - 1)];
+    *buf = '\0';
+}
+
+// A random name with some characters turned into *, ? or an escape, and
+// sometimes a leading * so the pattern has no prefix at all
+static void random_pattern(char *buf) {
+    char name[16], *out = buf;
+
+    random_name(name);
+    if (mock_random() % 8 == 0)
+        *out++ = '*';
+    for (const char *p = name; *p; p++) {
+        switch (mock_random() % 12) {
+            case 0:
+                *out++ = '*';
+                break;
+            case 1:
+                *out++ = '?';
+                break;
+            case 2:
+                *out++ = '\\';
+                *out++ = mock_random() % 2 ? '*' : *p;
+                break;
+            default:
+                *out++ = *p;
+                break;
+        }
+    }
+    *out = '\0';
+}
+
+TEST(matcher_agrees_with_linear_scan) {
+    ConfigEntry *root = mock_config_add(NULL, "root", NULL);
+    ConfigEntry *block = mock_config_add(root, "channel-welcome", NULL);
+    char buf[64];
+    int hits = 0, exact = 0, wild = 0;
+
+    mock_seed(33);
+    for (int i = 0; i < 2000; i++) {
+        random_pattern(buf);
+        mock_config_add(block, buf, "hello");
+        if (strpbrk(buf, "*?\\"))
+            wild++;
+        else
+            exact++;
+    }
+    CHECK_INTEQ(mock_module_load(root), 0);
+    mock_config_free(root);
+    CHECK_INTEQ(channel_count, 2000);
+    CHECK(exact > 100 && wild > 100);
+
+    for (int i = 0; i < 50000; i++) {
+        int expected;
+
+        random_name(buf);
+        if (mock_random() % 4 == 0)
+            strlcat(buf, "*", sizeof(buf));
+        expected = linear_lookup(buf);
+        CHECK_INTEQ(matcher_lookup(buf), expected);
+        if (matcher_lookup(buf) != expected) {
+            fprintf(stderr, "  for %s\n", buf);
+            break;
+        }
+        hits += expected >= 0;
+    }
+    // Most names match something
+    CHECK(hits > 25000);
+    mock_module_unload(0);
+}
+
+TEST(template_parse_segments) {
+    Segment segs[16];
+    int count = template_parse("Hi $nick$channel, $$5 $unknown $topic", segs);
+
+    CHECK_INTEQ(count, 6);
+    CHECK_INTEQ(segs[0].type, SEG_LITERAL);
+    CHECK(segs[0].len == 3 && !strncmp(segs[0].text, "Hi ", 3));
+    CHECK_INTEQ(segs[1].type, SEG_NICK);
+    CHECK_INTEQ(segs[2].type, SEG_CHANNEL);
+    CHECK_INTEQ(segs[3].type, SEG_LITERAL);
+    CHECK(segs[3].len == 3 && !strncmp(segs[3].text, ", $", 3));
+    CHECK_INTEQ(segs[4].type, SEG_LITERAL);
+    CHECK(segs[4].len == 11 && !strncmp(segs[4].text, "5 $unknown ", 11));
+    CHECK_INTEQ(segs[5].type, SEG_TOPIC);
+    CHECK_INTEQ(template_parse("", NULL), 0);
+}
+
+TEST(template_send_does_not_allocate) {
+    Client *alice = mock_local_user("alice", "alice", "10.0.0.1");
+    Channel *channel = mock_channel("#help");
+    const char *text = "Hi $nick, $channel has $usercount users, topic: $topic, account: $account";
+    Segment segs[16];
+    WelcomeTemplate line = { segs, template_parse(text, segs) };
+    unsigned long long before;
+
+    mock_join(alice, channel, NULL);
+    safe_strdup(channel->topic, "Read the FAQ");
+    mock_set_account(alice, "Alice");
+
+    before = alloc_calls;
+    for (int i = 0; i < 100; i++)
+        template_send(alice, channel, &line, 1);
+    CHECK_INTEQ(alloc_calls - before, 0);
+
+    mock_capture = 1;
+    template_send(alice, channel, &line, 1);
+    CHECK_INTEQ(mock_count_lines(alice, ":Hi alice, #help has 1 users, topic: Read the FAQ, account: Alice"), 1);
+}
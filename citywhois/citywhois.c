@@ -1,6 +1,7 @@
 #include "unrealircd.h"
 #include <maxminddb.h>
 #include <arpa/inet.h>
+#include <jansson.h>
 
 #define MYCONF "citywhois"
 
@@ -21,11 +22,90 @@ ModuleHeader MOD_HEADER = {
     "unrealircd-6",                   // UnrealIRCd version
 };
 
+// Cost of the WHOIS hook and of the MaxMind lookup inside it, as call
+// counts and log2 histograms of nanoseconds. Shown in /STATS modstats and
+// the modstats.citywhois RPC call.
+#define MODSTAT_BUCKETS 40
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long hist[MODSTAT_BUCKETS]; // bucket b: calls that took [2^b, 2^(b+1)) ns
+} ModStat;
+
+static inline uint64_t modstat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void modstat_record(ModStat *m, uint64_t start) {
+    uint64_t ns = modstat_now() - start;
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (b >= MODSTAT_BUCKETS)
+        b = MODSTAT_BUCKETS - 1;
+    m->calls++;
+    m->total_ns += ns;
+    m->hist[b]++;
+}
+
+// Upper bound of the bucket that holds the given percentile
+static uint64_t modstat_percentile(const ModStat *m, int pct) {
+    unsigned long long want = (m->calls * pct + 99) / 100, seen = 0;
+
+    for (int b = 0; b < MODSTAT_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen && seen >= want)
+            return 2ULL << b;
+    }
+    return 0;
+}
+
+static void modstat_report(Client *client, const char *name, const ModStat *m) {
+    sendtxtnumeric(client, "%s %s: calls=%llu avg=%lluns p50<%lluns p99<%lluns",
+                   MOD_HEADER.name, name, m->calls,
+                   m->calls ? m->total_ns / m->calls : 0ULL,
+                   (unsigned long long)modstat_percentile(m, 50),
+                   (unsigned long long)modstat_percentile(m, 99));
+}
+
+static json_t *modstat_json(const ModStat *m) {
+    json_t *j = json_object();
+    json_t *hist = json_array();
+
+    json_object_set_new(j, "calls", json_integer(m->calls));
+    json_object_set_new(j, "total_ns", json_integer(m->total_ns));
+    json_object_set_new(j, "p50_ns", json_integer(modstat_percentile(m, 50)));
+    json_object_set_new(j, "p99_ns", json_integer(modstat_percentile(m, 99)));
+    for (int b = 0; b < MODSTAT_BUCKETS; b++)
+        json_array_append_new(hist, json_integer(m->hist[b]));
+    json_object_set_new(j, "histogram_log2_ns", hist);
+    return j;
+}
+
+// Survives module reloads (rehash); dropped if the layout changed.
+typedef struct {
+    size_t size;
+    time_t since;
+    ModStat whois;
+    ModStat mmdb_lookup;
+} ModStats;
+
+static ModStats *modstats = NULL;
+
+static void modstats_free(ModData *m) {
+    safe_free(m->ptr);
+}
+
 // Function prototypes
 int citywhois_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int citywhois_configposttest(int *errs);
 int citywhois_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
 int citywhois_whois(Client *requester, Client *acptr, NameValuePrioList **list);
+static int citywhois_whois_lookup(Client *requester, Client *acptr, NameValuePrioList **list);
+int citywhois_stats(Client *client, const char *flag);
+RPC_CALL_FUNC(rpc_modstats_citywhois);
 
 // Module initialization functions
 MOD_TEST() {
@@ -36,9 +116,30 @@ MOD_TEST() {
 }
 
 MOD_INIT() {
+    RPCHandlerInfo r;
+
     MARK_AS_GLOBAL_MODULE(modinfo);
     HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, citywhois_configrun);
     HookAdd(modinfo->handle, HOOKTYPE_WHOIS, 0, citywhois_whois);
+    HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, citywhois_stats);
+
+    memset(&r, 0, sizeof(r));
+    r.method = "modstats.citywhois";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_modstats_citywhois;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("CityWhois: Could not register RPC handler");
+        return MOD_FAILED;
+    }
+
+    LoadPersistentPointer(modinfo, modstats, modstats_free);
+    if (modstats && modstats->size != sizeof(ModStats))
+        safe_free(modstats);
+    if (!modstats) {
+        modstats = safe_alloc(sizeof(ModStats));
+        modstats->size = sizeof(ModStats);
+        modstats->since = TStime();
+    }
     return MOD_SUCCESS;
 }
 
@@ -56,6 +157,7 @@ MOD_LOAD() {
 }
 
 MOD_UNLOAD() {
+    SavePersistentPointer(modinfo, modstats);
     if (citywhois_config.db_loaded) {
         MMDB_close(&citywhois_config.mmdb);
         citywhois_config.db_loaded = 0;
@@ -144,6 +246,13 @@ int citywhois_whois(Client *requester, Client *acptr, NameValuePrioList **list)
     if (!IsOper(requester))
         return 0;
 
+    uint64_t started = modstat_now();
+    int ret = citywhois_whois_lookup(requester, acptr, list);
+    modstat_record(&modstats->whois, started);
+    return ret;
+}
+
+static int citywhois_whois_lookup(Client *requester, Client *acptr, NameValuePrioList **list) {
     // Ensure the target is a user
     if (!IsUser(acptr))
         return 0;
@@ -158,7 +267,9 @@ int citywhois_whois(Client *requester, Client *acptr, NameValuePrioList **list)
 
         // Perform the lookup
         int gai_error = 0, mmdb_error = MMDB_SUCCESS;
+        uint64_t lookup_started = modstat_now();
         MMDB_lookup_result_s result = MMDB_lookup_string(&citywhois_config.mmdb, acptr->ip, &gai_error, &mmdb_error);
+        modstat_record(&modstats->mmdb_lookup, lookup_started);
 
         if (gai_error != 0) {
             unreal_log(ULOG_ERROR, "citywhois", "module", NULL, "CityWhois: getaddrinfo error for %s - %s", acptr->ip, gai_strerror(gai_error));
@@ -199,3 +310,27 @@ int citywhois_whois(Client *requester, Client *acptr, NameValuePrioList **list)
 
     return 0;
 }
+
+// /STATS modstats
+int citywhois_stats(Client *client, const char *flag) {
+    if (strcasecmp(flag, "modstats") || !IsOper(client))
+        return 0;
+
+    modstat_report(client, "whois", &modstats->whois);
+    modstat_report(client, "mmdb_lookup", &modstats->mmdb_lookup);
+    return 0;
+}
+
+RPC_CALL_FUNC(rpc_modstats_citywhois) {
+    json_t *result = json_object();
+    json_t *stats = json_object();
+
+    json_object_set_new(result, "module", json_string_unreal(MOD_HEADER.name));
+    json_object_set_new(result, "since", json_integer(modstats->since));
+    json_object_set_new(stats, "whois", modstat_json(&modstats->whois));
+    json_object_set_new(stats, "mmdb_lookup", modstat_json(&modstats->mmdb_lookup));
+    json_object_set_new(result, "stats", stats);
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
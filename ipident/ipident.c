@@ -21,16 +21,24 @@ module
 */
 
 #include "unrealircd.h"
-#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <arpa/inet.h>
+#include <jansson.h>
 
 // Config block
 #define MYCONF "cloak-ident-keys"
 #define MAX_CLOAK_KEYS 5
 
+// Default prefix lengths the address is masked to before hashing
+#define DEFAULT_IPV4_PREFIX 32
+#define DEFAULT_IPV6_PREFIX 64
+
 // Configuration structure to hold the cloak keys
 typedef struct {
     char *keys[MAX_CLOAK_KEYS];
     int key_count;
+    int ipv4_prefix;
+    int ipv6_prefix;
 } CloakConfig;
 
 CloakConfig cloak_config;
@@ -41,16 +49,93 @@ void freecfg(void);
 int m_ipident_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int m_ipident_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
 int set_crypto_ip_based_ident(Client *client);
+int ipident_stats(Client *client, const char *flag);
+RPC_CALL_FUNC(rpc_modstats_ipident);
 
 // Dat dere module header
 ModuleHeader MOD_HEADER = {
     "third/ipident", // Module name
-    "1.0.1", // Version
+    "1.1.0", // Version
     "Generate ident based on ipv4 and ipv6 + user-defined config cloak-ident-keys", // Description
     "reverse", // Author
     "unrealircd-6", // Modversion
 };
 
+// Timing of ident generation on connect, log2 histogram of nanoseconds.
+// Shown in /STATS modstats and the modstats.ipident RPC call.
+#define MODSTAT_BUCKETS 40
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long hist[MODSTAT_BUCKETS]; // bucket b: calls that took [2^b, 2^(b+1)) ns
+} ModStat;
+
+static inline uint64_t modstat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void modstat_record(ModStat *m, uint64_t start) {
+    uint64_t ns = modstat_now() - start;
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (b >= MODSTAT_BUCKETS)
+        b = MODSTAT_BUCKETS - 1;
+    m->calls++;
+    m->total_ns += ns;
+    m->hist[b]++;
+}
+
+// Upper bound of the bucket that holds the given percentile
+static uint64_t modstat_percentile(const ModStat *m, int pct) {
+    unsigned long long want = (m->calls * pct + 99) / 100, seen = 0;
+
+    for (int b = 0; b < MODSTAT_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen && seen >= want)
+            return 2ULL << b;
+    }
+    return 0;
+}
+
+static void modstat_report(Client *client, const char *name, const ModStat *m) {
+    sendtxtnumeric(client, "%s %s: calls=%llu avg=%lluns p50<%lluns p99<%lluns",
+                   MOD_HEADER.name, name, m->calls,
+                   m->calls ? m->total_ns / m->calls : 0ULL,
+                   (unsigned long long)modstat_percentile(m, 50),
+                   (unsigned long long)modstat_percentile(m, 99));
+}
+
+static json_t *modstat_json(const ModStat *m) {
+    json_t *j = json_object();
+    json_t *hist = json_array();
+
+    json_object_set_new(j, "calls", json_integer(m->calls));
+    json_object_set_new(j, "total_ns", json_integer(m->total_ns));
+    json_object_set_new(j, "p50_ns", json_integer(modstat_percentile(m, 50)));
+    json_object_set_new(j, "p99_ns", json_integer(modstat_percentile(m, 99)));
+    for (int b = 0; b < MODSTAT_BUCKETS; b++)
+        json_array_append_new(hist, json_integer(m->hist[b]));
+    json_object_set_new(j, "histogram_log2_ns", hist);
+    return j;
+}
+
+// Saved and restored over a rehash so the histogram keeps growing.
+// A different size means an upgraded module, we start from zero then.
+typedef struct {
+    size_t size;
+    time_t since;
+    ModStat ident;
+} ModStats;
+
+static ModStats *modstats = NULL;
+
+static void modstats_free(ModData *m) {
+    safe_free(m->ptr);
+}
+
 // Configuration testing-related hooks go in the testing phase
 MOD_TEST() {
     memset(&cloak_config, 0, sizeof(cloak_config)); // Zero-initialise config
@@ -62,11 +147,32 @@ MOD_TEST() {
 
 // Initialisation routine (register hooks, commands and modes or create structs etc)
 MOD_INIT() {
+    RPCHandlerInfo r;
+
     MARK_AS_GLOBAL_MODULE(modinfo);
 
     setcfg();
     HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, m_ipident_configrun);
     HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CONNECT, 0, set_crypto_ip_based_ident);
+    HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, ipident_stats);
+
+    memset(&r, 0, sizeof(r));
+    r.method = "modstats.ipident";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_modstats_ipident;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("[ipident] Could not register RPC handler");
+        return MOD_FAILED;
+    }
+
+    LoadPersistentPointer(modinfo, modstats, modstats_free);
+    if (modstats && modstats->size != sizeof(ModStats))
+        safe_free(modstats);
+    if (!modstats) {
+        modstats = safe_alloc(sizeof(ModStats));
+        modstats->size = sizeof(ModStats);
+        modstats->since = TStime();
+    }
     return MOD_SUCCESS;
 }
 
@@ -76,6 +182,7 @@ MOD_LOAD() {
 
 // Called on unload/rehash
 MOD_UNLOAD() {
+    SavePersistentPointer(modinfo, modstats);
     freecfg();
     return MOD_SUCCESS; // We good
 }
@@ -83,6 +190,8 @@ MOD_UNLOAD() {
 // Set config defaults
 void setcfg(void) {
     memset(&cloak_config, 0, sizeof(cloak_config));
+    cloak_config.ipv4_prefix = DEFAULT_IPV4_PREFIX;
+    cloak_config.ipv6_prefix = DEFAULT_IPV6_PREFIX;
 }
 
 // Free allocated memory on unload/reload
@@ -114,6 +223,16 @@ int m_ipident_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs) {
             continue;
         }
 
+        if (!strcmp(cep->name, "ipv4-prefix") || !strcmp(cep->name, "ipv6-prefix")) {
+            int max = !strcmp(cep->name, "ipv4-prefix") ? 32 : 128;
+            int v = atoi(cep->value);
+            if (v < 1 || v > max) {
+                config_error("%s:%i: %s::%s must be between 1 and %d", cep->file->filename, cep->line_number, MYCONF, cep->name, max);
+                errors++;
+            }
+            continue;
+        }
+
         if (cloak_config.key_count >= MAX_CLOAK_KEYS) {
             config_error("%s:%i: too many keys specified in %s", cep->file->filename, cep->line_number, MYCONF);
             errors++;
@@ -144,6 +263,14 @@ int m_ipident_configrun(ConfigFile *cf, ConfigEntry *ce, int type) {
     freecfg();
 
     for (cep = ce->items; cep; cep = cep->next) {
+        if (!strcmp(cep->name, "ipv4-prefix")) {
+            cloak_config.ipv4_prefix = atoi(cep->value);
+            continue;
+        }
+        if (!strcmp(cep->name, "ipv6-prefix")) {
+            cloak_config.ipv6_prefix = atoi(cep->value);
+            continue;
+        }
         if (cloak_config.key_count < MAX_CLOAK_KEYS) {
             cloak_config.keys[cloak_config.key_count++] = strdup(cep->value);
             if (!cloak_config.keys[cloak_config.key_count - 1]) {
@@ -157,9 +284,31 @@ int m_ipident_configrun(ConfigFile *cf, ConfigEntry *ce, int type) {
     return 1; // We good
 }
 
-// Function to determine if the IP address is IPv6
-static int is_ipv6_address(const char *ip) {
-    return strchr(ip, ':') != NULL;
+// Parse the client IP into its binary form and clear every bit past the
+// configured prefix. Returns the number of address bytes written, 0 on failure.
+static int get_masked_address(const char *ip, unsigned char *out, int *prefix) {
+    int len, bits;
+
+    if (inet_pton(AF_INET6, ip, out) == 1) {
+        len = 16;
+        bits = cloak_config.ipv6_prefix;
+    } else if (inet_pton(AF_INET, ip, out) == 1) {
+        len = 4;
+        bits = cloak_config.ipv4_prefix;
+    } else {
+        return 0;
+    }
+
+    for (int i = 0; i < len; i++) {
+        if (bits >= 8) {
+            bits -= 8;
+        } else {
+            out[i] &= (unsigned char)(0xff << (8 - bits));
+            bits = 0;
+        }
+    }
+    *prefix = (len == 16) ? cloak_config.ipv6_prefix : cloak_config.ipv4_prefix;
+    return len;
 }
 
 int set_crypto_ip_based_ident(Client *client) {
@@ -172,26 +321,72 @@ int set_crypto_ip_based_ident(Client *client) {
         return HOOK_CONTINUE;
     }
 
-    unsigned char hash[SHA256_DIGEST_LENGTH];
+    uint64_t started = modstat_now();
+    unsigned char addr[16];
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned char tag[2];
+    unsigned int hash_len = 0;
+    int prefix = 0;
     char ident[10];
 
-    
-    SHA256((unsigned char*)client->ip, strlen(client->ip), hash);
+    int addr_len = get_masked_address(client->ip, addr, &prefix);
+    if (!addr_len) {
+        modstat_record(&modstats->ident, started);
+        return HOOK_CONTINUE;
+    }
 
-    // Select a cloak key
-    const char *cloak_key = cloak_config.keys[rand() % cloak_config.key_count];
-    char combined_hash[SHA256_DIGEST_LENGTH + 64 + 1];
-    snprintf(combined_hash, sizeof(combined_hash), "%s%s", client->ip, cloak_key);
+    // Hash the keys together with the masked address so that everyone behind
+    // the same prefix ends up with the same ident. The family and prefix length
+    // are mixed in so a v4 /24 and a v6 /64 can never produce the same input.
+    tag[0] = (unsigned char)addr_len;
+    tag[1] = (unsigned char)prefix;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        modstat_record(&modstats->ident, started);
+        return HOOK_CONTINUE;
+    }
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    for (int i = 0; i < cloak_config.key_count; i++) {
+        EVP_DigestUpdate(ctx, cloak_config.keys[i], strlen(cloak_config.keys[i]));
+    }
+    EVP_DigestUpdate(ctx, tag, sizeof(tag));
+    EVP_DigestUpdate(ctx, addr, addr_len);
+    EVP_DigestFinal_ex(ctx, hash, &hash_len);
+    EVP_MD_CTX_free(ctx);
 
     for (int i = 0; i < 9; ++i) {
-        unsigned char byte = combined_hash[i % (SHA256_DIGEST_LENGTH + 64)];
+        unsigned char byte = hash[i];
         if (i < 6) {
-            ident[i] = (byte % 2 == 0) ? 'a' + (byte % 26) : 'A' + (byte % 26);
+            ident[i] = (byte & 0x80) ? 'a' + (byte % 26) : 'A' + (byte % 26);
         } else {
             ident[i] = '0' + (byte % 10);
         }
     }
     ident[9] = '\0';
     strlcpy(client->user->username, ident, sizeof(client->user->username));
+    modstat_record(&modstats->ident, started);
     return HOOK_CONTINUE;
 }
+
+// /STATS modstats
+int ipident_stats(Client *client, const char *flag) {
+    if (strcasecmp(flag, "modstats") || !IsOper(client))
+        return 0;
+
+    modstat_report(client, "ident", &modstats->ident);
+    return 0;
+}
+
+RPC_CALL_FUNC(rpc_modstats_ipident) {
+    json_t *result = json_object();
+    json_t *stats = json_object();
+
+    json_object_set_new(result, "module", json_string_unreal(MOD_HEADER.name));
+    json_object_set_new(result, "since", json_integer(modstats->since));
+    json_object_set_new(stats, "ident", modstat_json(&modstats->ident));
+    json_object_set_new(result, "stats", stats);
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
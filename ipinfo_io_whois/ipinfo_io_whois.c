@@ -25,13 +25,14 @@ module
 #include <uthash.h>
 
 #define MYCONF "ipinfo_io_whois"
-#define API_URL "https://ipinfo.io/"
+#define DEFAULT_API_URL "https://ipinfo.io/"
 
 typedef struct {
     char *apikey;
+    char *api_url; // always ends with a slash, the IP is appended to it
 } cfgstruct;
 
-static cfgstruct muhcfg = {NULL};  // Ensure apikey is initialized to NULL
+static cfgstruct muhcfg = {NULL, NULL};  // Ensure apikey is initialized to NULL
 
 typedef struct {
     char ip[46]; // Supports both IPv4 and IPv6
@@ -46,12 +47,100 @@ static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 ModuleHeader MOD_HEADER = {
     "third/ipinfo_io_whois",
-    "1.0.0",
+    "1.1.0",
     "Show IPinfo.io information in WHOIS",
     "reverse",
     "unrealircd-6",
 };
 
+// Timing of the WHOIS hook and of the ipinfo.io round trip, plus cache
+// counters. Shown in /STATS modstats and the modstats.ipinfo_io_whois RPC call.
+#define MODSTAT_BUCKETS 40
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long hist[MODSTAT_BUCKETS]; // bucket b: calls that took [2^b, 2^(b+1)) ns
+} ModStat;
+
+static inline uint64_t modstat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void modstat_record(ModStat *m, uint64_t start) {
+    uint64_t ns = modstat_now() - start;
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (b >= MODSTAT_BUCKETS)
+        b = MODSTAT_BUCKETS - 1;
+    m->calls++;
+    m->total_ns += ns;
+    m->hist[b]++;
+}
+
+// Upper bound of the bucket that holds the given percentile
+static uint64_t modstat_percentile(const ModStat *m, int pct) {
+    unsigned long long want = (m->calls * pct + 99) / 100, seen = 0;
+
+    for (int b = 0; b < MODSTAT_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen && seen >= want)
+            return 2ULL << b;
+    }
+    return 0;
+}
+
+static void modstat_report(Client *client, const char *name, const ModStat *m) {
+    sendtxtnumeric(client, "%s %s: calls=%llu avg=%lluns p50<%lluns p99<%lluns",
+                   MOD_HEADER.name, name, m->calls,
+                   m->calls ? m->total_ns / m->calls : 0ULL,
+                   (unsigned long long)modstat_percentile(m, 50),
+                   (unsigned long long)modstat_percentile(m, 99));
+}
+
+static json_t *modstat_json(const ModStat *m) {
+    json_t *j = json_object();
+    json_t *hist = json_array();
+
+    json_object_set_new(j, "calls", json_integer(m->calls));
+    json_object_set_new(j, "total_ns", json_integer(m->total_ns));
+    json_object_set_new(j, "p50_ns", json_integer(modstat_percentile(m, 50)));
+    json_object_set_new(j, "p99_ns", json_integer(modstat_percentile(m, 99)));
+    for (int b = 0; b < MODSTAT_BUCKETS; b++)
+        json_array_append_new(hist, json_integer(m->hist[b]));
+    json_object_set_new(j, "histogram_log2_ns", hist);
+    return j;
+}
+
+// Handed over to the next instance on rehash, like the cache is.
+// size tells us whether it still has the layout we expect.
+typedef struct {
+    size_t size;
+    time_t since;
+    ModStat whois;
+    ModStat http;
+    unsigned long long cache_hits;
+    unsigned long long cache_misses;
+    unsigned long long api_errors;
+} ModStats;
+
+static ModStats *modstats = NULL;
+
+static void modstats_free(ModData *m) {
+    safe_free(m->ptr);
+}
+
+// What we need to remember about a lookup until the response comes in.
+// Clients are looked up again by ID, they may be gone by then.
+typedef struct {
+    char requester[IDLEN + 1];
+    char target[IDLEN + 1];
+    char ip[46];
+    uint64_t started;
+} IpinfoRequest;
+
 int ipinfo_io_whois_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int ipinfo_io_whois_configposttest(int *errs);
 int ipinfo_io_whois_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
@@ -59,6 +148,8 @@ int ipinfo_io_whois_whois(Client *requester, Client *acptr, NameValuePrioList **
 void free_cache();
 void save_cache(ModuleInfo *modinfo);
 void ipinfo_io_whois_callback(OutgoingWebRequest *request, OutgoingWebResponse *response);
+int ipinfo_io_whois_stats(Client *client, const char *flag);
+RPC_CALL_FUNC(rpc_modstats_ipinfo_io_whois);
 
 MOD_TEST() {
     memset(&muhcfg, 0, sizeof(muhcfg));
@@ -68,6 +159,8 @@ MOD_TEST() {
 }
 
 MOD_INIT() {
+    RPCHandlerInfo r;
+
     MARK_AS_GLOBAL_MODULE(modinfo);
 
     // Ensures the module is not unloaded or reloaded to prevent crashes during async operations
@@ -75,6 +168,24 @@ MOD_INIT() {
 
     HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, ipinfo_io_whois_configrun);
     HookAdd(modinfo->handle, HOOKTYPE_WHOIS, 0, ipinfo_io_whois_whois);
+    HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, ipinfo_io_whois_stats);
+
+    memset(&r, 0, sizeof(r));
+    r.method = "modstats.ipinfo_io_whois";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_modstats_ipinfo_io_whois;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("[ipinfo_io_whois] Could not register RPC handler");
+        return MOD_FAILED;
+    }
+    LoadPersistentPointer(modinfo, modstats, modstats_free);
+    if (modstats && modstats->size != sizeof(ModStats))
+        safe_free(modstats);
+    if (!modstats) {
+        modstats = safe_alloc(sizeof(ModStats));
+        modstats->size = sizeof(ModStats);
+        modstats->since = TStime();
+    }
 
     // Register the web response callback
     RegisterApiCallbackWebResponse(modinfo->handle, "ipinfo_io_whois_callback", ipinfo_io_whois_callback);
@@ -85,11 +196,15 @@ MOD_INIT() {
 }
 
 MOD_LOAD() {
+    if (!muhcfg.api_url)
+        safe_strdup(muhcfg.api_url, DEFAULT_API_URL);
     return MOD_SUCCESS;
 }
 
 MOD_UNLOAD() {
+    SavePersistentPointer(modinfo, modstats);
     safe_free(muhcfg.apikey);
+    safe_free(muhcfg.api_url);
 
     // Save the cache before unloading the module
     save_cache(modinfo);
@@ -130,6 +245,14 @@ int ipinfo_io_whois_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *e
             safe_strdup(muhcfg.apikey, cep->value);
             continue;
         }
+
+        if (!strcmp(cep->name, "api-url")) {
+            if (!cep->value || (strncmp(cep->value, "https://", 8) && strncmp(cep->value, "http://", 7))) {
+                config_error("%s:%i: %s::%s must be an http:// or https:// URL", cep->file->filename, cep->line_number, MYCONF, cep->name);
+                errors++;
+            }
+            continue;
+        }
     }
 
     *errs = errors;
@@ -175,6 +298,16 @@ int ipinfo_io_whois_configrun(ConfigFile *cf, ConfigEntry *ce, int type) {
             safe_strdup(muhcfg.apikey, cep->value);
             continue;
         }
+
+        if (!strcmp(cep->name, "api-url")) {
+            size_t len = strlen(cep->value);
+            safe_free(muhcfg.api_url);
+            muhcfg.api_url = safe_alloc(len + 2);
+            strlcpy(muhcfg.api_url, cep->value, len + 2);
+            if (len && cep->value[len - 1] != '/')
+                strlcat(muhcfg.api_url, "/", len + 2);
+            continue;
+        }
     }
     return 1;
 }
@@ -218,12 +351,19 @@ void save_cache(ModuleInfo *modinfo) {
 }
 
 void ipinfo_io_whois_callback(OutgoingWebRequest *request, OutgoingWebResponse *response) {
-    Client *acptr = (Client *)request->callback_data;
+    IpinfoRequest *req = (IpinfoRequest *)request->callback_data;
+    if (!req)
+        return;
+
+    modstat_record(&modstats->http, req->started);
+
     if (response->errorbuf || !response->memory) {
+        modstats->api_errors++;
         unreal_log(ULOG_INFO, "ipinfo_io_whois", "IPINFO_IO_WHOIS_BAD_RESPONSE", NULL,
                    "Error while trying to get IP info for $ip: $error",
-                   log_data_string("ip", acptr->ip),
+                   log_data_string("ip", req->ip),
                    log_data_string("error", response->errorbuf ? response->errorbuf : "No data (body) returned"));
+        safe_free(req);
         return;
     }
 
@@ -247,17 +387,23 @@ void ipinfo_io_whois_callback(OutgoingWebRequest *request, OutgoingWebResponse *
                      json_string_value(country),
                      json_string_value(org));
 
-            add_to_cache(acptr->ip, result_info);
+            add_to_cache(req->ip, result_info);
 
-            // Add the information to the WHOIS response
-            Client *requester = (Client *)request->callback_data;
-            NameValuePrioList *nvplist = NULL;
-            add_nvplist_numeric_fmt(&nvplist, 320, "city", acptr, 320, "%s :is connecting from %s", acptr->name, result_info);
-            sendto_one(requester, NULL, ":%s 320 %s %s :is connecting from %s", me.name, requester->name, acptr->name, result_info);
+            // The WHOIS reply is long gone, send the answer on its own
+            Client *requester = hash_find_id(req->requester, NULL);
+            Client *acptr = hash_find_id(req->target, NULL);
+            if (requester && acptr)
+                sendto_one(requester, NULL, ":%s 320 %s %s :is connecting from %s", me.name, requester->name, acptr->name, result_info);
+        } else {
+            // Valid JSON but not a lookup result, like the error body of a 403/429
+            modstats->api_errors++;
         }
 
         json_decref(root);
+    } else {
+        modstats->api_errors++;
     }
+    safe_free(req);
 }
 
 int ipinfo_io_whois_whois(Client *requester, Client *acptr, NameValuePrioList **list) {
@@ -265,23 +411,67 @@ int ipinfo_io_whois_whois(Client *requester, Client *acptr, NameValuePrioList **
         return 0; // Only opers can see the IP info, and ignore service clients and servers
     }
 
+    uint64_t started = modstat_now();
     CacheEntry *cached = find_in_cache(acptr->ip);
     if (cached) {
+        modstats->cache_hits++;
         add_nvplist_numeric_fmt(list, 320, "city", acptr, 320, "%s :is connecting from %s", acptr->name, cached->info);
+        modstat_record(&modstats->whois, started);
         return 0;
     }
+    modstats->cache_misses++;
 
     // Use UnrealIRCd's URL API
-    char url[256];
-    snprintf(url, sizeof(url), API_URL "%s?token=%s", acptr->ip, muhcfg.apikey);
+    char url[512];
+    snprintf(url, sizeof(url), "%s%s?token=%s", muhcfg.api_url, acptr->ip, muhcfg.apikey);
 
     OutgoingWebRequest *w = safe_alloc(sizeof(OutgoingWebRequest));
     safe_strdup(w->url, url);
     w->http_method = HTTP_METHOD_GET;
     safe_strdup(w->apicallback, "ipinfo_io_whois_callback");
-    w->callback_data = acptr;
+    IpinfoRequest *req = safe_alloc(sizeof(IpinfoRequest));
+    strlcpy(req->requester, requester->id, sizeof(req->requester));
+    strlcpy(req->target, acptr->id, sizeof(req->target));
+    strlcpy(req->ip, acptr->ip, sizeof(req->ip));
+    req->started = modstat_now();
+    w->callback_data = req;
 
     url_start_async(w);
 
+    modstat_record(&modstats->whois, started);
     return 0; // we g00d
 }
+
+// /STATS modstats
+int ipinfo_io_whois_stats(Client *client, const char *flag) {
+    unsigned long long lookups = modstats->cache_hits + modstats->cache_misses;
+
+    if (strcasecmp(flag, "modstats") || !IsOper(client))
+        return 0;
+
+    modstat_report(client, "whois", &modstats->whois);
+    modstat_report(client, "http", &modstats->http);
+    sendtxtnumeric(client, "%s cache: hits=%llu misses=%llu hit-ratio=%llu%% api-errors=%llu",
+                   MOD_HEADER.name, modstats->cache_hits, modstats->cache_misses,
+                   lookups ? modstats->cache_hits * 100 / lookups : 0ULL, modstats->api_errors);
+    return 0;
+}
+
+RPC_CALL_FUNC(rpc_modstats_ipinfo_io_whois) {
+    json_t *result = json_object();
+    json_t *stats = json_object();
+    json_t *counters = json_object();
+
+    json_object_set_new(result, "module", json_string_unreal(MOD_HEADER.name));
+    json_object_set_new(result, "since", json_integer(modstats->since));
+    json_object_set_new(stats, "whois", modstat_json(&modstats->whois));
+    json_object_set_new(stats, "http", modstat_json(&modstats->http));
+    json_object_set_new(result, "stats", stats);
+    json_object_set_new(counters, "cache_hits", json_integer(modstats->cache_hits));
+    json_object_set_new(counters, "cache_misses", json_integer(modstats->cache_misses));
+    json_object_set_new(counters, "api_errors", json_integer(modstats->api_errors));
+    json_object_set_new(result, "counters", counters);
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
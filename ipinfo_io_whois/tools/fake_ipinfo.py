@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the ipinfo.io API, for load testing ipinfo_io_whois
+without spending real API calls.
+
+Point the module at it with:
+
+    ipinfo_io_whois {
+        apikey "test";
+        api-url "http://127.0.0.1:8088/";
+    };
+
+GET /<ip>?token=... answers with canned JSON (the same IP always gets the
+same city/org). Latency, errors and rate limiting can be tuned, see --help.
+GET /_stats returns request counters as JSON, GET /_reset clears them.
+
+Only uses the Python standard library.
+"""
+
+import argparse
+import hashlib
+import json
+import random
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlsplit, parse_qs
+
+CITIES = [
+    ("Lyon", "Auvergne-Rhône-Alpes", "FR"),
+    ("Paris", "Île-de-France", "FR"),
+    ("Berlin", "Berlin", "DE"),
+    ("Amsterdam", "North Holland", "NL"),
+    ("London", "England", "GB"),
+    ("New York City", "New York", "US"),
+    ("São Paulo", "São Paulo", "BR"),
+    ("Tokyo", "Tokyo", "JP"),
+]
+
+ORGS = [
+    "AS1554 Societe Francaise Du Radiotelephone - SFR SA",
+    "AS3215 Orange S.A.",
+    "AS3320 Deutsche Telekom AG",
+    "AS7922 Comcast Cable Communications, LLC",
+    "AS16509 Amazon.com, Inc.",
+]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        with self.lock:
+            self.requests = 0
+            self.ok = 0
+            self.errors = 0
+            self.rate_limited = 0
+            self.bad_token = 0
+            self.per_ip = {}
+            self.in_flight = 0
+            self.max_in_flight = 0
+            self.window_start = time.monotonic()
+            self.window_count = 0
+
+    def as_dict(self):
+        with self.lock:
+            dup = sum(n - 1 for n in self.per_ip.values() if n > 1)
+            return {
+                "requests": self.requests,
+                "ok": self.ok,
+                "errors": self.errors,
+                "rate_limited": self.rate_limited,
+                "bad_token": self.bad_token,
+                "unique_ips": len(self.per_ip),
+                "duplicate_requests": dup,
+                "in_flight": self.in_flight,
+                "max_in_flight": self.max_in_flight,
+            }
+
+
+def canned(ip):
+    h = int.from_bytes(hashlib.sha256(ip.encode()).digest()[:4], "big")
+    city, region, country = CITIES[h % len(CITIES)]
+    return {
+        "ip": ip,
+        "city": city,
+        "region": region,
+        "country": country,
+        "loc": "0.0000,0.0000",
+        "org": ORGS[(h >> 8) % len(ORGS)],
+        "timezone": "UTC",
+    }
+
+
+def make_handler(opts, stats):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            if opts.verbose:
+                super().log_message(fmt, *args)
+
+        def reply(self, code, body, extra=None):
+            data = json.dumps(body).encode()
+            self.send_response(code)
+            self.send_header("Content-Type", "application/json; charset=utf-8")
+            self.send_header("Content-Length", str(len(data)))
+            for k, v in (extra or {}).items():
+                self.send_header(k, v)
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_GET(self):
+            url = urlsplit(self.path)
+            path = url.path.strip("/")
+
+            if path == "_stats":
+                return self.reply(200, stats.as_dict())
+            if path == "_reset":
+                stats.reset()
+                return self.reply(200, {"reset": True})
+
+            ip = path.split("/")[0]
+            token = parse_qs(url.query).get("token", [""])[0]
+
+            with stats.lock:
+                stats.requests += 1
+                stats.per_ip[ip] = stats.per_ip.get(ip, 0) + 1
+                stats.in_flight += 1
+                stats.max_in_flight = max(stats.max_in_flight, stats.in_flight)
+                now = time.monotonic()
+                if now - stats.window_start >= 1.0:
+                    stats.window_start = now
+                    stats.window_count = 0
+                stats.window_count += 1
+                over_rps = opts.max_rps and stats.window_count > opts.max_rps
+
+            try:
+                delay = opts.latency + random.uniform(0, opts.jitter)
+                if random.random() < opts.slow_rate:
+                    delay += opts.slow_latency
+                if delay > 0:
+                    time.sleep(delay / 1000.0)
+
+                if opts.token and token != opts.token:
+                    with stats.lock:
+                        stats.bad_token += 1
+                    return self.reply(403, {"error": {"title": "Unknown token", "message": "Please ensure you've entered your token correctly."}})
+                if over_rps or random.random() < opts.ratelimit_rate:
+                    with stats.lock:
+                        stats.rate_limited += 1
+                    return self.reply(429, {"error": {"title": "Rate limit exceeded", "message": "Too many requests."}},
+                                      {"Retry-After": "1"})
+                if random.random() < opts.error_rate:
+                    with stats.lock:
+                        stats.errors += 1
+                    return self.reply(500, {"error": {"title": "Internal error", "message": "Simulated failure."}})
+
+                with stats.lock:
+                    stats.ok += 1
+                return self.reply(200, canned(ip))
+            finally:
+                with stats.lock:
+                    stats.in_flight -= 1
+
+    return Handler
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Local stand-in for the ipinfo.io API")
+    ap.add_argument("--bind", default="127.0.0.1", help="address to listen on (default 127.0.0.1)")
+    ap.add_argument("--port", type=int, default=8088, help="port to listen on (default 8088)")
+    ap.add_argument("--token", default="", help="only accept this token, others get 403 (default: accept any)")
+    ap.add_argument("--latency", type=float, default=50, help="base response time in ms (default 50)")
+    ap.add_argument("--jitter", type=float, default=20, help="random extra response time in ms, 0..N (default 20)")
+    ap.add_argument("--slow-rate", type=float, default=0.0, help="fraction of requests that are slow (default 0)")
+    ap.add_argument("--slow-latency", type=float, default=5000, help="extra ms for slow requests (default 5000)")
+    ap.add_argument("--error-rate", type=float, default=0.0, help="fraction of requests answered with 500 (default 0)")
+    ap.add_argument("--ratelimit-rate", type=float, default=0.0, help="fraction of requests answered with 429 (default 0)")
+    ap.add_argument("--max-rps", type=int, default=0, help="answer 429 above this many requests per second (default: no limit)")
+    ap.add_argument("--verbose", action="store_true", help="log every request")
+    opts = ap.parse_args()
+
+    stats = Stats()
+    server = ThreadingHTTPServer((opts.bind, opts.port), make_handler(opts, stats))
+    server.daemon_threads = True
+    print("fake ipinfo.io listening on http://%s:%d/" % (opts.bind, opts.port), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(json.dumps(stats.as_dict(), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,535 @@
+#!/usr/bin/env python3
+"""
+Replay a WHOIS/connect trace against a test ircd running ipinfo_io_whois
+and report how the lookup path holds up.
+
+Trace format, one event per line, times in seconds from the start:
+
+    # comment
+    0.000 connect alice 203.0.113.7
+    0.250 whois alice
+    9.100 quit alice
+
+Every "connect" opens a real client connection. Each distinct trace IP is
+mapped to its own loopback address (127.0.0.2, 127.0.0.3, ...) so the
+module sees, and caches, one IP per trace IP. This needs Linux, where the
+whole 127.0.0.0/8 is usable; pass --no-bind to connect everything from the
+default address instead.
+
+The WHOIS requests are sent by one oper connection. Meanwhile that
+connection sends a PING every --ping-interval ms: the ircd handles
+everything in a single event loop, so the PING round trip shows how long
+the loop stalls while lookups are in progress.
+
+Reported: WHOIS throughput and round trip, async 320 replies and how long
+they took, API calls per WHOIS, cache hit ratio (from /STATS modstats) and
+event-loop stall times. With --fake-url the counters of fake_ipinfo.py are
+included too.
+
+Make a synthetic trace with --generate, e.g.:
+
+    replay.py --generate --users 2000 --ips 500 --whois 20000 --duration 60 > trace.txt
+
+Only uses the Python standard library.
+"""
+
+import argparse
+import asyncio
+import collections
+import ipaddress
+import json
+import random
+import re
+import ssl
+import sys
+import time
+import urllib.request
+
+MODULE = "third/ipinfo_io_whois"
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    k = min(len(values) - 1, max(0, int(round(pct / 100.0 * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+def parse_trace(path):
+    events = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            parts = line.split()
+            try:
+                t = float(parts[0])
+                kind = parts[1].lower()
+                if kind == "connect" and len(parts) == 4:
+                    ipaddress.ip_address(parts[3])
+                    events.append((t, kind, parts[2], parts[3]))
+                elif kind in ("whois", "quit") and len(parts) == 3:
+                    events.append((t, kind, parts[2], None))
+                else:
+                    raise ValueError
+            except (ValueError, IndexError):
+                sys.exit("%s:%d: cannot parse: %s" % (path, lineno, line))
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+def generate(opts):
+    rnd = random.Random(opts.seed)
+    net = ipaddress.ip_network("198.18.0.0/15")  # benchmarking range
+    ips = [str(net[rnd.randrange(2, net.num_addresses - 1)]) for _ in range(opts.ips)]
+    nicks = ["u%05d" % i for i in range(opts.users)]
+    ramp = opts.duration * 0.2
+    out = []
+    for i, nick in enumerate(nicks):
+        out.append((ramp * i / max(1, opts.users), "connect", nick, ips[i % len(ips)]))
+    # Popular targets get WHOISed a lot, like a real oper would
+    weights = [1.0 / (i + 1) for i in range(len(nicks))]
+    for _ in range(opts.whois):
+        t = ramp + rnd.random() * (opts.duration - ramp)
+        out.append((t, "whois", rnd.choices(nicks, weights)[0], None))
+    out.sort(key=lambda e: e[0])
+    print("# generated: users=%d ips=%d whois=%d duration=%s seed=%d"
+          % (opts.users, opts.ips, opts.whois, opts.duration, opts.seed))
+    for t, kind, nick, ip in out:
+        print("%.3f %s %s%s" % (t, kind, nick, " " + ip if ip else ""))
+
+
+class Irc:
+    """Minimal IRC client connection."""
+
+    def __init__(self, opts, nick, local_addr=None):
+        self.opts = opts
+        self.nick = nick
+        self.local_addr = local_addr
+        self.reader = None
+        self.writer = None
+        self.registered = asyncio.get_running_loop().create_future()
+        self.task = None
+
+    async def connect(self):
+        ctx = None
+        if self.opts.tls:
+            ctx = ssl.create_default_context()
+            ctx.check_hostname = False
+            ctx.verify_mode = ssl.CERT_NONE
+        self.reader, self.writer = await asyncio.open_connection(
+            self.opts.host, self.opts.port, ssl=ctx,
+            local_addr=(self.local_addr, 0) if self.local_addr else None)
+        if self.opts.password:
+            self.send("PASS :%s" % self.opts.password)
+        self.send("NICK %s" % self.nick)
+        self.send("USER %s 0 * :ipinfo_io_whois replay" % self.nick)
+        self.task = asyncio.ensure_future(self.read_loop())
+        await asyncio.wait_for(asyncio.shield(self.registered), self.opts.timeout)
+
+    def send(self, line):
+        if self.writer and not self.writer.is_closing():
+            self.writer.write((line + "\r\n").encode())
+
+    async def read_loop(self):
+        try:
+            while True:
+                raw = await self.reader.readline()
+                if not raw:
+                    break
+                line = raw.decode("utf-8", "replace").rstrip("\r\n")
+                if line.startswith("@"):
+                    line = line.split(" ", 1)[1]
+                self.on_line(line)
+        except (ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            if not self.registered.done():
+                self.registered.set_exception(ConnectionError("%s: connection closed" % self.nick))
+
+    def on_line(self, line):
+        parts = line.split(" ")
+        if parts[0] == "PING":
+            self.send("PONG %s" % " ".join(parts[1:]))
+            return
+        if len(parts) < 2:
+            return
+        cmd = parts[1]
+        if cmd == "001" and not self.registered.done():
+            self.registered.set_result(True)
+        elif cmd in ("432", "433", "465") and not self.registered.done():
+            self.registered.set_exception(ConnectionError("%s: %s" % (self.nick, line)))
+        elif cmd == "ERROR" and not self.registered.done():
+            self.registered.set_exception(ConnectionError("%s: %s" % (self.nick, line)))
+
+    async def close(self, reason="replay done"):
+        self.send("QUIT :%s" % reason)
+        if self.writer:
+            try:
+                await self.writer.drain()
+            except ConnectionError:
+                pass
+            self.writer.close()
+        if self.task:
+            self.task.cancel()
+
+
+class Oper(Irc):
+    """The connection that sends the WHOIS requests and the stall probes."""
+
+    def __init__(self, opts, nick):
+        super().__init__(opts, nick)
+        self.opered = asyncio.get_running_loop().create_future()
+        self.pending = collections.defaultdict(collections.deque)  # nick -> send times
+        self.last_whois = {}
+        self.whois_rtt = []
+        self.whois_done = 0
+        self.inline_320 = 0
+        self.async_320 = 0
+        self.async_latency = []
+        self.pings = {}
+        self.ping_rtt = []
+        self.stats_lines = None
+        self.stats_done = None
+
+    def whois(self, nick):
+        now = time.monotonic()
+        self.pending[nick.lower()].append(now)
+        self.last_whois[nick.lower()] = now
+        self.send("WHOIS %s" % nick)
+
+    def ping(self, token):
+        self.pings[token] = time.monotonic()
+        self.send("PING :%s" % token)
+
+    async def modstats(self):
+        self.stats_lines = []
+        self.stats_done = asyncio.get_running_loop().create_future()
+        self.send("STATS modstats")
+        await asyncio.wait_for(self.stats_done, self.opts.timeout)
+        return parse_modstats(self.stats_lines)
+
+    def on_line(self, line):
+        super().on_line(line)
+        parts = line.split(" ", 3)
+        if len(parts) < 3:
+            return
+        cmd = parts[1]
+        now = time.monotonic()
+        if cmd == "381" and not self.opered.done():
+            self.opered.set_result(True)
+        elif cmd in ("464", "491") and not self.opered.done():
+            self.opered.set_exception(ConnectionError("OPER failed: %s" % line))
+        elif cmd == "PONG":
+            token = line.rsplit(":", 1)[-1]
+            sent = self.pings.pop(token, None)
+            if sent is not None:
+                self.ping_rtt.append(now - sent)
+        elif cmd == "320" and len(parts) == 4:
+            target = parts[3].split(" ", 1)[0].lower()
+            # citywhois uses 320 as well, only count ours
+            if ", Org: " not in line:
+                return
+            if self.pending.get(target):
+                self.inline_320 += 1
+            else:
+                self.async_320 += 1
+                if target in self.last_whois:
+                    self.async_latency.append(now - self.last_whois[target])
+        elif cmd == "318" and len(parts) == 4:
+            target = parts[3].split(" ", 1)[0].lower()
+            q = self.pending.get(target)
+            if q:
+                self.whois_rtt.append(now - q.popleft())
+                self.whois_done += 1
+        elif cmd == "401" and len(parts) == 4:
+            # No such nick, the 318 follows and is counted there
+            pass
+        elif cmd == "304" and self.stats_lines is not None and len(parts) == 4:
+            self.stats_lines.append(parts[3].lstrip(":"))
+        elif cmd == "219" and self.stats_done and not self.stats_done.done():
+            self.stats_done.set_result(True)
+
+
+def parse_modstats(lines):
+    """Pick the ipinfo_io_whois lines out of /STATS modstats."""
+    out = {}
+    for text in lines:
+        if not text.startswith(MODULE + " "):
+            continue
+        text = text[len(MODULE) + 1:]
+        m = re.match(r"(\S+?):?\s+(.*)$", text)
+        if not m:
+            continue
+        section = m.group(1).rstrip(":")
+        for key, value in re.findall(r"([\w-]+)[=<](\d+)", m.group(2)):
+            out["%s.%s" % (section, key)] = int(value)
+    return out
+
+
+def fake_stats(opts):
+    if not opts.fake_url:
+        return None
+    try:
+        with urllib.request.urlopen(opts.fake_url.rstrip("/") + "/_stats", timeout=5) as r:
+            return json.load(r)
+    except OSError as e:
+        print("warning: cannot read %s/_stats: %s" % (opts.fake_url, e), file=sys.stderr)
+        return None
+
+
+class AddressMap:
+    """Give every trace IP its own loopback source address."""
+
+    def __init__(self, enabled):
+        self.enabled = enabled
+        self.map = {}
+
+    def get(self, ip):
+        if not self.enabled:
+            return None
+        if ip not in self.map:
+            n = len(self.map) + 2
+            if n >= 1 << 24:
+                sys.exit("too many distinct IPs in trace for 127.0.0.0/8")
+            self.map[ip] = "127.%d.%d.%d" % (n >> 16, (n >> 8) & 255, n & 255)
+        return self.map[ip]
+
+
+async def replay(opts, events):
+    loop = asyncio.get_running_loop()
+    addrs = AddressMap(not opts.no_bind)
+    clients = {}
+    connected = {}
+    failures = collections.Counter()
+    connect_times = []
+
+    oper = Oper(opts, opts.nick)
+    await oper.connect()
+    oper.send("OPER %s %s" % (opts.oper_name, opts.oper_pass))
+    await asyncio.wait_for(oper.opered, opts.timeout)
+
+    before = await oper.modstats()
+    fake_before = fake_stats(opts)
+
+    async def do_connect(nick, ip):
+        c = Irc(opts, nick, addrs.get(ip))
+        clients[nick.lower()] = c
+        t0 = time.monotonic()
+        try:
+            await c.connect()
+            connect_times.append(time.monotonic() - t0)
+            connected[nick.lower()].set_result(True)
+        except (OSError, asyncio.TimeoutError) as e:
+            failures["connect"] += 1
+            if opts.verbose:
+                print("connect %s failed: %s" % (nick, e), file=sys.stderr)
+            connected[nick.lower()].set_result(False)
+
+    async def do_whois(nick):
+        fut = connected.get(nick.lower())
+        if fut is None:
+            failures["whois_unknown_nick"] += 1
+            return
+        try:
+            ok = await asyncio.wait_for(asyncio.shield(fut), opts.timeout)
+        except asyncio.TimeoutError:
+            ok = False
+        if not ok:
+            failures["whois_not_connected"] += 1
+            return
+        oper.whois(nick)
+
+    async def do_quit(nick):
+        c = clients.pop(nick.lower(), None)
+        connected.pop(nick.lower(), None)
+        if c:
+            await c.close()
+
+    stop_probe = False
+
+    async def probe():
+        n = 0
+        while not stop_probe:
+            n += 1
+            oper.ping("probe%d" % n)
+            await asyncio.sleep(opts.ping_interval / 1000.0)
+
+    probe_task = asyncio.ensure_future(probe())
+    tasks = []
+    whois_sent = 0
+    start = time.monotonic()
+    for t, kind, nick, ip in events:
+        delay = start + t / opts.speed - time.monotonic()
+        if delay > 0:
+            await asyncio.sleep(delay)
+        if kind == "connect":
+            connected[nick.lower()] = loop.create_future()
+            tasks.append(asyncio.ensure_future(do_connect(nick, ip)))
+        elif kind == "whois":
+            whois_sent += 1
+            tasks.append(asyncio.ensure_future(do_whois(nick)))
+        else:
+            tasks.append(asyncio.ensure_future(do_quit(nick)))
+    await asyncio.gather(*tasks)
+
+    # Let outstanding WHOIS replies come in, then give the async 320
+    # lines (sent after the 318) a moment as well
+    deadline = time.monotonic() + opts.drain
+    while any(oper.pending.values()) and time.monotonic() < deadline:
+        await asyncio.sleep(0.05)
+    elapsed = time.monotonic() - start
+    await asyncio.sleep(max(0.0, min(opts.async_wait, deadline - time.monotonic())))
+
+    stop_probe = True
+    await probe_task
+    after = await oper.modstats()
+    fake_after = fake_stats(opts)
+
+    for c in list(clients.values()):
+        await c.close()
+    await oper.close()
+
+    return report(opts, events, elapsed, whois_sent, oper, connect_times, failures,
+                  before, after, fake_before, fake_after, addrs)
+
+
+def report(opts, events, elapsed, whois_sent, oper, connect_times, failures,
+           before, after, fake_before, fake_after, addrs):
+    def delta(key):
+        return after.get(key, 0) - before.get(key, 0)
+
+    ms = lambda s: round(s * 1000.0, 2)
+    hits, misses = delta("cache.hits"), delta("cache.misses")
+    lookups = hits + misses
+    res = {
+        "trace_events": len(events),
+        "elapsed_s": round(elapsed, 3),
+        "speed": opts.speed,
+        "distinct_source_ips": len(addrs.map) if addrs.enabled else 1,
+        "connects": {
+            "ok": len(connect_times),
+            "p50_ms": ms(percentile(connect_times, 50)),
+            "p99_ms": ms(percentile(connect_times, 99)),
+        },
+        "whois": {
+            "sent": whois_sent,
+            "completed": oper.whois_done,
+            "per_second": round(oper.whois_done / elapsed, 2) if elapsed else 0,
+            "rtt_p50_ms": ms(percentile(oper.whois_rtt, 50)),
+            "rtt_p99_ms": ms(percentile(oper.whois_rtt, 99)),
+            "rtt_max_ms": ms(max(oper.whois_rtt, default=0)),
+            "inline_320": oper.inline_320,
+            "async_320": oper.async_320,
+            "async_320_p50_ms": ms(percentile(oper.async_latency, 50)),
+            "async_320_p99_ms": ms(percentile(oper.async_latency, 99)),
+        },
+        "module": {
+            "cache_hits": hits,
+            "cache_misses": misses,
+            "cache_hit_ratio": round(hits / lookups, 4) if lookups else None,
+            "api_errors": delta("cache.api-errors"),
+            "api_calls_per_whois": round(misses / oper.whois_done, 3) if oper.whois_done else None,
+            "http_calls": delta("http.calls"),
+        },
+        "stall": {
+            "probes": len(oper.ping_rtt),
+            "interval_ms": opts.ping_interval,
+            "p50_ms": ms(percentile(oper.ping_rtt, 50)),
+            "p99_ms": ms(percentile(oper.ping_rtt, 99)),
+            "max_ms": ms(max(oper.ping_rtt, default=0)),
+            "over_threshold": sum(1 for r in oper.ping_rtt if r * 1000.0 >= opts.stall_threshold),
+            "threshold_ms": opts.stall_threshold,
+        },
+        "failures": dict(failures),
+    }
+    if fake_before is not None and fake_after is not None:
+        fake = {k: fake_after[k] - fake_before.get(k, 0)
+                for k in ("requests", "ok", "errors", "rate_limited", "bad_token", "duplicate_requests")}
+        fake["max_in_flight"] = fake_after.get("max_in_flight")
+        res["fake_api"] = fake
+        if oper.whois_done:
+            res["module"]["api_calls_per_whois"] = round(fake["requests"] / oper.whois_done, 3)
+    if not before and not after:
+        res["module"]["note"] = "no %s lines in /STATS modstats, is the module loaded?" % MODULE
+    return res
+
+
+def print_text(res):
+    w, m, s = res["whois"], res["module"], res["stall"]
+    print("Replayed %d events in %.1fs (speed x%s, %d source IPs)"
+          % (res["trace_events"], res["elapsed_s"], res["speed"], res["distinct_source_ips"]))
+    print("Connects:  %d ok, p50 %.1fms p99 %.1fms"
+          % (res["connects"]["ok"], res["connects"]["p50_ms"], res["connects"]["p99_ms"]))
+    print("WHOIS:     %d/%d completed, %.1f/s, rtt p50 %.1fms p99 %.1fms max %.1fms"
+          % (w["completed"], w["sent"], w["per_second"], w["rtt_p50_ms"], w["rtt_p99_ms"], w["rtt_max_ms"]))
+    print("320 lines: %d from cache, %d async (p50 %.1fms p99 %.1fms)"
+          % (w["inline_320"], w["async_320"], w["async_320_p50_ms"], w["async_320_p99_ms"]))
+    ratio = m["cache_hit_ratio"]
+    print("Module:    hits %d misses %d hit-ratio %s api-errors %d api-calls/whois %s"
+          % (m["cache_hits"], m["cache_misses"], "%.1f%%" % (ratio * 100) if ratio is not None else "n/a",
+             m["api_errors"], m["api_calls_per_whois"]))
+    if "fake_api" in res:
+        f = res["fake_api"]
+        print("Fake API:  %d requests, %d ok, %d errors, %d rate-limited, %d duplicate, max %s in flight"
+              % (f["requests"], f["ok"], f["errors"], f["rate_limited"], f["duplicate_requests"], f["max_in_flight"]))
+    print("Stalls:    %d probes every %sms, p50 %.1fms p99 %.1fms max %.1fms, %d >= %sms"
+          % (s["probes"], s["interval_ms"], s["p50_ms"], s["p99_ms"], s["max_ms"], s["over_threshold"], s["threshold_ms"]))
+    if res["failures"]:
+        print("Failures:  %s" % ", ".join("%s=%d" % kv for kv in sorted(res["failures"].items())))
+    if "note" in m:
+        print("Note:      %s" % m["note"])
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Replay a WHOIS/connect trace against a test ircd running ipinfo_io_whois")
+    ap.add_argument("trace", nargs="?", help="trace file (see the top of this script for the format)")
+    ap.add_argument("--host", default="127.0.0.1", help="ircd to connect to (default 127.0.0.1)")
+    ap.add_argument("--port", type=int, default=6667, help="ircd port (default 6667)")
+    ap.add_argument("--tls", action="store_true", help="use TLS (certificate is not checked)")
+    ap.add_argument("--password", default="", help="server password, if any")
+    ap.add_argument("--nick", default="replayoper", help="nick of the oper connection (default replayoper)")
+    ap.add_argument("--oper-name", default="replay", help="oper block name (default replay)")
+    ap.add_argument("--oper-pass", default="replay", help="oper password (default replay)")
+    ap.add_argument("--speed", type=float, default=1.0, help="replay speed factor, 10 = ten times faster (default 1)")
+    ap.add_argument("--no-bind", action="store_true", help="don't map trace IPs to loopback addresses")
+    ap.add_argument("--ping-interval", type=float, default=100, help="ms between stall probes (default 100)")
+    ap.add_argument("--stall-threshold", type=float, default=50, help="probe round trip counted as a stall, ms (default 50)")
+    ap.add_argument("--drain", type=float, default=10, help="max seconds to wait for replies after the last event (default 10)")
+    ap.add_argument("--async-wait", type=float, default=2, help="seconds to wait for late 320 lines (default 2)")
+    ap.add_argument("--timeout", type=float, default=15, help="seconds to wait for registration/oper/stats (default 15)")
+    ap.add_argument("--fake-url", default="", help="base URL of fake_ipinfo.py, to include its counters")
+    ap.add_argument("--json", action="store_true", help="print the results as JSON")
+    ap.add_argument("--verbose", action="store_true", help="report every failed connection")
+    gen = ap.add_argument_group("trace generation")
+    gen.add_argument("--generate", action="store_true", help="write a synthetic trace to stdout and exit")
+    gen.add_argument("--users", type=int, default=1000, help="clients to connect (default 1000)")
+    gen.add_argument("--ips", type=int, default=300, help="distinct IPs they connect from (default 300)")
+    gen.add_argument("--whois", type=int, default=10000, help="WHOIS requests (default 10000)")
+    gen.add_argument("--duration", type=float, default=60, help="trace length in seconds (default 60)")
+    gen.add_argument("--seed", type=int, default=1, help="random seed (default 1)")
+    opts = ap.parse_args()
+
+    if opts.generate:
+        generate(opts)
+        return
+    if not opts.trace:
+        ap.error("a trace file is required (or use --generate to make one)")
+    if opts.speed <= 0:
+        ap.error("--speed must be positive")
+
+    events = parse_trace(opts.trace)
+    try:
+        res = asyncio.run(replay(opts, events))
+    except (OSError, asyncio.TimeoutError) as e:
+        sys.exit("replay failed: %s" % (e or "timeout"))
+    if opts.json:
+        print(json.dumps(res, indent=2))
+    else:
+        print_text(res)
+
+
+if __name__ == "__main__":
+    main()
@@ -20,51 +20,434 @@ module
 */
 
 #include "unrealircd.h"
+#include <jansson.h>
 
 #define MSG_SG "SG"
 #define MSG_SG_USER "SG-user"
+#define MSG_SG_CHECK "SG-check"
+#define MSG_SGQUERY "SGQUERY"
+#define MSG_SGREPLY "SGREPLY"
+#define MSG_SGEND "SGEND"
+#define MSG_SG_STATS "SG-STATS"
+#define MSG_SGSTATSQ "SGSTATSQ"
+#define MSG_SGSTATS "SGSTATS"
 #define MAX_BUFFER_SIZE 512
-#define MAX_NICKNAMES_PER_LINE 10
+
+// /SG output is paused while the requester's sendq is above 1/N of its limit
+#define SG_SENDQ_DIVISOR 2
+#define SG_OUTPUT_INTERVAL 250
+#define SG_BATCH_TYPE "unrealircd.org/security-group-members"
+
+// A listing whose requester doesn't read it is dropped after this many
+// seconds, it would otherwise keep compaction of its group on hold
+#define SG_OUTPUT_MAX_AGE 60
+
+// Remote member lines a /SG -global listing holds on to while the
+// requester's sendq is full; anything beyond that is dropped and counted
+#define SG_OUTPUT_MAX_QUEUED 2000
+
+// Time based rules (connect-time, reputation-score) change without any hook
+// firing, so every client is re-evaluated once per SG_RESYNC_INTERVAL (msec).
+// That is done SG_RESYNC_BATCH clients at a time every SG_RESYNC_STEP msec,
+// all at once would stall a big server.
+#define SG_RESYNC_INTERVAL 300000
+#define SG_RESYNC_STEP 100
+#define SG_RESYNC_BATCH 500
+
+// Tombstones are only squeezed out once there are this many of them
+#define SG_COMPACT_MIN 64
+
+// security_group.members page size, default and maximum
+#define SG_RPC_DEFAULT_LIMIT 1000
+#define SG_RPC_MAX_LIMIT 10000
+
+// Network-wide /SG: seconds to wait for the other servers, and the room
+// for nicknames in one SGREPLY once the prefix and parameters are taken off
+#define SG_QUERY_TIMEOUT 10
+#define SG_REPLY_PAYLOAD 400
+
+// One entry per configured security group, numbered in config order.
+// Members live in append-only slots: a client that leaves the group
+// leaves a NULL tombstone behind, removed later by sgindex_compact().
+typedef struct {
+    char *name;
+    SecurityGroup *sg;
+    Client **slots;
+    int used;     // slots in use, tombstones included
+    int size;     // slots allocated
+    int members;  // live members
+    int busy;     // listings in progress, compaction waits for them
+    unsigned int epoch; // changes on compaction, invalidates RPC cursors
+} SGIndexGroup;
+
+// Per-client position in every group's slot array (-1 if not a member)
+// and the same membership as a bitmap, one bit per group
+typedef struct {
+    int *slot;
+    uint32_t *bits;
+    unsigned int resync_round; // sg_resync_round when last re-evaluated
+} SGClientIndex;
+
+static SGIndexGroup *sg_groups = NULL;
+static int sg_group_count = 0;
+static unsigned int sg_resync_round = 0;
+static int sg_resync_active = 0;
+ModDataInfo *sgindex_md = NULL;
+ModDataInfo *sgbits_md = NULL;
+
+#define SGINDEX(client) ((SGClientIndex *)moddata_local_client(client, sgindex_md).ptr)
+#define SG_BITMAP_WORDS(n) (((n) + 31) / 32)
+#define SG_HAS_BIT(bits, g) ((bits)[(g) / 32] & (1U << ((g) % 32)))
+
+typedef struct SGOutput SGOutput;
+
+// A /SG -global or /SG-STATS -global waiting for the other servers to answer
+typedef struct SGRemoteQuery SGRemoteQuery;
+struct SGRemoteQuery {
+    SGRemoteQuery *prev, *next;
+    SGOutput *output; // member query: the listing the answers go to
+    unsigned int id;
+    char requester[IDLEN + 1];
+    char *groupname;  // NULL for a stats query
+    int expected;     // servers asked
+    int answered;     // servers that sent SGEND
+    int members;      // remote members reported so far
+    int *counts;      // stats query: network-wide count per group
+    int unknown;      // stats query: remote groups we don't have here
+    time_t deadline;
+};
+
+static SGRemoteQuery *sg_queries = NULL;
+static unsigned int sg_query_id = 0;
+
+// A line of a /SG listing waiting for room in the requester's sendq
+typedef struct SGLine SGLine;
+struct SGLine {
+    SGLine *next;
+    char *text;
+};
+
+// A /SG listing that is streamed out over several event loop ticks.
+// The local members go first; for /SG -global the answers of the other
+// servers are queued behind them and the batch ends once both are sent.
+struct SGOutput {
+    SGOutput *prev, *next;
+    char requester[IDLEN + 1];
+    int group;
+    int pos;      // next slot to send
+    int found;
+    int local_done;       // local members sent, the group is no longer held busy
+    int global;           // other servers were asked too
+    SGRemoteQuery *query; // network-wide part still running, NULL if none
+    SGLine *lines, **lines_tail;
+    int queued;
+    int dropped;
+    time_t started;
+    char batch[BATCHLEN + 1]; // empty if the client has no batch support
+};
+
+static SGOutput *sg_outputs = NULL;
 
 CMD_FUNC(cmd_sg);
 CMD_FUNC(cmd_sg_user);
+CMD_FUNC(cmd_sg_check);
+CMD_FUNC(cmd_sgquery);
+CMD_FUNC(cmd_sgreply);
+CMD_FUNC(cmd_sgend);
+CMD_FUNC(cmd_sg_stats);
+CMD_FUNC(cmd_sgstatsq);
+CMD_FUNC(cmd_sgstats);
 
 // Forward declarations
 void list_security_groups_for_user(Client *client, Client *user);
-void list_members_of_security_group(Client *client, const char *groupname);
+void list_members_of_security_group(Client *client, const char *groupname, int global);
+void sgindex_build(void);
+void sgindex_free(void);
+int sgindex_find(const char *groupname);
+void sgindex_update_client(Client *client);
+void sgindex_remove_client(Client *client);
+void sgindex_md_free(ModData *m);
+Client *sgindex_next_member(SGIndexGroup *group, int *pos);
+RPC_CALL_FUNC(rpc_security_group_members);
+RPC_CALL_FUNC(rpc_security_group_of_client);
+RPC_CALL_FUNC(rpc_modstats_listsg);
+int listsg_stats(Client *client, const char *flag);
+void sgbits_md_free(ModData *m);
+EVENT(sgindex_resync);
+EVENT(sgindex_resync_step);
+void sg_query_start(Client *client, SGOutput *o);
+void sg_stats_query_start(Client *client);
+void sg_query_finish(SGRemoteQuery *q, int timed_out);
+static void sg_query_free(SGRemoteQuery *q);
+EVENT(sg_query_timeout);
+int sg_output_run(SGOutput *o);
+void sg_output_done(SGOutput *o, const char *reason);
+static void sg_output_line(Client *client, SGOutput *o, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,3,4)));
+static void sg_output_queue(SGOutput *o, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,2,3)));
+static void sg_output_kick(SGOutput *o);
+static void sg_reply_queue(SGRemoteQuery *q, Client *server, const char *nicks);
+EVENT(sg_output_resume);
+static void sgindex_maybe_compact(int g);
+
+// Hooks that may change the outcome of a security group match
+int sgindex_connect(Client *client);
+int sgindex_quit(Client *client, MessageTag *mtags, const char *comment);
+int sgindex_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
+int sgindex_account_login(Client *client, MessageTag *mtags);
+int sgindex_oper(Client *client, int add, const char *oper_block, const char *operclass);
+int sgindex_umode_change(Client *client, long setflags, long newflags);
+int sgindex_userhost_change(Client *client, const char *olduser, const char *oldhost);
+int sgindex_ip_change(Client *client, const char *oldip);
+int sgindex_realname_change(Client *client, const char *oldinfo);
 
 ModuleHeader MOD_HEADER = {
     "third/listsg",   // Module name
-    "1.0",              // Version
+    "1.1",              // Version
     "Commands /SG and /SG-user to list security groups and their members", // Description
     "reverse",          // Author
     "unrealircd-6",     // UnrealIRCd version
 };
 
+// Time spent in /SG, /SG-user and in keeping the index up to date, as call
+// counts and log2 histograms of nanoseconds. Shown in /STATS modstats and
+// the modstats.listsg RPC call.
+#define MODSTAT_BUCKETS 40
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long hist[MODSTAT_BUCKETS]; // bucket b: calls that took [2^b, 2^(b+1)) ns
+} ModStat;
+
+static inline uint64_t modstat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void modstat_record(ModStat *m, uint64_t start) {
+    uint64_t ns = modstat_now() - start;
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (b >= MODSTAT_BUCKETS)
+        b = MODSTAT_BUCKETS - 1;
+    m->calls++;
+    m->total_ns += ns;
+    m->hist[b]++;
+}
+
+// Upper bound of the bucket that holds the given percentile
+static uint64_t modstat_percentile(const ModStat *m, int pct) {
+    unsigned long long want = (m->calls * pct + 99) / 100, seen = 0;
+
+    for (int b = 0; b < MODSTAT_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen && seen >= want)
+            return 2ULL << b;
+    }
+    return 0;
+}
+
+static void modstat_report(Client *client, const char *name, const ModStat *m) {
+    sendtxtnumeric(client, "%s %s: calls=%llu avg=%lluns p50<%lluns p99<%lluns",
+                   MOD_HEADER.name, name, m->calls,
+                   m->calls ? m->total_ns / m->calls : 0ULL,
+                   (unsigned long long)modstat_percentile(m, 50),
+                   (unsigned long long)modstat_percentile(m, 99));
+}
+
+static json_t *modstat_json(const ModStat *m) {
+    json_t *j = json_object();
+    json_t *hist = json_array();
+
+    json_object_set_new(j, "calls", json_integer(m->calls));
+    json_object_set_new(j, "total_ns", json_integer(m->total_ns));
+    json_object_set_new(j, "p50_ns", json_integer(modstat_percentile(m, 50)));
+    json_object_set_new(j, "p99_ns", json_integer(modstat_percentile(m, 99)));
+    for (int b = 0; b < MODSTAT_BUCKETS; b++)
+        json_array_append_new(hist, json_integer(m->hist[b]));
+    json_object_set_new(j, "histogram_log2_ns", hist);
+    return j;
+}
+
+// Persistent across rehash. size is checked on load in case an upgrade
+// changed the struct.
+typedef struct {
+    size_t size;
+    time_t since;
+    ModStat sg;
+    ModStat sg_user;
+    ModStat index_update;
+    ModStat resync;
+} ModStats;
+
+static ModStats *modstats = NULL;
+
+static void modstats_free(ModData *m) {
+    safe_free(m->ptr);
+}
+
 MOD_INIT() {
+    ModDataInfo mreq;
+    RPCHandlerInfo r;
+
     MARK_AS_GLOBAL_MODULE(modinfo);
-    CommandAdd(modinfo->handle, MSG_SG, cmd_sg, 1, CMD_USER); // Adding the command for groups
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.name = "listsg_index";
+    mreq.type = MODDATATYPE_LOCAL_CLIENT;
+    mreq.free = sgindex_md_free;
+    sgindex_md = ModDataAdd(modinfo->handle, mreq);
+    if (!sgindex_md) {
+        config_error("[listsg] failed adding moddata");
+        return MOD_FAILED;
+    }
+
+    // Read-only view of the membership bitmap for other modules. Bit N is
+    // the N-th security group in config order (the securitygroups list).
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.name = "security-group-bits";
+    mreq.type = MODDATATYPE_LOCAL_CLIENT;
+    mreq.free = sgbits_md_free;
+    sgbits_md = ModDataAdd(modinfo->handle, mreq);
+    if (!sgbits_md) {
+        config_error("[listsg] failed adding moddata");
+        return MOD_FAILED;
+    }
+
+    CommandAdd(modinfo->handle, MSG_SG, cmd_sg, 2, CMD_USER); // Adding the command for groups
     CommandAdd(modinfo->handle, MSG_SG_USER, cmd_sg_user, 1, CMD_USER); // Adding the command for user security groups
+    CommandAdd(modinfo->handle, MSG_SG_CHECK, cmd_sg_check, 1, CMD_USER); // Verify the index against a full scan
+    CommandAdd(modinfo->handle, MSG_SGQUERY, cmd_sgquery, 2, CMD_SERVER); // Server to server: network-wide /SG request
+    CommandAdd(modinfo->handle, MSG_SGREPLY, cmd_sgreply, 3, CMD_SERVER); // Server to server: batch of member nicknames
+    CommandAdd(modinfo->handle, MSG_SGEND, cmd_sgend, 3, CMD_SERVER); // Server to server: end of reply
+    CommandAdd(modinfo->handle, MSG_SG_STATS, cmd_sg_stats, 1, CMD_USER); // Member counts of all groups
+    CommandAdd(modinfo->handle, MSG_SGSTATSQ, cmd_sgstatsq, 1, CMD_SERVER); // Server to server: network-wide /SG-STATS request
+    CommandAdd(modinfo->handle, MSG_SGSTATS, cmd_sgstats, 3, CMD_SERVER); // Server to server: batch of group counts
+
+    memset(&r, 0, sizeof(r));
+    r.method = "security_group.members";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_security_group_members;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("[listsg] Could not register RPC handler");
+        return MOD_FAILED;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.method = "security_group.of_client";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_security_group_of_client;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("[listsg] Could not register RPC handler");
+        return MOD_FAILED;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.method = "modstats.listsg";
+    r.loglevel = ULOG_DEBUG;
+    r.call = rpc_modstats_listsg;
+    if (!RPCHandlerAdd(modinfo->handle, &r)) {
+        config_error("[listsg] Could not register RPC handler");
+        return MOD_FAILED;
+    }
+    LoadPersistentPointer(modinfo, modstats, modstats_free);
+    if (modstats && modstats->size != sizeof(ModStats))
+        safe_free(modstats);
+    if (!modstats) {
+        modstats = safe_alloc(sizeof(ModStats));
+        modstats->size = sizeof(ModStats);
+        modstats->since = TStime();
+    }
+
+    // Answers to queries of a previous instance may still arrive after a
+    // rehash, don't let them match a fresh query with the same id
+    sg_query_id = getrandom32();
+
+    HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, listsg_stats);
+
+    HookAdd(modinfo->handle, HOOKTYPE_LOCAL_CONNECT, 0, sgindex_connect);
+    HookAdd(modinfo->handle, HOOKTYPE_LOCAL_QUIT, 0, sgindex_quit);
+    HookAdd(modinfo->handle, HOOKTYPE_POST_LOCAL_NICKCHANGE, 0, sgindex_nickchange);
+    HookAdd(modinfo->handle, HOOKTYPE_ACCOUNT_LOGIN, 0, sgindex_account_login);
+    HookAdd(modinfo->handle, HOOKTYPE_LOCAL_OPER, 0, sgindex_oper);
+    HookAdd(modinfo->handle, HOOKTYPE_UMODE_CHANGE, 0, sgindex_umode_change);
+    HookAdd(modinfo->handle, HOOKTYPE_USERHOST_CHANGE, 0, sgindex_userhost_change);
+    HookAdd(modinfo->handle, HOOKTYPE_IP_CHANGE, 0, sgindex_ip_change);
+    HookAdd(modinfo->handle, HOOKTYPE_REALNAME_CHANGE, 0, sgindex_realname_change);
     return MOD_SUCCESS;
 }
 
 MOD_LOAD() {
+    // Security groups are (re)numbered here; on /rehash we get reloaded,
+    // so this is also where a changed set of groups gets picked up.
+    sgindex_build();
+    EventAdd(modinfo->handle, "sgindex_resync", sgindex_resync, NULL, SG_RESYNC_INTERVAL, 0);
+    EventAdd(modinfo->handle, "sgindex_resync_step", sgindex_resync_step, NULL, SG_RESYNC_STEP, 0);
+    EventAdd(modinfo->handle, "sg_query_timeout", sg_query_timeout, NULL, 1000, 0);
+    EventAdd(modinfo->handle, "sg_output_resume", sg_output_resume, NULL, SG_OUTPUT_INTERVAL, 0);
     return MOD_SUCCESS;
 }
 
 MOD_UNLOAD() {
+    SGRemoteQuery *q, *q_next;
+
+    SavePersistentPointer(modinfo, modstats);
+
+    // Any answers still in flight are ignored by the reloaded module
+    for (q = sg_queries; q; q = q_next) {
+        q_next = q->next;
+        sg_query_free(q);
+    }
+
+    sgindex_free();
     return MOD_SUCCESS;
 }
 
 // Command function for /SG (lists members of a security group)
 CMD_FUNC(cmd_sg) {
+    uint64_t started = modstat_now();
+
     if (parc < 2) {
-        sendnotice(client, "Usage: /SG <groupname>");
+        sendnotice(client, "Usage: /SG [-global] <groupname>");
+        return;
+    }
+
+    if (!strcasecmp(parv[1], "-global")) {
+        if (!IsOper(client)) {
+            sendnumeric(client, ERR_NOPRIVILEGES);
+            return;
+        }
+        if (parc < 3 || BadPtr(parv[2])) {
+            sendnotice(client, "Usage: /SG [-global] <groupname>");
+            return;
+        }
+        list_members_of_security_group(client, parv[2], 1);
+        modstat_record(&modstats->sg, started);
         return;
     }
 
     const char *groupname = parv[1];
-    list_members_of_security_group(client, groupname);
+    list_members_of_security_group(client, groupname, 0);
+    modstat_record(&modstats->sg, started);
+}
+
+// Command function for /SG-STATS (member counts of every security group)
+CMD_FUNC(cmd_sg_stats) {
+    int global = (parc > 1 && !strcasecmp(parv[1], "-global"));
+
+    if (!IsOper(client)) {
+        sendnumeric(client, ERR_NOPRIVILEGES);
+        return;
+    }
+
+    // The index keeps a live count per group, no client scan needed
+    sendnotice(client, "Local security group member counts:");
+    for (int g = 0; g < sg_group_count; g++)
+        sendnotice(client, "- %s: %d", sg_groups[g].name, sg_groups[g].members);
+
+    if (global)
+        sg_stats_query_start(client);
 }
 
 // Command function for /SG-user (lists security groups for a user)
@@ -77,64 +460,1065 @@ CMD_FUNC(cmd_sg_user) {
     const char *nickname = parv[1];
     Client *target_user = find_client(nickname, NULL);
     if (target_user) {
+        uint64_t started = modstat_now();
         list_security_groups_for_user(client, target_user);
+        modstat_record(&modstats->sg_user, started);
     } else {
         sendnotice(client, "No such nickname: %s", nickname);
     }
 }
 
+// Command function for /SG-check (compares the index with a full scan)
+CMD_FUNC(cmd_sg_check) {
+    Client *target;
+    int clients = 0, missing = 0, stale = 0, miscounted = 0;
+    int *counts;
+
+    if (!IsOper(client)) {
+        sendnumeric(client, ERR_NOPRIVILEGES);
+        return;
+    }
+
+    counts = safe_alloc(sizeof(int) * (sg_group_count + 1));
+
+    list_for_each_entry(target, &lclient_list, lclient_node) {
+        if (!MyUser(target))
+            continue;
+        clients++;
+
+        SGClientIndex *idx = SGINDEX(target);
+        for (int g = 0; g < sg_group_count; g++) {
+            int member = user_allowed_by_security_group(target, sg_groups[g].sg);
+            int indexed = idx && idx->slot[g] >= 0 && sg_groups[g].slots[idx->slot[g]] == target;
+
+            if (member)
+                counts[g]++;
+            if (member && !indexed)
+                missing++;
+            else if (!member && indexed)
+                stale++;
+        }
+    }
+
+    for (int g = 0; g < sg_group_count; g++) {
+        if (counts[g] != sg_groups[g].members) {
+            sendnotice(client, "- %s: index has %d members, full scan found %d",
+                       sg_groups[g].name, sg_groups[g].members, counts[g]);
+            miscounted++;
+        }
+    }
+    safe_free(counts);
+
+    sendnotice(client, "Security group index check: %d clients, %d groups, %d missing, %d stale, %d miscounted groups",
+               clients, sg_group_count, missing, stale, miscounted);
+
+    if ((missing || stale || miscounted) && parc > 1 && !strcasecmp(parv[1], "fix")) {
+        sgindex_build();
+        sendnotice(client, "Security group index rebuilt.");
+    }
+}
+
 // Function to list security groups a user is part of
 void list_security_groups_for_user(Client *client, Client *user) {
-    const char *groups = get_security_groups(user);
-    if (!groups || *groups == '\0') {
-        sendnotice(client, "User %s is not part of any security groups.", user->name);
+    SGClientIndex *idx = MyUser(user) ? SGINDEX(user) : NULL;
+
+    // Only local users are indexed, remote ones are evaluated on the spot
+    if (!idx) {
+        const char *groups = get_security_groups(user);
+        if (!groups || *groups == '\0') {
+            sendnotice(client, "User %s is not part of any security groups.", user->name);
+            return;
+        }
+
+        sendnotice(client, "Security groups for user %s:", user->name);
+        sendnotice(client, "- %s", groups);
         return;
     }
 
-    sendnotice(client, "Security groups for user %s:", user->name);
-    sendnotice(client, "- %s", groups);
+    char buffer[MAX_BUFFER_SIZE];
+    size_t len = 0, room = MAX_BUFFER_SIZE - 100;
+    int found = 0;
+
+    for (int g = 0; g < sg_group_count; g++) {
+        if (!SG_HAS_BIT(idx->bits, g))
+            continue;
+
+        size_t namelen = strlen(sg_groups[g].name);
+        if (!found)
+            sendnotice(client, "Security groups for user %s:", user->name);
+        if (len && len + 1 + namelen > room) {
+            buffer[len] = '\0';
+            sendnotice(client, "- %s", buffer);
+            len = 0;
+        }
+        if (len)
+            buffer[len++] = ',';
+        memcpy(buffer + len, sg_groups[g].name, namelen);
+        len += namelen;
+        found++;
+    }
+
+    if (len) {
+        buffer[len] = '\0';
+        sendnotice(client, "- %s", buffer);
+    }
+    if (!found)
+        sendnotice(client, "User %s is not part of any security groups.", user->name);
 }
 
-// Function to list members of a security group
-void list_members_of_security_group(Client *client, const char *groupname) {
-    SecurityGroup *group = find_security_group(groupname);
-    if (!group) {
+static SGOutput *sg_output_find(Client *client) {
+    SGOutput *o;
+
+    for (o = sg_outputs; o; o = o->next) {
+        if (!strcmp(o->requester, client->id))
+            return o;
+    }
+    return NULL;
+}
+
+// Function to list members of a security group, with global set the
+// members on the other servers as well
+void list_members_of_security_group(Client *client, const char *groupname, int global) {
+    int g = sgindex_find(groupname);
+    if (g < 0) {
         sendnotice(client, "Security group %s does not exist.", groupname);
         return;
     }
 
-    sendnotice(client, "Members of security group %s:", groupname);
+    // One listing per client, or someone not reading their sendq could pile them up
+    if (sg_output_find(client)) {
+        sendnotice(client, "Your previous /SG listing is still being sent, try again when it has finished.");
+        return;
+    }
 
-    Client *target;
-    int member_found = 0;
-    char buffer[MAX_BUFFER_SIZE];
-    buffer[0] = '\0';
-    int nickname_count = 0;
+    SGOutput *o = safe_alloc(sizeof(SGOutput));
+    strlcpy(o->requester, client->id, sizeof(o->requester));
+    o->group = g;
+    o->lines_tail = &o->lines;
+    o->started = TStime();
+    sg_groups[g].busy++;
+    AddListItem(o, sg_outputs);
 
-    list_for_each_entry(target, &lclient_list, lclient_node) {
-        if (user_allowed_by_security_group_name(target, groupname)) {
-            if (nickname_count > 0) {
-                strlcat(buffer, ", ", sizeof(buffer));
+    if (HasCapability(client, "batch")) {
+        generate_batch_id(o->batch);
+        sendto_one(client, NULL, ":%s BATCH +%s %s %s", me.name, o->batch, SG_BATCH_TYPE, sg_groups[g].name);
+    }
+    sg_output_line(client, o, "Members of security group %s:", sg_groups[g].name);
+    if (global)
+        sg_query_start(client, o);
+
+    // Send what fits right now, sg_output_resume() picks up the rest
+    sg_output_kick(o);
+}
+
+static void sg_output_line(Client *client, SGOutput *o, FORMAT_STRING(const char *fmt), ...) {
+    char text[MAX_BUFFER_SIZE];
+    va_list vl;
+
+    va_start(vl, fmt);
+    ircvsnprintf(text, sizeof(text), fmt, vl);
+    va_end(vl);
+
+    if (*o->batch) {
+        MessageTag mtag;
+        memset(&mtag, 0, sizeof(mtag));
+        mtag.name = "batch";
+        mtag.value = o->batch;
+        sendto_one(client, &mtag, ":%s NOTICE %s :%s", me.name, client->name, text);
+    } else {
+        sendnotice(client, "%s", text);
+    }
+}
+
+// Send members until the group is exhausted or the requester's sendq
+// gets too full, then any queued remote lines. Returns 1 when done, 0 when
+// it should be resumed later.
+int sg_output_run(SGOutput *o) {
+    Client *client = hash_find_id(o->requester, NULL);
+    SGIndexGroup *group = &sg_groups[o->group];
+
+    if (!client || !MyConnect(client))
+        return 1;
+
+    if (!o->local_done) {
+        char buffer[MAX_BUFFER_SIZE];
+        size_t len = 0, room;
+        int paused = 0;
+
+        // ":<server> NOTICE <nick> :- <nicks>\r\n" has to fit in one IRC line
+        room = 510 - (strlen(me.name) + strlen(client->name) + 14);
+        if (room >= sizeof(buffer))
+            room = sizeof(buffer) - 1;
+
+        while (1) {
+            if (DBufLength(&client->local->sendQ) > get_sendq(client) / SG_SENDQ_DIVISOR) {
+                paused = 1;
+                break;
             }
-            strlcat(buffer, target->name, sizeof(buffer));
-            nickname_count++;
-            member_found = 1;
-
-            // Check if the buffer is near its limit or if we reached the max nicknames per line
-            if (strlen(buffer) >= MAX_BUFFER_SIZE - 50 || nickname_count >= MAX_NICKNAMES_PER_LINE) {
-                sendnotice(client, "- %s", buffer);
-                buffer[0] = '\0'; // Reset buffer
-                nickname_count = 0; // Reset nickname count
+
+            int pos = o->pos;
+            Client *target = sgindex_next_member(group, &pos);
+            if (!target) {
+                o->pos = pos;
+                break;
             }
+
+            size_t nicklen = strlen(target->name);
+            if (len && len + 2 + nicklen > room) {
+                buffer[len] = '\0';
+                sg_output_line(client, o, "- %s", buffer);
+                len = 0;
+                continue;
+            }
+            if (len) {
+                buffer[len++] = ',';
+                buffer[len++] = ' ';
+            }
+            memcpy(buffer + len, target->name, nicklen);
+            len += nicklen;
+            o->found++;
+            o->pos = pos;
+        }
+
+        // Never hold on to a partial line across ticks
+        if (len) {
+            buffer[len] = '\0';
+            sg_output_line(client, o, "- %s", buffer);
         }
+        if (paused)
+            return 0;
+
+        // Done with the slot array, let the group be compacted again
+        o->local_done = 1;
+        if (o->global && !o->found)
+            sg_output_line(client, o, "No members on this server.");
+        group->busy--;
+        sgindex_maybe_compact(o->group);
     }
 
-    // Send any remaining nicknames in the buffer
-    if (nickname_count > 0) {
-        sendnotice(client, "- %s", buffer);
+    while (o->lines) {
+        if (DBufLength(&client->local->sendQ) > get_sendq(client) / SG_SENDQ_DIVISOR)
+            return 0;
+
+        SGLine *line = o->lines;
+        sg_output_line(client, o, "%s", line->text);
+        o->lines = line->next;
+        if (!o->lines)
+            o->lines_tail = &o->lines;
+        o->queued--;
+        safe_free(line->text);
+        safe_free(line);
+    }
+
+    // Still waiting for the other servers?
+    return !o->query;
+}
+
+// Finish (or abort, when reason is set) a listing and close its batch
+void sg_output_done(SGOutput *o, const char *reason) {
+    Client *client = hash_find_id(o->requester, NULL);
+    SGIndexGroup *group = &sg_groups[o->group];
+    SGLine *line, *line_next;
+
+    if (client && MyConnect(client)) {
+        if (reason)
+            sg_output_line(client, o, "Listing of %s interrupted: %s", group->name, reason);
+        else if (!o->found && !o->global)
+            sg_output_line(client, o, "Security group %s has no members.", group->name);
+        if (o->dropped)
+            sg_output_line(client, o, "%d line%s of remote members dropped, your client was not reading fast enough.",
+                           o->dropped, o->dropped == 1 ? "" : "s");
+        if (*o->batch)
+            sendto_one(client, NULL, ":%s BATCH -%s", me.name, o->batch);
     }
 
-    if (!member_found) {
-        sendnotice(client, "Security group %s has no members.", groupname);
+    // Answers still on their way are of no use any more
+    if (o->query)
+        sg_query_free(o->query);
+
+    for (line = o->lines; line; line = line_next) {
+        line_next = line->next;
+        safe_free(line->text);
+        safe_free(line);
+    }
+
+    DelListItem(o, sg_outputs);
+    if (!o->local_done) {
+        group->busy--;
+        sgindex_maybe_compact(o->group);
     }
+    safe_free(o);
+}
+
+// Queue a line behind the local members, it goes out when there is room
+static void sg_output_queue(SGOutput *o, FORMAT_STRING(const char *fmt), ...) {
+    char text[MAX_BUFFER_SIZE];
+    va_list vl;
+    SGLine *line;
+
+    va_start(vl, fmt);
+    ircvsnprintf(text, sizeof(text), fmt, vl);
+    va_end(vl);
+
+    line = safe_alloc(sizeof(SGLine));
+    safe_strdup(line->text, text);
+    *o->lines_tail = line;
+    o->lines_tail = &line->next;
+    o->queued++;
+}
+
+// Send whatever can go out now, and finish the listing if that was all
+static void sg_output_kick(SGOutput *o) {
+    if (sg_output_run(o))
+        sg_output_done(o, NULL);
+}
+
+EVENT(sg_output_resume) {
+    SGOutput *o, *o_next;
+
+    for (o = sg_outputs; o; o = o_next) {
+        o_next = o->next;
+        if (sg_output_run(o))
+            sg_output_done(o, NULL);
+        else if (TStime() - o->started > SG_OUTPUT_MAX_AGE)
+            sg_output_done(o, "your client is not reading it fast enough");
+    }
+}
+
+// security_group.members: one page of members of a group.
+// The cursor is "<epoch>:<slot>"; it expires if the group gets compacted.
+RPC_CALL_FUNC(rpc_security_group_members) {
+    const char *name, *cursor;
+    int limit, details, pos = 0, g;
+    json_t *result, *list;
+    Client *target;
+
+    REQUIRE_PARAM_STRING("name", name);
+    OPTIONAL_PARAM_STRING("cursor", cursor);
+    OPTIONAL_PARAM_INTEGER("limit", limit, SG_RPC_DEFAULT_LIMIT);
+    OPTIONAL_PARAM_INTEGER("object_detail_level", details, 0);
+
+    g = sgindex_find(name);
+    if (g < 0) {
+        rpc_error(client, request, JSON_RPC_ERROR_NOT_FOUND, "Security group not found");
+        return;
+    }
+    SGIndexGroup *group = &sg_groups[g];
+
+    if (limit < 1) {
+        rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "limit must be at least 1");
+        return;
+    }
+    if (limit > SG_RPC_MAX_LIMIT)
+        limit = SG_RPC_MAX_LIMIT;
+
+    if (cursor) {
+        unsigned int epoch;
+        if (sscanf(cursor, "%u:%d", &epoch, &pos) != 2 || pos < 0) {
+            rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Invalid cursor");
+            return;
+        }
+        if (epoch != group->epoch) {
+            rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Cursor expired, start over without a cursor");
+            return;
+        }
+    }
+
+    result = json_object();
+    list = json_array();
+    json_object_set_new(result, "name", json_string_unreal(group->name));
+    json_object_set_new(result, "count", json_integer(group->members));
+
+    for (int n = 0; n < limit && (target = sgindex_next_member(group, &pos)); n++) {
+        json_t *item = json_object();
+        json_expand_client(item, NULL, target, details);
+        json_array_append_new(list, item);
+    }
+    json_object_set_new(result, "members", list);
+
+    // Only hand out a cursor if there is anything left to fetch
+    int peek = pos;
+    if (sgindex_next_member(group, &peek)) {
+        char next[32];
+        snprintf(next, sizeof(next), "%u:%d", group->epoch, pos);
+        json_object_set_new(result, "next_cursor", json_string_unreal(next));
+    } else {
+        json_object_set_new(result, "next_cursor", json_null());
+    }
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
+
+// security_group.of_client: names of all security groups a user is in
+RPC_CALL_FUNC(rpc_security_group_of_client) {
+    const char *nick;
+    Client *target;
+    json_t *result, *list;
+
+    REQUIRE_PARAM_STRING("nick", nick);
+
+    target = find_user(nick, NULL);
+    if (!target) {
+        rpc_error(client, request, JSON_RPC_ERROR_NOT_FOUND, "Nickname not found");
+        return;
+    }
+
+    result = json_object();
+    list = json_array();
+    json_object_set_new(result, "name", json_string_unreal(target->name));
+
+    SGClientIndex *idx = MyUser(target) ? SGINDEX(target) : NULL;
+    if (idx) {
+        for (int g = 0; g < sg_group_count; g++) {
+            if (SG_HAS_BIT(idx->bits, g))
+                json_array_append_new(list, json_string_unreal(sg_groups[g].name));
+        }
+    } else {
+        // Remote user, let the core evaluate it
+        char buf[MAX_BUFFER_SIZE];
+        char *p, *name;
+        const char *groups = get_security_groups(target);
+
+        strlcpy(buf, groups ? groups : "", sizeof(buf));
+        for (name = strtoken(&p, buf, ","); name; name = strtoken(&p, NULL, ","))
+            json_array_append_new(list, json_string_unreal(name));
+    }
+    json_object_set_new(result, "security_groups", list);
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
+
+// Register a query to every other server, NULL if we are alone
+static SGRemoteQuery *sg_query_new(Client *client) {
+    Client *acptr;
+    SGRemoteQuery *q;
+    int expected = 0;
+
+    list_for_each_entry(acptr, &global_server_list, client_node) {
+        if (!IsMe(acptr) && !IsULine(acptr))
+            expected++;
+    }
+
+    if (!expected)
+        return NULL;
+
+    q = safe_alloc(sizeof(SGRemoteQuery));
+    q->id = ++sg_query_id;
+    strlcpy(q->requester, client->id, sizeof(q->requester));
+    q->expected = expected;
+    q->deadline = TStime() + SG_QUERY_TIMEOUT;
+    AddListItem(q, sg_queries);
+    return q;
+}
+
+static void sg_query_free(SGRemoteQuery *q) {
+    if (q->output)
+        q->output->query = NULL;
+    DelListItem(q, sg_queries);
+    safe_free(q->groupname);
+    safe_free(q->counts);
+    safe_free(q);
+}
+
+// Ask every other server for its local members of a group, their answers
+// are added to the listing o
+void sg_query_start(Client *client, SGOutput *o) {
+    SGRemoteQuery *q = sg_query_new(client);
+    const char *groupname = sg_groups[o->group].name;
+
+    if (!q)
+        return;
+
+    safe_strdup(q->groupname, groupname);
+    q->output = o;
+    o->query = q;
+    o->global = 1;
+    sg_output_line(client, o, "Asking %d other server%s for members of %s...", q->expected, q->expected == 1 ? "" : "s", groupname);
+    sendto_server(NULL, 0, 0, NULL, ":%s %s %u %s", me.id, MSG_SGQUERY, q->id, groupname);
+}
+
+// Ask every other server for its member counts, starting from our own
+void sg_stats_query_start(Client *client) {
+    SGRemoteQuery *q = sg_query_new(client);
+
+    if (!q)
+        return;
+
+    q->counts = safe_alloc(sizeof(int) * (sg_group_count + 1));
+    for (int g = 0; g < sg_group_count; g++)
+        q->counts[g] = sg_groups[g].members;
+
+    sendnotice(client, "Asking %d other server%s for member counts...", q->expected, q->expected == 1 ? "" : "s");
+    sendto_server(NULL, 0, 0, NULL, ":%s %s %u", me.id, MSG_SGSTATSQ, q->id);
+}
+
+static SGRemoteQuery *sg_query_find(unsigned int id) {
+    SGRemoteQuery *q;
+
+    for (q = sg_queries; q; q = q->next) {
+        if (q->id == id)
+            return q;
+    }
+    return NULL;
+}
+
+void sg_query_finish(SGRemoteQuery *q, int timed_out) {
+    Client *requester = hash_find_id(q->requester, NULL);
+
+    if (requester && q->counts) {
+        sendnotice(requester, "Network-wide security group member counts (%d of %d servers answered%s):",
+                   q->answered, q->expected, timed_out ? ", timed out" : "");
+        for (int g = 0; g < sg_group_count; g++)
+            sendnotice(requester, "- %s: %d", sg_groups[g].name, q->counts[g]);
+        if (q->unknown)
+            sendnotice(requester, "- %d remote group count%s for groups not configured here were skipped",
+                       q->unknown, q->unknown == 1 ? "" : "s");
+    } else if (q->output) {
+        // Goes out after the local members and the queued remote lines
+        SGOutput *o = q->output;
+        if (timed_out) {
+            sg_output_queue(o, "Network-wide query for %s timed out: %d of %d servers answered, %d remote members.",
+                            q->groupname, q->answered, q->expected, q->members);
+        } else {
+            sg_output_queue(o, "End of network-wide query for %s: %d servers answered, %d remote members.",
+                            q->groupname, q->answered, q->members);
+        }
+        sg_query_free(q);
+        sg_output_kick(o);
+        return;
+    }
+
+    sg_query_free(q);
+}
+
+EVENT(sg_query_timeout) {
+    SGRemoteQuery *q, *q_next;
+
+    for (q = sg_queries; q; q = q_next) {
+        q_next = q->next;
+        if (TStime() >= q->deadline)
+            sg_query_finish(q, 1);
+    }
+}
+
+// :<origin> SGQUERY <id> <group>
+// Pass it on, then answer from our own index with as few SGREPLY lines as possible.
+CMD_FUNC(cmd_sgquery) {
+    char buffer[SG_REPLY_PAYLOAD + NICKLEN + 2];
+    size_t len = 0;
+    int g, count = 0;
+
+    if (parc < 3 || BadPtr(parv[2]))
+        return;
+
+    sendto_server(client, 0, 0, NULL, ":%s %s %s %s", client->id, MSG_SGQUERY, parv[1], parv[2]);
+
+    g = sgindex_find(parv[2]);
+    if (g < 0) {
+        sendto_one(client, NULL, ":%s %s %s %s -1", me.id, MSG_SGEND, client->id, parv[1]);
+        return;
+    }
+
+    SGIndexGroup *group = &sg_groups[g];
+    Client *target;
+    int pos = 0;
+    while ((target = sgindex_next_member(group, &pos))) {
+        size_t nicklen = strlen(target->name);
+        if (len && len + 1 + nicklen > SG_REPLY_PAYLOAD) {
+            buffer[len] = '\0';
+            sendto_one(client, NULL, ":%s %s %s %s :%s", me.id, MSG_SGREPLY, client->id, parv[1], buffer);
+            len = 0;
+        }
+        if (len)
+            buffer[len++] = ' ';
+        memcpy(buffer + len, target->name, nicklen);
+        len += nicklen;
+        count++;
+    }
+
+    if (len) {
+        buffer[len] = '\0';
+        sendto_one(client, NULL, ":%s %s %s %s :%s", me.id, MSG_SGREPLY, client->id, parv[1], buffer);
+    }
+    sendto_one(client, NULL, ":%s %s %s %s %d", me.id, MSG_SGEND, client->id, parv[1], count);
+}
+
+// :<server> SGREPLY <origin> <id> :<nick> <nick> ...
+CMD_FUNC(cmd_sgreply) {
+    Client *origin, *requester;
+    SGRemoteQuery *q;
+    char buffer[MAX_BUFFER_SIZE];
+    size_t len = 0, room;
+
+    if (parc < 4 || BadPtr(parv[3]))
+        return;
+
+    origin = find_client(parv[1], NULL);
+    if (!origin || (!IsServer(origin) && !IsMe(origin)))
+        return;
+
+    if (!IsMe(origin)) {
+        sendto_one(origin, NULL, ":%s %s %s %s :%s", client->id, MSG_SGREPLY, parv[1], parv[2], parv[3]);
+        return;
+    }
+
+    q = sg_query_find(strtoul(parv[2], NULL, 10));
+    if (!q || !q->output)
+        return; // Already timed out
+
+    // The other server filled up to SG_REPLY_PAYLOAD without knowing our
+    // name or the requester's, so split the nicks again to fit
+    // ":<server> NOTICE <nick> :- [<remote server>] <nicks>\r\n" in one line
+    requester = hash_find_id(q->output->requester, NULL);
+    room = 510 - (strlen(me.name) + (requester ? strlen(requester->name) : NICKLEN) + 14) - (strlen(client->name) + 3);
+    if (room >= sizeof(buffer))
+        room = sizeof(buffer) - 1;
+
+    for (const char *p = parv[3]; *p; ) {
+        const char *nick;
+        size_t nicklen;
+
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            break;
+        nick = p;
+        while (*p && *p != ' ')
+            p++;
+        nicklen = p - nick;
+        if (nicklen > room)
+            nicklen = room;
+
+        if (len && len + 1 + nicklen > room) {
+            buffer[len] = '\0';
+            sg_reply_queue(q, client, buffer);
+            len = 0;
+        }
+        if (len)
+            buffer[len++] = ' ';
+        memcpy(buffer + len, nick, nicklen);
+        len += nicklen;
+        q->members++;
+    }
+    if (len) {
+        buffer[len] = '\0';
+        sg_reply_queue(q, client, buffer);
+    }
+    sg_output_kick(q->output);
+}
+
+// Through the listing, so it respects the sendq and stays inside the batch
+static void sg_reply_queue(SGRemoteQuery *q, Client *server, const char *nicks) {
+    if (q->output->queued >= SG_OUTPUT_MAX_QUEUED) {
+        q->output->dropped++;
+        return;
+    }
+    sg_output_queue(q->output, "- [%s] %s", server->name, nicks);
+}
+
+// :<server> SGEND <origin> <id> <count>, count is -1 if the group is unknown there
+CMD_FUNC(cmd_sgend) {
+    Client *origin;
+    SGRemoteQuery *q;
+
+    if (parc < 4)
+        return;
+
+    origin = find_client(parv[1], NULL);
+    if (!origin || (!IsServer(origin) && !IsMe(origin)))
+        return;
+
+    if (!IsMe(origin)) {
+        sendto_one(origin, NULL, ":%s %s %s %s %s", client->id, MSG_SGEND, parv[1], parv[2], parv[3]);
+        return;
+    }
+
+    q = sg_query_find(strtoul(parv[2], NULL, 10));
+    if (!q)
+        return;
+
+    if (q->output && atoi(parv[3]) < 0)
+        sg_output_queue(q->output, "- [%s] security group %s does not exist there", client->name, q->groupname);
+
+    q->answered++;
+    if (q->answered >= q->expected)
+        sg_query_finish(q, 0);
+}
+
+// :<origin> SGSTATSQ <id>
+// Pass it on, then answer with name=count pairs for all of our groups.
+CMD_FUNC(cmd_sgstatsq) {
+    char buffer[SG_REPLY_PAYLOAD + 64];
+    char pair[64];
+    size_t len = 0;
+
+    if (parc < 2 || BadPtr(parv[1]))
+        return;
+
+    sendto_server(client, 0, 0, NULL, ":%s %s %s", client->id, MSG_SGSTATSQ, parv[1]);
+
+    for (int g = 0; g < sg_group_count; g++) {
+        int pairlen = snprintf(pair, sizeof(pair), "%s=%d", sg_groups[g].name, sg_groups[g].members);
+        if (pairlen <= 0 || pairlen >= (int)sizeof(pair))
+            continue;
+
+        if (len && len + 1 + pairlen > SG_REPLY_PAYLOAD) {
+            buffer[len] = '\0';
+            sendto_one(client, NULL, ":%s %s %s %s :%s", me.id, MSG_SGSTATS, client->id, parv[1], buffer);
+            len = 0;
+        }
+        if (len)
+            buffer[len++] = ' ';
+        memcpy(buffer + len, pair, pairlen);
+        len += pairlen;
+    }
+
+    if (len) {
+        buffer[len] = '\0';
+        sendto_one(client, NULL, ":%s %s %s %s :%s", me.id, MSG_SGSTATS, client->id, parv[1], buffer);
+    }
+    sendto_one(client, NULL, ":%s %s %s %s %d", me.id, MSG_SGEND, client->id, parv[1], sg_group_count);
+}
+
+// :<server> SGSTATS <origin> <id> :<group>=<count> ...
+CMD_FUNC(cmd_sgstats) {
+    Client *origin;
+    SGRemoteQuery *q;
+    char buf[MAX_BUFFER_SIZE];
+    char *name, *p;
+
+    if (parc < 4 || BadPtr(parv[3]))
+        return;
+
+    origin = find_client(parv[1], NULL);
+    if (!origin || (!IsServer(origin) && !IsMe(origin)))
+        return;
+
+    if (!IsMe(origin)) {
+        sendto_one(origin, NULL, ":%s %s %s %s :%s", client->id, MSG_SGSTATS, parv[1], parv[2], parv[3]);
+        return;
+    }
+
+    q = sg_query_find(strtoul(parv[2], NULL, 10));
+    if (!q || !q->counts)
+        return;
+
+    strlcpy(buf, parv[3], sizeof(buf));
+    for (name = strtoken(&p, buf, " "); name; name = strtoken(&p, NULL, " ")) {
+        char *eq = strchr(name, '=');
+        if (!eq)
+            continue;
+        *eq = '\0';
+
+        int g = sgindex_find(name);
+        if (g < 0)
+            q->unknown++;
+        else
+            q->counts[g] += atoi(eq + 1);
+    }
+}
+
+// Number every configured security group and index all local users.
+// A rehash that adds or removes groups lands here once, not per client.
+void sgindex_build(void) {
+    SecurityGroup *s;
+    Client *client;
+    int g = 0;
+
+    sgindex_free();
+
+    for (s = securitygroups; s; s = s->next)
+        sg_group_count++;
+
+    if (!sg_group_count)
+        return;
+
+    sg_groups = safe_alloc(sizeof(SGIndexGroup) * sg_group_count);
+    for (s = securitygroups; s; s = s->next, g++) {
+        safe_strdup(sg_groups[g].name, s->name);
+        sg_groups[g].sg = s;
+        sg_groups[g].epoch = getrandom32();
+    }
+
+    list_for_each_entry(client, &lclient_list, lclient_node) {
+        if (MyUser(client))
+            sgindex_update_client(client);
+    }
+}
+
+// Drop the whole index, including the per-client slot arrays
+void sgindex_free(void) {
+    Client *client;
+
+    // Listings point into the slot arrays, they can't survive a rebuild
+    while (sg_outputs)
+        sg_output_done(sg_outputs, "security group index was rebuilt");
+
+    list_for_each_entry(client, &lclient_list, lclient_node) {
+        SGClientIndex *idx = SGINDEX(client);
+        if (idx) {
+            safe_free(idx->slot);
+            safe_free(idx->bits);
+            safe_free(idx);
+            moddata_local_client(client, sgindex_md).ptr = NULL;
+            moddata_local_client(client, sgbits_md).ptr = NULL;
+        }
+    }
+
+    for (int g = 0; g < sg_group_count; g++) {
+        safe_free(sg_groups[g].name);
+        safe_free(sg_groups[g].slots);
+    }
+    safe_free(sg_groups);
+    sg_group_count = 0;
+}
+
+// Next live member at or after *pos, which is moved past it. This is the
+// one way members are walked, shared by /SG, SGQUERY and the RPC calls.
+Client *sgindex_next_member(SGIndexGroup *group, int *pos) {
+    while (*pos < group->used) {
+        Client *client = group->slots[(*pos)++];
+        if (client)
+            return client;
+    }
+    return NULL;
+}
+
+int sgindex_find(const char *groupname) {
+    for (int g = 0; g < sg_group_count; g++) {
+        if (!strcasecmp(sg_groups[g].name, groupname))
+            return g;
+    }
+    return -1;
+}
+
+// Squeeze the tombstones out of a group and fix up the moved clients' slots
+static void sgindex_compact(int g) {
+    SGIndexGroup *group = &sg_groups[g];
+    int n = 0;
+
+    for (int i = 0; i < group->used; i++) {
+        Client *client = group->slots[i];
+        if (!client)
+            continue;
+        group->slots[n] = client;
+        SGINDEX(client)->slot[g] = n;
+        n++;
+    }
+    group->used = n;
+    group->epoch++;
+}
+
+static void sgindex_add(int g, Client *client, SGClientIndex *idx) {
+    SGIndexGroup *group = &sg_groups[g];
+
+    if (group->used == group->size) {
+        group->size = group->size ? group->size * 2 : 64;
+        group->slots = realloc(group->slots, sizeof(Client *) * group->size);
+        if (!group->slots)
+            outofmemory(sizeof(Client *) * group->size);
+    }
+    idx->slot[g] = group->used;
+    idx->bits[g / 32] |= 1U << (g % 32);
+    group->slots[group->used++] = client;
+    group->members++;
+}
+
+// Compact only when nobody is walking the slots and it is worth it
+static void sgindex_maybe_compact(int g) {
+    SGIndexGroup *group = &sg_groups[g];
+    int tombstones = group->used - group->members;
+
+    if (!group->busy && tombstones > SG_COMPACT_MIN && tombstones > group->members)
+        sgindex_compact(g);
+}
+
+static void sgindex_del(int g, SGClientIndex *idx) {
+    SGIndexGroup *group = &sg_groups[g];
+
+    group->slots[idx->slot[g]] = NULL;
+    idx->slot[g] = -1;
+    idx->bits[g / 32] &= ~(1U << (g % 32));
+    group->members--;
+
+    // Trailing tombstones can simply be dropped
+    while (group->used > 0 && !group->slots[group->used - 1])
+        group->used--;
+
+    sgindex_maybe_compact(g);
+}
+
+// Re-evaluate every security group for this client and move it in or out
+void sgindex_update_client(Client *client) {
+    SGClientIndex *idx;
+
+    if (!MyUser(client) || !sg_group_count)
+        return;
+
+    uint64_t started = modstat_now();
+    idx = SGINDEX(client);
+    if (!idx) {
+        idx = safe_alloc(sizeof(SGClientIndex));
+        idx->slot = safe_alloc(sizeof(int) * sg_group_count);
+        for (int g = 0; g < sg_group_count; g++)
+            idx->slot[g] = -1;
+        idx->bits = safe_alloc(sizeof(uint32_t) * SG_BITMAP_WORDS(sg_group_count));
+        moddata_local_client(client, sgindex_md).ptr = idx;
+        moddata_local_client(client, sgbits_md).ptr = idx->bits;
+    }
+
+    for (int g = 0; g < sg_group_count; g++) {
+        int member = user_allowed_by_security_group(client, sg_groups[g].sg);
+        if (member && idx->slot[g] < 0)
+            sgindex_add(g, client, idx);
+        else if (!member && idx->slot[g] >= 0)
+            sgindex_del(g, idx);
+    }
+    idx->resync_round = sg_resync_round;
+    modstat_record(&modstats->index_update, started);
+}
+
+void sgindex_remove_client(Client *client) {
+    SGClientIndex *idx = SGINDEX(client);
+
+    if (!idx)
+        return;
+
+    for (int g = 0; g < sg_group_count; g++) {
+        if (idx->slot[g] >= 0)
+            sgindex_del(g, idx);
+    }
+    safe_free(idx->slot);
+    safe_free(idx->bits);
+    safe_free(idx);
+    moddata_local_client(client, sgindex_md).ptr = NULL;
+    moddata_local_client(client, sgbits_md).ptr = NULL;
+}
+
+void sgindex_md_free(ModData *m) {
+    SGClientIndex *idx = m->ptr;
+
+    // Normally already gone through sgindex_remove_client() on quit
+    if (idx) {
+        safe_free(idx->slot);
+        safe_free(idx->bits);
+        safe_free(idx);
+        m->ptr = NULL;
+    }
+}
+
+void sgbits_md_free(ModData *m) {
+    // The bitmap is owned by the SGClientIndex, this is only a view on it
+    m->ptr = NULL;
+}
+
+// Start a new round, sgindex_resync_step() does the work
+EVENT(sgindex_resync) {
+    sg_resync_round++;
+    sg_resync_active = 1;
+}
+
+// Re-evaluate the next SG_RESYNC_BATCH clients that were not updated in
+// this round yet. Clients that connect or quit in between need no special
+// care: anything updated by a hook already counts for the round.
+EVENT(sgindex_resync_step) {
+    Client *client;
+    int done = 0;
+
+    if (!sg_resync_active)
+        return;
+    if (!sg_group_count) {
+        sg_resync_active = 0;
+        return;
+    }
+
+    uint64_t started = modstat_now();
+    list_for_each_entry(client, &lclient_list, lclient_node) {
+        SGClientIndex *idx = MyUser(client) ? SGINDEX(client) : NULL;
+
+        if (!MyUser(client) || (idx && idx->resync_round == sg_resync_round))
+            continue;
+        if (done++ == SG_RESYNC_BATCH)
+            break;
+        sgindex_update_client(client);
+    }
+    if (done <= SG_RESYNC_BATCH)
+        sg_resync_active = 0;
+    modstat_record(&modstats->resync, started);
+}
+
+// /STATS modstats
+int listsg_stats(Client *client, const char *flag) {
+    if (strcasecmp(flag, "modstats") || !IsOper(client))
+        return 0;
+
+    modstat_report(client, "sg", &modstats->sg);
+    modstat_report(client, "sg_user", &modstats->sg_user);
+    modstat_report(client, "index_update", &modstats->index_update);
+    modstat_report(client, "resync", &modstats->resync);
+    return 0;
+}
+
+RPC_CALL_FUNC(rpc_modstats_listsg) {
+    json_t *result = json_object();
+    json_t *stats = json_object();
+
+    json_object_set_new(result, "module", json_string_unreal(MOD_HEADER.name));
+    json_object_set_new(result, "since", json_integer(modstats->since));
+    json_object_set_new(stats, "sg", modstat_json(&modstats->sg));
+    json_object_set_new(stats, "sg_user", modstat_json(&modstats->sg_user));
+    json_object_set_new(stats, "index_update", modstat_json(&modstats->index_update));
+    json_object_set_new(stats, "resync", modstat_json(&modstats->resync));
+    json_object_set_new(result, "stats", stats);
+
+    rpc_response(client, request, result);
+    json_decref(result);
+}
+
+int sgindex_connect(Client *client) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_quit(Client *client, MessageTag *mtags, const char *comment) {
+    sgindex_remove_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_nickchange(Client *client, MessageTag *mtags, const char *oldnick) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+// Also runs on logout, with the account set back to "0"
+int sgindex_account_login(Client *client, MessageTag *mtags) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_oper(Client *client, int add, const char *oper_block, const char *operclass) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_umode_change(Client *client, long setflags, long newflags) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_userhost_change(Client *client, const char *olduser, const char *oldhost) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_ip_change(Client *client, const char *oldip) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
+}
+
+int sgindex_realname_change(Client *client, const char *oldinfo) {
+    sgindex_update_client(client);
+    return HOOK_CONTINUE;
 }
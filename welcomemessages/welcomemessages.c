@@ -21,59 +21,354 @@ module
 */
 
 #include "unrealircd.h"
+#include <jansson.h>
 #define MYCONF "channel-welcome"
+#define MYCONF_SETTINGS "channel-welcome-settings"
 #define MAX_WELCOME_MSG 512 // Define the maximum length for the welcome message
 
-// Structure to hold channel-specific messages
+// Welcomes set with /WELCOME are kept here and written out in batches
+#define WELCOMEDB_FILE "welcomemessages.db"
+#define WELCOMEDB_MAGIC 0x57454C43
+#define WELCOMEDB_VERSION 1
+#define WELCOMEDB_SAVE_EVERY 60000 // msec
+#define RUNTIME_HASH_SIZE 1024
+
+// A welcome line compiled into literal text and per-join variables
+typedef enum {
+	SEG_LITERAL,
+	SEG_NICK,
+	SEG_CHANNEL,
+	SEG_USERCOUNT,
+	SEG_TOPIC,
+	SEG_ACCOUNT,
+} SegmentType;
+
 typedef struct {
-	char channel[CHANNELLEN + 1];
-	char message[MAX_WELCOME_MSG];
+	SegmentType type;
+	const char *text; // SEG_LITERAL only, not NUL terminated
+	size_t len;
+} Segment;
+
+typedef struct {
+	Segment *segs;
+	int count;
+} WelcomeTemplate;
+
+// Structure to hold channel-specific messages. The channel is an offset
+// into string_pool, the lines are a range of welcome_lines.
+typedef struct {
+	unsigned int channel;
+	unsigned int first_line;
+	unsigned int line_count;
 } ChannelMessage;
 
 // Global array of ChannelMessage structures
 ChannelMessage *channel_messages = NULL;
 int channel_count = 0;
 
+// All channel patterns and messages, back to back, sized to fit exactly
+static char *string_pool = NULL;
+
+// Compiled lines of all messages and the segments they point to.
+// Literal segments point into string_pool, which never moves once built.
+static WelcomeTemplate *welcome_lines = NULL;
+static Segment *welcome_segments = NULL;
+
+#define CM_CHANNEL(i) (string_pool + channel_messages[i].channel)
+
+// Welcome set at runtime with /WELCOME, takes precedence over the config.
+// The text is only compiled into a template when a channel first needs it.
+typedef struct RuntimeWelcome RuntimeWelcome;
+struct RuntimeWelcome {
+	RuntimeWelcome *next;
+	char channel[CHANNELLEN + 1];
+	char *text;
+	Segment *segs; // NULL until compiled
+	WelcomeTemplate line;
+};
+
+static RuntimeWelcome *runtime_welcomes[RUNTIME_HASH_SIZE];
+static char runtime_hashkey[SIPHASH_KEY_LENGTH];
+static int runtime_dirty = 0;
+static int runtime_count = 0;
+static int welcomedb_disabled = 0; // set when an unreadable database could not be moved aside
+
+// Resolved welcome for a channel, kept in channel ModData. It is only
+// trusted if it was resolved in the current generation.
+typedef struct {
+	int generation;
+	const WelcomeTemplate *lines; // NULL for no welcome
+	int line_count;
+} WelcomeCache;
+
+ModDataInfo *welcome_md = NULL;
+static int welcome_generation = 0;
+
+// channel-welcome-settings block
+typedef struct {
+	char *database;         // where /WELCOME changes are stored
+	long suppress_window;   // seconds, 0 disables duplicate suppression
+	int suppress_entries;   // size of the recently-welcomed table
+	int max_per_second;     // global budget, 0 for unlimited
+	int max_runtime;        // how many /WELCOME entries may exist
+} WelcomeSettings;
+
+static WelcomeSettings settings;
+
+// Recently welcomed (identity, channel) pairs. Direct mapped: a colliding
+// pair simply replaces the older one, so memory stays at suppress_entries
+// slots and the worst case is an extra welcome, never a missing one.
+typedef struct {
+	uint64_t key;
+	time_t when;
+} RecentWelcome;
+
+static RecentWelcome *recent = NULL;
+static unsigned int recent_mask = 0;
+static char recent_hashkey[SIPHASH_KEY_LENGTH];
+
+static time_t budget_second = 0;
+static int budget_used = 0;
+
+// Compiled form of the channel patterns, built once per config load.
+// Exact names go into a case-insensitive hash table, wildcard patterns
+// hang off a trie node keyed on their literal prefix (before the first
+// wildcard). A lookup only runs match_simple on patterns whose prefix
+// is a prefix of the channel name, and the lowest config index wins.
+typedef struct {
+	unsigned char c;
+	int child;    // first child node, -1 if none
+	int sibling;  // next node with the same parent, -1 if none
+	int patterns; // first pattern whose prefix ends here, -1 if none
+} PrefixNode;
+
+static int *exact_buckets = NULL;  // head of chain per bucket, -1 if empty
+static int *exact_next = NULL;     // next entry in the same chain
+static unsigned int exact_mask = 0;
+static char exact_hashkey[SIPHASH_KEY_LENGTH];
+
+static PrefixNode *prefix_nodes = NULL;
+static int prefix_node_count = 0;
+static int prefix_node_size = 0;
+static int *pattern_next = NULL;   // next pattern on the same node, in config order
+
 // Function declarations
 void setcfg(void);
 void freecfg(void);
 int m_channelwelcome_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int m_channelwelcome_configposttest(int *errs);
 int m_channelwelcome_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
+int m_channelwelcome_settings_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int m_channelwelcome_settings_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
+CMD_FUNC(cmd_welcomestats);
+CMD_FUNC(cmd_welcome);
+RuntimeWelcome *runtime_find(const char *channel);
+void runtime_set(const char *channel, const char *text);
+void runtime_free_all(void);
+int welcomedb_read(void);
+int welcomedb_write(void);
+EVENT(welcomedb_save);
 int custom_join(Client *sptr, Channel *chptr, MessageTag *mtags);
+static void welcome_on_join(Client *sptr, Channel *chptr);
+void matcher_build(void);
+void matcher_free(void);
+int matcher_lookup(const char *name);
+int template_parse(const char *text, Segment *out);
+static void welcome_resolve(Channel *channel, WelcomeCache *wc);
+void template_send(Client *client, Channel *channel, const WelcomeTemplate *lines, int count);
+void welcome_cache_free(ModData *m);
+int welcomemessages_stats(Client *client, const char *flag);
+RPC_CALL_FUNC(rpc_modstats_welcomemessages);
 
 // Dat dere module header
 ModuleHeader MOD_HEADER = {
 	"third/welcomemessages", // Module name
-	"1.0.1", // Version
+	"1.1.0", // Version
 	"Sends custom welcome messages for different channels", // Description
 	"reverse", // Author
 	"unrealircd-6", // Modversion
 };
 
+// How long joins spend on welcomes, as call counts and log2 histograms of
+// nanoseconds. Shown in /STATS modstats and the modstats.welcomemessages
+// RPC call, next to the sent/suppressed counters.
+#define MODSTAT_BUCKETS 40
+
+typedef struct {
+	unsigned long long calls;
+	unsigned long long total_ns;
+	unsigned long long hist[MODSTAT_BUCKETS]; // bucket b: calls that took [2^b, 2^(b+1)) ns
+} ModStat;
+
+static inline uint64_t modstat_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void modstat_record(ModStat *m, uint64_t start) {
+	uint64_t ns = modstat_now() - start;
+	int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	if (b >= MODSTAT_BUCKETS)
+		b = MODSTAT_BUCKETS - 1;
+	m->calls++;
+	m->total_ns += ns;
+	m->hist[b]++;
+}
+
+// Upper bound of the bucket that holds the given percentile
+static uint64_t modstat_percentile(const ModStat *m, int pct) {
+	unsigned long long want = (m->calls * pct + 99) / 100, seen = 0;
+
+	for (int b = 0; b < MODSTAT_BUCKETS; b++) {
+		seen += m->hist[b];
+		if (seen && seen >= want)
+			return 2ULL << b;
+	}
+	return 0;
+}
+
+static void modstat_report(Client *client, const char *name, const ModStat *m) {
+	sendtxtnumeric(client, "%s %s: calls=%llu avg=%lluns p50<%lluns p99<%lluns",
+				   MOD_HEADER.name, name, m->calls,
+				   m->calls ? m->total_ns / m->calls : 0ULL,
+				   (unsigned long long)modstat_percentile(m, 50),
+				   (unsigned long long)modstat_percentile(m, 99));
+}
+
+static json_t *modstat_json(const ModStat *m) {
+	json_t *j = json_object();
+	json_t *hist = json_array();
+
+	json_object_set_new(j, "calls", json_integer(m->calls));
+	json_object_set_new(j, "total_ns", json_integer(m->total_ns));
+	json_object_set_new(j, "p50_ns", json_integer(modstat_percentile(m, 50)));
+	json_object_set_new(j, "p99_ns", json_integer(modstat_percentile(m, 99)));
+	for (int b = 0; b < MODSTAT_BUCKETS; b++)
+		json_array_append_new(hist, json_integer(m->hist[b]));
+	json_object_set_new(j, "histogram_log2_ns", hist);
+	return j;
+}
+
+// Like welcome_generation this is kept over a rehash; size catches an
+// upgrade that changed the layout.
+typedef struct {
+	size_t size;
+	time_t since;
+	ModStat join;
+	ModStat resolve;
+	unsigned long welcomes_sent;
+	unsigned long welcomes_duplicate;
+	unsigned long welcomes_over_budget;
+} ModStats;
+
+static ModStats *modstats = NULL;
+
+static void modstats_free(ModData *m) {
+	safe_free(m->ptr);
+}
+
 // Configuration testing-related hooks
 MOD_TEST() {
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, m_channelwelcome_configtest);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, m_channelwelcome_settings_configtest);
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGPOSTTEST, 0, m_channelwelcome_configposttest);
 	return MOD_SUCCESS;
 }
 
 // Initialisation routine (register hooks, commands and modes or create structs etc)
 MOD_INIT() {
+	ModDataInfo mreq;
+
 	MARK_AS_GLOBAL_MODULE(modinfo);
+
+	// Every load is a new generation. We get reloaded on each rehash, so
+	// whatever channels cached before is ignored from here on.
+	LoadPersistentInt(modinfo, welcome_generation);
+	welcome_generation++;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "welcomemessages_cache";
+	mreq.type = MODDATATYPE_CHANNEL;
+	mreq.free = welcome_cache_free;
+	welcome_md = ModDataAdd(modinfo->handle, mreq);
+	if (!welcome_md) {
+		config_error("[welcomemessages] failed adding moddata");
+		return MOD_FAILED;
+	}
+
 	setcfg();
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, m_channelwelcome_configrun);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, m_channelwelcome_settings_configrun);
 	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_JOIN, 0, custom_join);
+	CommandAdd(modinfo->handle, "WELCOMESTATS", cmd_welcomestats, 0, CMD_USER);
+	CommandAdd(modinfo->handle, "WELCOME", cmd_welcome, 2, CMD_USER);
+	HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, welcomemessages_stats);
+
+	RPCHandlerInfo r;
+	memset(&r, 0, sizeof(r));
+	r.method = "modstats.welcomemessages";
+	r.loglevel = ULOG_DEBUG;
+	r.call = rpc_modstats_welcomemessages;
+	if (!RPCHandlerAdd(modinfo->handle, &r)) {
+		config_error("[welcomemessages] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+	LoadPersistentPointer(modinfo, modstats, modstats_free);
+	if (modstats && modstats->size != sizeof(ModStats))
+		safe_free(modstats);
+	if (!modstats) {
+		modstats = safe_alloc(sizeof(ModStats));
+		modstats->size = sizeof(ModStats);
+		modstats->since = TStime();
+	}
 	return MOD_SUCCESS;
 }
 
 MOD_LOAD() {
+	// Settings are known by now, size the recently-welcomed table
+	if (settings.suppress_window > 0) {
+		unsigned int size = 1024;
+		while (size < (unsigned int)settings.suppress_entries)
+			size <<= 1;
+		recent = safe_alloc(sizeof(RecentWelcome) * size);
+		recent_mask = size - 1;
+		siphash_generate_key(recent_hashkey);
+	}
+
+	siphash_generate_key(runtime_hashkey);
+	if (!settings.database)
+		safe_strdup(settings.database, WELCOMEDB_FILE);
+	convert_to_absolute_path(&settings.database, PERMDATADIR);
+	if (!welcomedb_read()) {
+		// Same as the core databases: keep the bad file aside and start empty
+		char fname[512];
+		snprintf(fname, sizeof(fname), "%s.corrupt", settings.database);
+		if (rename(settings.database, fname) == 0) {
+			config_warn("[welcomemessages] Could not read %s, renamed it to %s and starting with no runtime welcomes",
+			            settings.database, fname);
+		} else {
+			config_warn("[welcomemessages] Could not read %s and could not rename it to %s: %s. Changes made with /WELCOME will not be saved.",
+			            settings.database, fname, strerror(errno));
+			welcomedb_disabled = 1;
+		}
+	}
+	EventAdd(modinfo->handle, "welcomedb_save", welcomedb_save, NULL, WELCOMEDB_SAVE_EVERY, 0);
 	return MOD_SUCCESS; // We good
 }
 
 // Called on unload/rehash
 MOD_UNLOAD() {
+	SavePersistentPointer(modinfo, modstats);
+	SavePersistentInt(modinfo, welcome_generation);
+	if (runtime_dirty)
+		welcomedb_write();
+	runtime_free_all();
 	freecfg();
+	safe_free(recent);
+	recent_mask = 0;
+	safe_free(settings.database);
 	return MOD_SUCCESS; // We good
 }
 
@@ -82,14 +377,23 @@ void setcfg(void) {
 	// Initialize with no channels
 	channel_messages = NULL;
 	channel_count = 0;
+
+	settings.suppress_window = 0; // off unless configured
+	settings.suppress_entries = 65536;
+	settings.max_per_second = 0;
+	settings.max_runtime = 1000;
 }
 
 // Free allocated memory on unload/reload
 void freecfg(void) {
+	matcher_free();
 	if (channel_messages) {
 		free(channel_messages);
 		channel_messages = NULL;
 	}
+	safe_free(string_pool);
+	safe_free(welcome_lines);
+	safe_free(welcome_segments);
 	channel_count = 0;
 }
 
@@ -108,7 +412,8 @@ int m_channelwelcome_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *
 		return 0;
 
 	for (cep = ce->items; cep; cep = cep->next) {
-		if (!cep->name || !cep->value) {
+		// Either "#chan" "message"; or "#chan" { "line 1"; "line 2"; };
+		if (!cep->name || (!cep->value && !cep->items)) {
 			config_error("%s:%i: invalid %s entry", cep->file->filename, cep->line_number, MYCONF);
 			errors++;
 			continue;
@@ -120,11 +425,72 @@ int m_channelwelcome_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *
 			continue;
 		}
 
-		if (strlen(cep->value) >= MAX_WELCOME_MSG) {
+		if (cep->value && strlen(cep->value) >= MAX_WELCOME_MSG) {
 			config_error("%s:%i: welcome message too long, maximum length is %d characters", cep->file->filename, cep->line_number, MAX_WELCOME_MSG);
 			errors++;
 			continue;
 		}
+
+		for (ConfigEntry *cepp = cep->value ? NULL : cep->items; cepp; cepp = cepp->next) {
+			if (strlen(cepp->name) >= MAX_WELCOME_MSG) {
+				config_error("%s:%i: welcome message too long, maximum length is %d characters", cepp->file->filename, cepp->line_number, MAX_WELCOME_MSG);
+				errors++;
+			}
+		}
+	}
+
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+// Configuration test for channel-welcome-settings
+int m_channelwelcome_settings_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs) {
+	int errors = 0;
+	ConfigEntry *cep;
+
+	if (type != CONFIG_MAIN)
+		return 0;
+
+	if (!ce || !ce->name)
+		return 0;
+
+	if (strcmp(ce->name, MYCONF_SETTINGS))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next) {
+		if (!cep->name || !cep->value) {
+			config_error("%s:%i: invalid %s entry", cep->file->filename, cep->line_number, MYCONF_SETTINGS);
+			errors++;
+			continue;
+		}
+
+		if (!strcmp(cep->name, "suppress-window")) {
+			if (config_checkval(cep->value, CFG_TIME) < 0) {
+				config_error("%s:%i: %s::suppress-window must be a time value, eg 5m", cep->file->filename, cep->line_number, MYCONF_SETTINGS);
+				errors++;
+			}
+		} else if (!strcmp(cep->name, "suppress-entries")) {
+			int v = atoi(cep->value);
+			if (v < 1024 || v > 16777216) {
+				config_error("%s:%i: %s::suppress-entries must be between 1024 and 16777216", cep->file->filename, cep->line_number, MYCONF_SETTINGS);
+				errors++;
+			}
+		} else if (!strcmp(cep->name, "database")) {
+			// Any path will do, relative ones end up in the data directory
+		} else if (!strcmp(cep->name, "max-runtime-welcomes")) {
+			if (atoi(cep->value) < 0) {
+				config_error("%s:%i: %s::max-runtime-welcomes can't be negative", cep->file->filename, cep->line_number, MYCONF_SETTINGS);
+				errors++;
+			}
+		} else if (!strcmp(cep->name, "max-per-second")) {
+			if (atoi(cep->value) < 0) {
+				config_error("%s:%i: %s::max-per-second can't be negative", cep->file->filename, cep->line_number, MYCONF_SETTINGS);
+				errors++;
+			}
+		} else {
+			config_error("%s:%i: unknown directive %s::%s", cep->file->filename, cep->line_number, MYCONF_SETTINGS, cep->name);
+			errors++;
+		}
 	}
 
 	*errs = errors;
@@ -151,31 +517,691 @@ int m_channelwelcome_configrun(ConfigFile *cf, ConfigEntry *ce, int type) {
 
 	freecfg();
 
-	for (cep = ce->items; cep; cep = cep->next)
+	// First pass sizes everything exactly, second pass fills it in
+	size_t pool_size = 0;
+	int line_count = 0, segment_count = 0;
+	for (cep = ce->items; cep; cep = cep->next) {
 		channel_count++;
+		pool_size += strlen(cep->name) + 1;
+		if (cep->value) {
+			pool_size += strlen(cep->value) + 1;
+			segment_count += template_parse(cep->value, NULL);
+			line_count++;
+		}
+		for (ConfigEntry *cepp = cep->value ? NULL : cep->items; cepp; cepp = cepp->next) {
+			pool_size += strlen(cepp->name) + 1;
+			segment_count += template_parse(cepp->name, NULL);
+			line_count++;
+		}
+	}
 
-	channel_messages = malloc(sizeof(ChannelMessage) * channel_count);
+	channel_messages = safe_alloc(sizeof(ChannelMessage) * channel_count);
+	string_pool = safe_alloc(pool_size);
+	welcome_lines = safe_alloc(sizeof(WelcomeTemplate) * (line_count + 1));
+	welcome_segments = safe_alloc(sizeof(Segment) * (segment_count + 1));
 
-	int i = 0;
+	int i = 0, line = 0, seg = 0;
+	size_t pos = 0;
 	for (cep = ce->items; cep; cep = cep->next) {
-		strlcpy(channel_messages[i].channel, cep->name, CHANNELLEN + 1);
-		strlcpy(channel_messages[i].message, cep->value, MAX_WELCOME_MSG);
+		channel_messages[i].channel = pos;
+		pos += strlcpy(string_pool + pos, cep->name, pool_size - pos) + 1;
+		channel_messages[i].first_line = line;
+
+		ConfigEntry single = { 0 };
+		ConfigEntry *cepp = cep->items;
+		if (cep->value) {
+			single.name = cep->value;
+			cepp = &single;
+		}
+		for (; cepp; cepp = cepp->next) {
+			char *text = string_pool + pos;
+			pos += strlcpy(text, cepp->name, pool_size - pos) + 1;
+			welcome_lines[line].segs = &welcome_segments[seg];
+			welcome_lines[line].count = template_parse(text, welcome_lines[line].segs);
+			seg += welcome_lines[line].count;
+			line++;
+		}
+		channel_messages[i].line_count = line - channel_messages[i].first_line;
 		i++;
 	}
 
+	matcher_build();
+	return 1; // We good
+}
+
+// Run the configuration for channel-welcome-settings
+int m_channelwelcome_settings_configrun(ConfigFile *cf, ConfigEntry *ce, int type) {
+	ConfigEntry *cep;
+
+	if (type != CONFIG_MAIN)
+		return 0;
+
+	if (!ce || !ce->name)
+		return 0;
+
+	if (strcmp(ce->name, MYCONF_SETTINGS))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next) {
+		if (!strcmp(cep->name, "suppress-window"))
+			settings.suppress_window = config_checkval(cep->value, CFG_TIME);
+		else if (!strcmp(cep->name, "suppress-entries"))
+			settings.suppress_entries = atoi(cep->value);
+		else if (!strcmp(cep->name, "max-per-second"))
+			settings.max_per_second = atoi(cep->value);
+		else if (!strcmp(cep->name, "max-runtime-welcomes"))
+			settings.max_runtime = atoi(cep->value);
+		else if (!strcmp(cep->name, "database"))
+			safe_strdup(settings.database, cep->value);
+	}
+
 	return 1; // We good
 }
 
+// The recently-welcomed slot for this user and channel, NULL if suppression
+// is off. The slot holds this pair if its key equals *key.
+static RecentWelcome *recent_slot(Client *client, Channel *channel, uint64_t *key) {
+	char buf[256];
+	const char *identity;
+
+	if (!recent)
+		return NULL;
+
+	// Key on the account when there is one, so a reconnect from another IP still counts
+	if (IsLoggedIn(client))
+		identity = client->user->account;
+	else
+		identity = client->ip ? client->ip : "";
+	snprintf(buf, sizeof(buf), "%s %s", identity, channel->name);
+
+	*key = siphash_nocase(buf, recent_hashkey);
+	return &recent[*key & recent_mask];
+}
+
+// Take one notice from this second's global budget, 0 if it is used up
+static int welcome_budget_take(void) {
+	time_t now = TStime();
+
+	if (!settings.max_per_second)
+		return 1;
+
+	if (now != budget_second) {
+		budget_second = now;
+		budget_used = 0;
+	}
+	if (budget_used >= settings.max_per_second)
+		return 0;
+	budget_used++;
+	return 1;
+}
+
+// /WELCOMESTATS: how many welcomes went out and how many were held back
+CMD_FUNC(cmd_welcomestats) {
+	if (!IsOper(client)) {
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return;
+	}
+
+	sendnotice(client, "Welcome messages sent: %lu", modstats->welcomes_sent);
+	sendnotice(client, "Suppressed as duplicate: %lu", modstats->welcomes_duplicate);
+	sendnotice(client, "Suppressed by max-per-second: %lu", modstats->welcomes_over_budget);
+}
+
+// /STATS modstats
+int welcomemessages_stats(Client *client, const char *flag) {
+	if (strcasecmp(flag, "modstats") || !IsOper(client))
+		return 0;
+
+	modstat_report(client, "join", &modstats->join);
+	modstat_report(client, "resolve", &modstats->resolve);
+	sendtxtnumeric(client, "%s sent=%lu duplicate=%lu over_budget=%lu",
+		MOD_HEADER.name, modstats->welcomes_sent, modstats->welcomes_duplicate, modstats->welcomes_over_budget);
+	return 0;
+}
+
+RPC_CALL_FUNC(rpc_modstats_welcomemessages) {
+	json_t *result = json_object();
+	json_t *stats = json_object();
+
+	json_object_set_new(result, "module", json_string_unreal(MOD_HEADER.name));
+	json_object_set_new(result, "since", json_integer(modstats->since));
+	json_object_set_new(stats, "join", modstat_json(&modstats->join));
+	json_object_set_new(stats, "resolve", modstat_json(&modstats->resolve));
+	json_object_set_new(result, "stats", stats);
+	json_object_set_new(result, "welcomes_sent", json_integer(modstats->welcomes_sent));
+	json_object_set_new(result, "welcomes_duplicate", json_integer(modstats->welcomes_duplicate));
+	json_object_set_new(result, "welcomes_over_budget", json_integer(modstats->welcomes_over_budget));
+
+	rpc_response(client, request, result);
+	json_decref(result);
+}
+
 // Send custom message on join
 int custom_join(Client *sptr, Channel *chptr, MessageTag *mtags) {
 	if (!IsUser(sptr))
 		return HOOK_CONTINUE;
 
-	for (int i = 0; i < channel_count; i++) {
-		if (match_simple(channel_messages[i].channel, chptr->name)) {
-			sendnotice(sptr, "%s", channel_messages[i].message);  // Use format string properly
+	uint64_t started = modstat_now();
+	welcome_on_join(sptr, chptr);
+	modstat_record(&modstats->join, started);
+	return HOOK_CONTINUE;
+}
+
+static void welcome_on_join(Client *sptr, Channel *chptr) {
+	WelcomeCache *wc = moddata_channel(chptr, welcome_md).ptr;
+	if (!wc) {
+		wc = safe_alloc(sizeof(WelcomeCache));
+		moddata_channel(chptr, welcome_md).ptr = wc;
+	}
+
+	// Resolve at most once per channel per generation
+	if (wc->generation != welcome_generation) {
+		uint64_t started = modstat_now();
+		welcome_resolve(chptr, wc);
+		modstat_record(&modstats->resolve, started);
+	}
+
+	if (!wc->lines)
+		return;
+
+	uint64_t key = 0;
+	RecentWelcome *recently = recent_slot(sptr, chptr, &key);
+	if (recently && recently->key == key && TStime() - recently->when < settings.suppress_window) {
+		modstats->welcomes_duplicate++;
+		return;
+	}
+
+	// Only remember the welcome once it is actually sent
+	if (!welcome_budget_take()) {
+		modstats->welcomes_over_budget++;
+		return;
+	}
+	if (recently) {
+		recently->key = key;
+		recently->when = TStime();
+	}
+
+	template_send(sptr, chptr, wc->lines, wc->line_count);
+	modstats->welcomes_sent++;
+}
+
+// Work out which welcome applies to a channel: a runtime one if set,
+// otherwise the first matching config entry
+static void welcome_resolve(Channel *channel, WelcomeCache *wc) {
+	RuntimeWelcome *rw = runtime_find(channel->name);
+
+	wc->lines = NULL;
+	wc->line_count = 0;
+	wc->generation = welcome_generation;
+
+	if (rw) {
+		if (!rw->segs) {
+			rw->segs = safe_alloc(sizeof(Segment) * (template_parse(rw->text, NULL) + 1));
+			rw->line.segs = rw->segs;
+			rw->line.count = template_parse(rw->text, rw->segs);
+		}
+		wc->lines = &rw->line;
+		wc->line_count = 1;
+		return;
+	}
+
+	int i = matcher_lookup(channel->name);
+	if (i >= 0) {
+		wc->lines = &welcome_lines[channel_messages[i].first_line];
+		wc->line_count = channel_messages[i].line_count;
+	}
+}
+
+// Make the next join on this channel resolve its welcome again
+static void welcome_invalidate(const char *name) {
+	Channel *channel = find_channel(name);
+	WelcomeCache *wc;
+
+	if (channel && (wc = moddata_channel(channel, welcome_md).ptr))
+		wc->generation = 0;
+}
+
+// /WELCOME <#channel> [<message>|-]
+CMD_FUNC(cmd_welcome) {
+	RuntimeWelcome *rw;
+
+	if (!MyUser(client))
+		return;
+
+	// Runtime welcomes are not sent to other servers, so this is an oper
+	// command: a chanop would only change the welcome on their own server
+	if (!IsOper(client)) {
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return;
+	}
+
+	if (parc < 2 || BadPtr(parv[1])) {
+		sendnotice(client, "Usage: /WELCOME <#channel> [<message>|-]");
+		return;
+	}
+
+	if (strlen(parv[1]) > CHANNELLEN || *parv[1] != '#') {
+		sendnumeric(client, ERR_NOSUCHCHANNEL, parv[1]);
+		return;
+	}
+
+	if (parc < 3 || BadPtr(parv[2])) {
+		rw = runtime_find(parv[1]);
+		if (rw)
+			sendnotice(client, "Welcome for %s: %s", rw->channel, rw->text);
+		else
+			sendnotice(client, "No welcome set with /WELCOME for %s.", parv[1]);
+		return;
+	}
+
+	if (!strcmp(parv[2], "-")) {
+		runtime_set(parv[1], NULL);
+		sendnotice(client, "Welcome for %s cleared.", parv[1]);
+		return;
+	}
+
+	if (strlen(parv[2]) >= MAX_WELCOME_MSG) {
+		sendnotice(client, "Welcome message too long, maximum length is %d characters.", MAX_WELCOME_MSG - 1);
+		return;
+	}
+
+	if (!runtime_find(parv[1]) && runtime_count >= settings.max_runtime) {
+		sendnotice(client, "Too many welcomes set with /WELCOME already (%d), clear one first.", settings.max_runtime);
+		return;
+	}
+
+	runtime_set(parv[1], parv[2]);
+	sendnotice(client, "Welcome for %s set.", parv[1]);
+}
+
+RuntimeWelcome *runtime_find(const char *channel) {
+	RuntimeWelcome *rw;
+
+	for (rw = runtime_welcomes[siphash_nocase(channel, runtime_hashkey) % RUNTIME_HASH_SIZE]; rw; rw = rw->next) {
+		if (!strcasecmp(rw->channel, channel))
+			return rw;
+	}
+	return NULL;
+}
+
+static void runtime_free_entry(RuntimeWelcome *rw) {
+	safe_free(rw->text);
+	safe_free(rw->segs);
+	safe_free(rw);
+}
+
+// Set (text != NULL) or clear the runtime welcome of a channel
+void runtime_set(const char *channel, const char *text) {
+	RuntimeWelcome **rwp = &runtime_welcomes[siphash_nocase(channel, runtime_hashkey) % RUNTIME_HASH_SIZE];
+	RuntimeWelcome *rw;
+
+	for (; *rwp; rwp = &(*rwp)->next) {
+		if (!strcasecmp((*rwp)->channel, channel))
 			break;
+	}
+
+	// The cache may point at the entry we are about to free or replace
+	welcome_invalidate(channel);
+
+	if (*rwp) {
+		rw = *rwp;
+		*rwp = rw->next;
+		runtime_free_entry(rw);
+		runtime_count--;
+	}
+
+	if (text) {
+		rw = safe_alloc(sizeof(RuntimeWelcome));
+		strlcpy(rw->channel, channel, sizeof(rw->channel));
+		safe_strdup(rw->text, text);
+		rw->next = *rwp;
+		*rwp = rw;
+		runtime_count++;
+	}
+	runtime_dirty = 1;
+}
+
+void runtime_free_all(void) {
+	RuntimeWelcome *rw, *rw_next;
+
+	for (int i = 0; i < RUNTIME_HASH_SIZE; i++) {
+		for (rw = runtime_welcomes[i]; rw; rw = rw_next) {
+			rw_next = rw->next;
+			runtime_free_entry(rw);
 		}
+		runtime_welcomes[i] = NULL;
 	}
-	return HOOK_CONTINUE;
+	runtime_count = 0;
+}
+
+// Load runtime welcomes. Only the text is read, templates are compiled
+// per channel on first join. Returns 0 on a read error, with nothing
+// loaded: a partial set must never be written back over the file.
+int welcomedb_read(void) {
+	UnrealDB *db;
+	uint32_t magic = 0, version = 0;
+	uint64_t count = 0;
+	char *channel = NULL, *text = NULL;
+
+	if (access(settings.database, F_OK) != 0)
+		return 1; // Nothing saved yet
+
+	db = unrealdb_open(settings.database, UNREALDB_MODE_READ, NULL);
+	if (!db)
+		return 0;
+
+	if (!unrealdb_read_int32(db, &magic) || magic != WELCOMEDB_MAGIC ||
+	    !unrealdb_read_int32(db, &version) || version > WELCOMEDB_VERSION ||
+	    !unrealdb_read_int64(db, &count))
+		goto read_fail;
+
+	for (uint64_t i = 0; i < count; i++) {
+		if (!unrealdb_read_str(db, &channel) || !unrealdb_read_str(db, &text))
+			goto read_fail;
+		if (channel && text && !runtime_find(channel))
+			runtime_set(channel, text);
+		safe_free(channel);
+		safe_free(text);
+	}
+
+	unrealdb_close(db);
+	runtime_dirty = 0;
+	return 1;
+
+read_fail:
+	safe_free(channel);
+	safe_free(text);
+	unrealdb_close(db);
+	runtime_free_all();
+	runtime_dirty = 0;
+	return 0;
+}
+
+// Write all runtime welcomes to a temporary file and move it in place,
+// so a crash halfway never leaves a truncated database behind
+int welcomedb_write(void) {
+	char tmpfname[512];
+	UnrealDB *db;
+	RuntimeWelcome *rw;
+	uint64_t count = 0;
+
+	if (welcomedb_disabled)
+		return 0;
+
+	for (int i = 0; i < RUNTIME_HASH_SIZE; i++)
+		for (rw = runtime_welcomes[i]; rw; rw = rw->next)
+			count++;
+
+	snprintf(tmpfname, sizeof(tmpfname), "%s.%x.tmp", settings.database, getrandom32());
+	db = unrealdb_open(tmpfname, UNREALDB_MODE_WRITE, NULL);
+	if (!db)
+		goto fail;
+
+	if (!unrealdb_write_int32(db, WELCOMEDB_MAGIC) ||
+	    !unrealdb_write_int32(db, WELCOMEDB_VERSION) ||
+	    !unrealdb_write_int64(db, count))
+		goto fail_close;
+
+	for (int i = 0; i < RUNTIME_HASH_SIZE; i++) {
+		for (rw = runtime_welcomes[i]; rw; rw = rw->next) {
+			if (!unrealdb_write_str(db, rw->channel) || !unrealdb_write_str(db, rw->text))
+				goto fail_close;
+		}
+	}
+
+	if (!unrealdb_close(db))
+		goto fail;
+
+	if (unreal_rename(tmpfname, settings.database) < 0)
+		goto fail;
+
+	runtime_dirty = 0;
+	return 1;
+
+fail_close:
+	unrealdb_close(db);
+fail:
+	unreal_log(ULOG_ERROR, "welcomemessages", "WELCOMEDB_WRITE_ERROR", NULL,
+	           "[welcomemessages] Error writing to temporary database file $filename: $error",
+	           log_data_string("filename", tmpfname),
+	           log_data_string("error", unrealdb_get_error_string()));
+	unlink(tmpfname);
+	return 0;
+}
+
+// Changes are collected and written out together instead of one by one
+EVENT(welcomedb_save) {
+	if (runtime_dirty)
+		welcomedb_write();
+}
+
+// Variables that can be used in a welcome message
+static struct {
+	const char *name;
+	SegmentType type;
+} template_vars[] = {
+	{ "usercount", SEG_USERCOUNT },
+	{ "channel", SEG_CHANNEL },
+	{ "account", SEG_ACCOUNT },
+	{ "topic", SEG_TOPIC },
+	{ "nick", SEG_NICK },
+	{ NULL, SEG_LITERAL },
+};
+
+// Split text into segments. Writes them to out unless it is NULL, and
+// returns how many there are. "$$" is a literal "$", unknown variables
+// are left in as text.
+int template_parse(const char *text, Segment *out) {
+	const char *p = text, *lit = text;
+	int count = 0;
+
+#define EMIT(t, s, l) do { if (out) { out[count].type = (t); out[count].text = (s); out[count].len = (l); } count++; } while (0)
+
+	while (*p) {
+		if (*p != '$') {
+			p++;
+			continue;
+		}
+		if (p[1] == '$') {
+			EMIT(SEG_LITERAL, lit, p + 1 - lit); // up to and including the first '$'
+			p += 2;
+			lit = p;
+			continue;
+		}
+		int v;
+		for (v = 0; template_vars[v].name; v++) {
+			if (!strncmp(p + 1, template_vars[v].name, strlen(template_vars[v].name)))
+				break;
+		}
+		if (!template_vars[v].name) {
+			p++;
+			continue;
+		}
+		if (p > lit)
+			EMIT(SEG_LITERAL, lit, p - lit);
+		EMIT(template_vars[v].type, NULL, 0);
+		p += 1 + strlen(template_vars[v].name);
+		lit = p;
+	}
+	if (p > lit)
+		EMIT(SEG_LITERAL, lit, p - lit);
+
+#undef EMIT
+	return count;
+}
+
+// Render every line in one pass into a stack buffer and send it
+void template_send(Client *client, Channel *channel, const WelcomeTemplate *lines, int count) {
+	char buf[MAX_WELCOME_MSG * 2];
+	char num[16];
+
+	for (int l = 0; l < count; l++) {
+		size_t len = 0;
+
+		for (int i = 0; i < lines[l].count; i++) {
+			const Segment *seg = &lines[l].segs[i];
+			const char *text = NULL;
+			size_t n;
+
+			switch (seg->type) {
+				case SEG_LITERAL:
+					text = seg->text;
+					break;
+				case SEG_NICK:
+					text = client->name;
+					break;
+				case SEG_CHANNEL:
+					text = channel->name;
+					break;
+				case SEG_USERCOUNT:
+					snprintf(num, sizeof(num), "%d", channel->users);
+					text = num;
+					break;
+				case SEG_TOPIC:
+					text = channel->topic ? channel->topic : "";
+					break;
+				case SEG_ACCOUNT:
+					text = IsLoggedIn(client) ? client->user->account : "*";
+					break;
+			}
+
+			n = (seg->type == SEG_LITERAL) ? seg->len : strlen(text);
+			if (n > sizeof(buf) - 1 - len)
+				n = sizeof(buf) - 1 - len;
+			memcpy(buf + len, text, n);
+			len += n;
+		}
+		buf[len] = '\0';
+		sendnotice(client, "%s", buf);  // Use format string properly
+	}
+}
+
+void welcome_cache_free(ModData *m) {
+	safe_free(m->ptr);
+}
+
+static int is_wildcard_char(char c) {
+	return c == '*' || c == '?' || c == '\\';
+}
+
+// Find or create the child of 'parent' for character c
+static int prefix_child(int parent, unsigned char c) {
+	int n;
+
+	for (n = prefix_nodes[parent].child; n >= 0; n = prefix_nodes[n].sibling) {
+		if (prefix_nodes[n].c == c)
+			return n;
+	}
+
+	if (prefix_node_count == prefix_node_size) {
+		prefix_node_size *= 2;
+		prefix_nodes = realloc(prefix_nodes, sizeof(PrefixNode) * prefix_node_size);
+		if (!prefix_nodes)
+			outofmemory(sizeof(PrefixNode) * prefix_node_size);
+	}
+	n = prefix_node_count++;
+	prefix_nodes[n].c = c;
+	prefix_nodes[n].child = -1;
+	prefix_nodes[n].patterns = -1;
+	prefix_nodes[n].sibling = prefix_nodes[parent].child;
+	prefix_nodes[parent].child = n;
+	return n;
+}
+
+// Compile channel_messages into the exact hash table and the prefix trie
+void matcher_build(void) {
+	unsigned int buckets = 16;
+
+	matcher_free();
+	if (!channel_count)
+		return;
+
+	while (buckets < (unsigned int)channel_count * 2)
+		buckets <<= 1;
+	exact_mask = buckets - 1;
+	siphash_generate_key(exact_hashkey);
+	exact_buckets = safe_alloc(sizeof(int) * buckets);
+	memset(exact_buckets, -1, sizeof(int) * buckets);
+	exact_next = safe_alloc(sizeof(int) * channel_count);
+	pattern_next = safe_alloc(sizeof(int) * channel_count);
+
+	prefix_node_size = 64;
+	prefix_nodes = safe_alloc(sizeof(PrefixNode) * prefix_node_size);
+	prefix_node_count = 1;
+	prefix_nodes[0].child = prefix_nodes[0].sibling = prefix_nodes[0].patterns = -1;
+
+	for (int i = channel_count - 1; i >= 0; i--) {
+		const char *pattern = CM_CHANNEL(i);
+		const char *p;
+
+		exact_next[i] = pattern_next[i] = -1;
+
+		for (p = pattern; *p && !is_wildcard_char(*p); p++)
+			;
+
+		if (!*p) {
+			// Walking backwards and pushing on the head keeps chains ascending
+			unsigned int b = siphash_nocase(pattern, exact_hashkey) & exact_mask;
+			exact_next[i] = exact_buckets[b];
+			exact_buckets[b] = i;
+			continue;
+		}
+
+		int node = 0;
+		for (const char *q = pattern; q < p; q++)
+			node = prefix_child(node, (unsigned char)tolower((unsigned char)*q));
+		pattern_next[i] = prefix_nodes[node].patterns;
+		prefix_nodes[node].patterns = i;
+	}
+}
+
+void matcher_free(void) {
+	safe_free(exact_buckets);
+	safe_free(exact_next);
+	safe_free(pattern_next);
+	safe_free(prefix_nodes);
+	prefix_node_count = prefix_node_size = 0;
+	exact_mask = 0;
+}
+
+// Lowest pattern index on this node that matches, if lower than best
+static int match_node_patterns(int node, const char *name, int best) {
+	for (int i = prefix_nodes[node].patterns; i >= 0 && (best < 0 || i < best); i = pattern_next[i]) {
+		if (match_simple(CM_CHANNEL(i), name))
+			return i;
+	}
+	return best;
+}
+
+// Index of the first channel_messages entry matching name, -1 if none
+int matcher_lookup(const char *name) {
+	int best = -1;
+
+	if (!exact_buckets)
+		return -1;
+
+	unsigned int b = siphash_nocase(name, exact_hashkey) & exact_mask;
+	for (int i = exact_buckets[b]; i >= 0; i = exact_next[i]) {
+		if (!strcasecmp(CM_CHANNEL(i), name)) {
+			best = i;
+			break;
+		}
+	}
+
+	int node = 0;
+	best = match_node_patterns(node, name, best);
+	for (const char *p = name; *p; p++) {
+		unsigned char c = (unsigned char)tolower((unsigned char)*p);
+		int n;
+
+		for (n = prefix_nodes[node].child; n >= 0; n = prefix_nodes[n].sibling) {
+			if (prefix_nodes[n].c == c)
+				break;
+		}
+		if (n < 0)
+			break;
+		node = n;
+		best = match_node_patterns(node, name, best);
+	}
+	return best;
 }